@@ -3,92 +3,266 @@
 #include <fstream>
 #include <string>
 #include <unordered_map>
-#include <regex>
+#include <unordered_set>
 #include <thread> // Required for sleep_for
 #include <chrono> // Required for chrono
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <map>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cerrno>
+#include "wal.h"
+#include "money.h"
+#include "passengerrecord.h"
+#include "chunkedlist.h"
+#include "snapshot.h"
+#include "bookingfile.h"
+#include "bookingarchive.h"
+#include "waitlist.h"
+#include "payment.h"
+#include "paymentledger.h"
+#include "reconcile.h"
+#include "validation.h"
+#include "passwordhash.h"
+#include "userstore.h"
+#include "session.h"
+#include "ratelimit.h"
+#include "userimport.h"
+#include "userauth.h"
 
 using namespace std;
 
-// To store payment history for auditing purposes
-unordered_map<string, string> paymentHistory;
+// Every payment outcome and refund, for auditing
+PaymentLedger paymentLedger;
 
-unordered_map<string, pair<string, string>> users; // stores email, password pair;
+// Accounts, looked up on disk by email (users.db and users.idx)
+UserStore userStore;
 
-void addUser(const string &role);
-void removeUser();
+// Password hashing runs on its own threads at a cost calibrated at startup
+UserAuthenticator authenticator;
 
-struct Passenger
-{
-    string name;
-    int flightID;
-    string flightDate;
-    string flightTime;
-    double fare;
-    bool isPaid;          // To track whether the passenger has paid
-    double paymentAmount; // The actual amount paid by the passenger
-
-    Passenger(string _name, int _flightID, string _flightDate, string _flightTime, double _fare)
-        : name(_name), flightID(_flightID), flightDate(_flightDate), flightTime(_flightTime), fare(_fare), isPaid(false), paymentAmount(0) {}
-};
+// Logged-in users, so the menus do not ask for the password again
+SessionManager sessions;
 
-struct PassengerNode
-{
-    Passenger passenger; // The actual passenger data
-    PassengerNode *next; // Pointer to the next node in the list
+// Login attempts per account and per source, checked before any hashing
+LoginRateLimiter loginLimiter;
+string loginSource = "console"; // where this session's attempts come from
 
-    PassengerNode(Passenger _passenger) : passenger(_passenger), next(nullptr) {}
-};
+// Durable record of every booking, payment and flight change
+WriteAheadLog bookingLog;
+const string BOOKING_LOG_FILE = "bookings.wal";
+const string BOOKING_LOG_ARCHIVE = "bookings.wal.old"; // log covered by the snapshot being written
+const string SNAPSHOT_FILE = "bookings.snap";
+
+// Periodic snapshots so restarts replay only the log tail
+BackgroundSnapshotter snapshotter;
+uint64_t snapshotInterval = 10000; // log records between snapshots
+atomic<uint64_t> lastSnapshotLSN(0);   // newest record covered by a snapshot on disk
+atomic<uint64_t> failedSnapshotLSN(0); // capture point of the last snapshot that could not be written
+
+// Bookings of finished flights, kept in a memory-mapped file and reported on in place
+MappedBookingFile bookingHistory;
+const string BOOKING_HISTORY_FILE = "bookings.dat";
+const string BOOKING_ARCHIVE_FILE = "bookings.arc"; // compressed tier for old history
+const uint64_t HISTORY_FOLD_RECORDS = 100000;        // history file size at which it moves to the archive
 
+int bookingIDCounter = 1; // next booking ID handed out by bookFlight
+
+// Requests waiting for seats on full flights
+Waitlist waitlist;
+
+// Card payments are authorized by worker threads while the session goes on
+PaymentPipeline paymentPipeline;
+unordered_set<int> bookingsAwaitingPayment; // bookings in a payment that has not been applied yet
+
+void addUser(UserRole role);
+void removeUser();
+void importUsersFromFile();
+void exportUsersToFile();
+
+// Bookings in the order they were made. They used to be a linked list of
+// heap nodes; they now sit in copy-on-write chunks, so a snapshot captures
+// them by sharing chunks instead of copying every booking. A cancelled
+// booking leaves a hole (its ID negated) that is skipped, and the holes are
+// squeezed out once they make up half the list.
+//
+// Booking IDs are handed out in ascending order, so the list is sorted by
+// ID and a booking is found by binary search; holes keep their ID's place
+// in that order. Replaying Pay and Cancel records therefore costs a binary
+// search per record rather than a scan of every booking. Should a booking
+// ever be added out of order, lookups fall back to a scan.
 class BookingLinkedList
 {
 private:
-    PassengerNode *head;
+    ChunkedList<Passenger> slots;
+    size_t holes;
+    int lastID;   // highest booking ID added
+    bool ordered; // whether slots are in ascending ID order
+
+    static int idOf(const Passenger &slot) { return slot.bookingID < 0 ? -slot.bookingID : slot.bookingID; }
+
+    // Index of the slot for bookingID, live or a hole, or slots.size()
+    size_t position(int bookingID) const
+    {
+        if (!ordered)
+        {
+            for (size_t i = 0; i < slots.size(); ++i)
+                if (idOf(slots[i]) == bookingID)
+                    return i;
+            return slots.size();
+        }
+        size_t low = 0, high = slots.size();
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (idOf(slots[middle]) < bookingID)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low < slots.size() && idOf(slots[low]) == bookingID ? low : slots.size();
+    }
+
+    void removeAt(size_t i)
+    {
+        Passenger &slot = slots.edit(i);
+        slot.bookingID = -slot.bookingID;
+        holes++;
+    }
+
+    void compactIfSparse()
+    {
+        if (holes * 2 <= slots.size())
+            return;
+        ChunkedList<Passenger> kept;
+        for (size_t i = 0; i < slots.size(); ++i)
+            if (slots[i].bookingID > 0)
+                kept.push_back(slots[i]);
+        slots = move(kept);
+        holes = 0;
+    }
 
 public:
-    BookingLinkedList() : head(nullptr) {}
+    // The bookings as they were when image() was called, for the snapshot thread
+    class Image
+    {
+    private:
+        friend class BookingLinkedList;
+        ChunkedList<Passenger>::Image slots;
+        size_t live;
 
-    // Add a new booking to the linked list
-    void addBooking(const Passenger &passenger)
+    public:
+        Image() : live(0) {}
+
+        size_t size() const { return live; }
+
+        template <typename Visit>
+        void forEach(Visit visit) const
+        {
+            slots.forEach([&visit](const Passenger &booking)
+                          {
+                              if (booking.bookingID > 0)
+                                  visit(booking); });
+        }
+    };
+
+    BookingLinkedList() : holes(0), lastID(0), ordered(true) {}
+
+    // Add a new booking at the end
+    void addBooking(Passenger passenger)
     {
-        PassengerNode *newNode = new PassengerNode(passenger);
-        if (!head)
+        if (passenger.bookingID <= lastID)
+            ordered = false;
+        lastID = max(lastID, static_cast<int>(passenger.bookingID));
+        slots.push_back(move(passenger));
+    }
+
+    // Copy bookings in list order (all of them, or only one flight's)
+    void collectBookings(vector<Passenger> &out, int flightID = 0)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
         {
-            head = newNode;
+            const Passenger &booking = slots[i];
+            if (booking.bookingID > 0 && (flightID == 0 || booking.flightID == flightID))
+                out.push_back(booking);
         }
-        else
+    }
+
+    // Drop every booking of a flight, returning how many were removed
+    int removeFlightBookings(int flightID)
+    {
+        int removed = 0;
+        for (size_t i = 0; i < slots.size(); ++i)
         {
-            PassengerNode *current = head;
-            while (current->next)
+            if (slots[i].bookingID > 0 && slots[i].flightID == flightID)
             {
-                current = current->next;
+                removeAt(i);
+                removed++;
             }
-            current->next = newNode;
         }
+        compactIfSparse();
+        return removed;
+    }
+
+    // Find a booking by its ID to change it (nullptr if there is none)
+    Passenger *findBooking(int bookingID)
+    {
+        size_t i = position(bookingID);
+        if (bookingID <= 0 || i == slots.size() || slots[i].bookingID != bookingID)
+            return nullptr;
+        return &slots.edit(i);
+    }
+
+    // Remove a booking, copying it into removed so the caller can release its seat
+    bool cancelBooking(int bookingID, Passenger *removed = nullptr)
+    {
+        size_t i = position(bookingID);
+        if (bookingID <= 0 || i == slots.size() || slots[i].bookingID != bookingID)
+            return false;
+        if (removed)
+            *removed = slots[i];
+        removeAt(i);
+        compactIfSparse();
+        return true;
     }
 
     // Display all bookings
     void displayBookingsWithPayments()
     {
-        if (!head)
+        if (slots.size() == holes)
         {
             cout << "No bookings found.\n";
             return;
         }
 
-        PassengerNode *current = head;
-        while (current)
+        for (size_t i = 0; i < slots.size(); ++i)
         {
-            // Accessing Passenger object fields through current->passenger
-            cout << "Passenger: " << current->passenger.name
-                 << ", Flight ID: " << current->passenger.flightID
-                 << ", Date: " << current->passenger.flightDate
-                 << ", Time: " << current->passenger.flightTime
-                 << ", Fare: " << current->passenger.fare << " PKR"
-                 << ", Paid: " << (current->passenger.isPaid ? "Yes" : "No")
-                 << ", Amount Paid: " << current->passenger.paymentAmount << " PKR\n";
-            current = current->next;
+            const Passenger &booking = slots[i];
+            if (booking.bookingID <= 0)
+                continue;
+            cout << "Booking ID: " << booking.bookingID
+                 << ", Passenger: " << booking.name()
+                 << ", Flight ID: " << booking.flightID
+                 << ", Date: " << booking.flightDate()
+                 << ", Time: " << booking.flightTime()
+                 << ", Fare: " << booking.fare()
+                 << ", Paid: " << (booking.isPaid() ? "Yes" : "No")
+                 << ", Amount Paid: " << booking.paymentAmount() << "\n";
         }
     }
+
+    size_t size() const { return slots.size() - holes; }
+
+    Image image() const
+    {
+        Image copy;
+        copy.slots = slots.image();
+        copy.live = size();
+        return copy;
+    }
 };
 
 struct Flight
@@ -98,11 +272,11 @@ struct Flight
     string destination;
     string date;
     string time;
-    double fare;
+    Money fare;
     int availableSeats;
 
-    Flight() : flightID(0), fare(0.0), availableSeats(0) {}
-    Flight(int id, string o, string d, string da, string t, double f, int s)
+    Flight() : flightID(0), availableSeats(0) {}
+    Flight(int id, string o, string d, string da, string t, Money f, int s)
         : flightID(id), origin(o), destination(d), date(da), time(t), fare(f), availableSeats(s) {}
 };
 
@@ -135,6 +309,16 @@ private:
         return node;
     }
 
+    // In-order traversal collecting copies of all flights
+    void collect(BSTNode *node, vector<Flight> &out)
+    {
+        if (!node)
+            return;
+        collect(node->left, out);
+        out.push_back(node->flight);
+        collect(node->right, out);
+    }
+
     // In-order traversal to display all flights
     void inOrder(BSTNode *node)
     {
@@ -150,7 +334,7 @@ private:
     {
         cout << "Flight ID: " << flight.flightID << ", Origin: " << flight.origin
              << ", Destination: " << flight.destination << ", Date: " << flight.date
-             << ", Time: " << flight.time << ", Fare: RS" << flight.fare
+             << ", Time: " << flight.time << ", Fare: " << flight.fare
              << ", Available Seats: " << flight.availableSeats << endl;
     }
 
@@ -194,6 +378,21 @@ private:
                bookSeatsHelper(node->right, flightID, numSeats);
     }
 
+    bool releaseSeatsHelper(BSTNode *node, int flightID, int numSeats)
+    {
+        if (!node)
+            return false;
+
+        if (node->flight.flightID == flightID)
+        {
+            node->flight.availableSeats += numSeats;
+            return true;
+        }
+
+        return releaseSeatsHelper(node->left, flightID, numSeats) ||
+               releaseSeatsHelper(node->right, flightID, numSeats);
+    }
+
 public:
     FlightBST() : root(nullptr), flightIDCounter(1) {}
 
@@ -201,8 +400,21 @@ public:
     void insertFlight(const Flight &flight)
     {
         root = insert(root, flight);
+        flightSchedule().set(flight.flightID, flight.date, flight.time);
+        if (flight.flightID >= flightIDCounter)
+            flightIDCounter = flight.flightID + 1;
+    }
+
+    // Copy every flight for a snapshot
+    void collectFlights(vector<Flight> &out)
+    {
+        collect(root, out);
     }
 
+    int nextFlightID() const { return flightIDCounter; }
+
+    void setNextFlightID(int id) { flightIDCounter = id; }
+
     // Display all available flights
     void displayAllFlights()
     {
@@ -215,11 +427,12 @@ public:
         inOrder(root);
     }
 
-    // Add flight to the BST with auto-generated ID
-    void addFlight(string origin, string destination, string date, string time, double fare, int seats)
+    // Add flight to the BST with auto-generated ID, returning the new ID
+    int addFlight(string origin, string destination, string date, string time, Money fare, int seats)
     {
         Flight newFlight(flightIDCounter++, origin, destination, date, time, fare, seats);
         insertFlight(newFlight);
+        return newFlight.flightID;
     }
 
     // Search for flights based on criteria
@@ -234,35 +447,61 @@ public:
         return bookSeatsHelper(root, flightID, numSeats);
     }
 
-    bool updateFlight(int flightID, const string &newTime, double newFare, int newSeats)
+    // Give seats back to a flight after a cancellation
+    bool releaseSeats(int flightID, int numSeats)
+    {
+        return releaseSeatsHelper(root, flightID, numSeats);
+    }
+
+    // Flights are ordered by time, so lookups by ID have to visit every node
+    BSTNode *findFlightNode(BSTNode *node, int flightID)
+    {
+        if (!node)
+            return nullptr;
+        if (node->flight.flightID == flightID)
+            return node;
+        BSTNode *found = findFlightNode(node->left, flightID);
+        return found ? found : findFlightNode(node->right, flightID);
+    }
+
+    bool updateFlight(int flightID, const string &newTime, Money newFare, int newSeats)
     {
-        BSTNode *node = root;
-        while (node)
+        BSTNode *node = findFlightNode(root, flightID);
+        if (!node)
+            return false; // Flight not found
+
+        Flight updated = node->flight;
+        updated.time = newTime;
+        updated.fare = newFare;
+        updated.availableSeats = newSeats;
+        if (newTime == node->flight.time)
         {
-            if (node->flight.flightID == flightID)
-            {
-                node->flight.time = newTime;
-                node->flight.fare = newFare;
-                node->flight.availableSeats = newSeats;
-                return true;
-            }
-            else if (flightID < node->flight.flightID)
-                node = node->left;
-            else
-                node = node->right;
+            node->flight = updated;
         }
-        return false; // Flight not found
+        else
+        {
+            // A new time moves the flight within the tree
+            removeFlight(flightID);
+            insertFlight(updated);
+        }
+        return true;
     }
 
-    BSTNode *removeFlight(BSTNode *node, int flightID)
+    // Remove the node holding flightID, navigating by its departure time
+    BSTNode *removeFlight(BSTNode *node, const string &time, int flightID)
     {
         if (!node)
             return node;
 
-        if (flightID < node->flight.flightID)
-            node->left = removeFlight(node->left, flightID);
-        else if (flightID > node->flight.flightID)
-            node->right = removeFlight(node->right, flightID);
+        if (time < node->flight.time)
+            node->left = removeFlight(node->left, time, flightID);
+        else if (time > node->flight.time || node->flight.flightID != flightID)
+        {
+            // Equal times normally sit on the right, but may be on either side after a removal
+            node->right = removeFlight(node->right, time, flightID);
+            if (time == node->flight.time)
+                node->left = removeFlight(node->left, time, flightID);
+        }
         else
         {
             if (!node->left)
@@ -280,25 +519,16 @@ public:
 
             BSTNode *temp = findMin(node->right);
             node->flight = temp->flight;
-            node->right = removeFlight(node->right, temp->flight.flightID);
+            node->right = removeFlight(node->right, temp->flight.time, temp->flight.flightID);
         }
         return node;
     }
 
     Flight getFlightByID(int flightID)
     {
-        BSTNode *node = root;
-        while (node)
-        {
-            if (node->flight.flightID == flightID)
-            {
-                return node->flight;
-            }
-            else if (flightID < node->flight.flightID)
-                node = node->left;
-            else
-                node = node->right;
-        }
+        BSTNode *node = findFlightNode(root, flightID);
+        if (node)
+            return node->flight;
 
         // If the flight is not found, we can throw an exception or return a default Flight object.
         throw runtime_error("Flight not found");
@@ -315,13 +545,770 @@ public:
     // Public function to remove a flight
     bool removeFlight(int flightID)
     {
-        root = removeFlight(root, flightID);
+        BSTNode *node = findFlightNode(root, flightID);
+        if (!node)
+            return false;
+        root = removeFlight(root, node->flight.time, flightID);
         return true;
     }
 };
 
-// Function to process payment (using the original fare set when adding/updating flights)
-bool processPayment(const string &userName, int fare)
+// Running totals for one flight, route or day
+struct BookingTotals
+{
+    int paidBookings;
+    int unpaidBookings;
+    Money revenue; // sum of amounts actually paid
+
+    BookingTotals() : paidBookings(0), unpaidBookings(0) {}
+};
+
+struct FlightStats
+{
+    string route; // "Origin-Destination"
+    string date;
+    int bookedSeats;
+    int availableSeats;
+    bool removed;
+    BookingTotals totals;
+
+    FlightStats() : bookedSeats(0), availableSeats(0), removed(false) {}
+};
+
+// Revenue and load-factor views kept up to date on every flight change,
+// booking, payment and cancellation, so the admin dashboard reads the
+// aggregates directly instead of walking every booking
+class BookingStats
+{
+private:
+    unordered_map<int, FlightStats> flights;
+    unordered_map<string, BookingTotals> routes;
+    unordered_map<string, BookingTotals> days;
+    BookingTotals overall;
+
+    // Apply a change to the flight's totals and its route and day totals
+    template <typename Change>
+    void updateGroups(int flightID, Change change)
+    {
+        FlightStats &stats = flights[flightID];
+        change(stats.totals);
+        change(routes[stats.route]);
+        change(days[stats.date]);
+    }
+
+    // ... and to the overall totals
+    template <typename Change>
+    void update(int flightID, Change change)
+    {
+        updateGroups(flightID, change);
+        change(overall);
+    }
+
+public:
+    void flightAdded(const Flight &flight)
+    {
+        FlightStats &stats = flights[flight.flightID];
+        stats.route = flight.origin + "-" + flight.destination;
+        stats.date = flight.date;
+        stats.availableSeats = flight.availableSeats;
+        stats.removed = false;
+    }
+
+    void flightUpdated(int flightID, int newSeats) { flights[flightID].availableSeats = newSeats; }
+
+    // Revenue already taken stays in the route and day totals
+    void flightRemoved(int flightID) { flights[flightID].removed = true; }
+
+    void booked(const Passenger &passenger)
+    {
+        FlightStats &stats = flights[passenger.flightID];
+        stats.bookedSeats++;
+        stats.availableSeats--;
+        update(passenger.flightID, [](BookingTotals &t)
+               { t.unpaidBookings++; });
+        if (passenger.isPaid())
+            paid(passenger);
+    }
+
+    void paid(const Passenger &passenger)
+    {
+        Money amount = passenger.paymentAmount();
+        update(passenger.flightID, [amount](BookingTotals &t)
+               {
+                   t.unpaidBookings--;
+                   t.paidBookings++;
+                   t.revenue += amount; });
+    }
+
+    // A cancelled paid booking is refunded
+    void cancelled(const Passenger &passenger)
+    {
+        FlightStats &stats = flights[passenger.flightID];
+        stats.bookedSeats--;
+        stats.availableSeats++;
+        bool wasPaid = passenger.isPaid();
+        Money amount = passenger.paymentAmount();
+        update(passenger.flightID, [wasPaid, amount](BookingTotals &t)
+               {
+                   if (wasPaid)
+                   {
+                       t.paidBookings--;
+                       t.revenue -= amount;
+                   }
+                   else
+                       t.unpaidBookings--; });
+    }
+
+    const unordered_map<int, FlightStats> &perFlight() const { return flights; }
+    const unordered_map<string, BookingTotals> &perRoute() const { return routes; }
+    const unordered_map<string, BookingTotals> &perDay() const { return days; }
+    const BookingTotals &total() const { return overall; }
+
+    // Load factor of a flight in percent: booked seats over capacity
+    static double loadFactor(const FlightStats &stats)
+    {
+        int capacity = stats.bookedSeats + stats.availableSeats;
+        return capacity > 0 ? 100.0 * stats.bookedSeats / capacity : 0.0;
+    }
+
+    // Recompute every view from the current flights and bookings. The
+    // overall revenue is summed from one contiguous column of paid amounts.
+    void rebuild(const vector<Flight> &allFlights, const vector<Passenger> &bookings)
+    {
+        clear();
+        for (const Flight &flight : allFlights)
+            flightAdded(flight);
+        vector<int64_t> paidAmounts;
+        paidAmounts.reserve(bookings.size());
+        for (const Passenger &passenger : bookings)
+        {
+            flights[passenger.flightID].bookedSeats++;
+            updateGroups(passenger.flightID, [&passenger](BookingTotals &t)
+                         {
+                             if (passenger.isPaid())
+                             {
+                                 t.paidBookings++;
+                                 t.revenue += passenger.paymentAmount();
+                             }
+                             else
+                                 t.unpaidBookings++; });
+            if (passenger.isPaid())
+            {
+                overall.paidBookings++;
+                paidAmounts.push_back(passenger.paymentAmount().minor);
+            }
+            else
+                overall.unpaidBookings++;
+        }
+        overall.revenue.minor = sumMinorUnits(paidAmounts.data(), paidAmounts.size());
+    }
+
+    void clear()
+    {
+        flights.clear();
+        routes.clear();
+        days.clear();
+        overall = BookingTotals();
+    }
+
+    void encode(WalBuffer &out) const
+    {
+        auto putTotals = [&out](const BookingTotals &t)
+        {
+            out.putI32(t.paidBookings);
+            out.putI32(t.unpaidBookings);
+            putMoney(out, t.revenue);
+        };
+        out.putU64(flights.size());
+        for (const auto &entry : flights)
+        {
+            out.putI32(entry.first);
+            out.putString(entry.second.route);
+            out.putString(entry.second.date);
+            out.putI32(entry.second.bookedSeats);
+            out.putI32(entry.second.availableSeats);
+            out.putU8(entry.second.removed ? 1 : 0);
+            putTotals(entry.second.totals);
+        }
+        for (const auto *table : {&routes, &days})
+        {
+            out.putU64(table->size());
+            for (const auto &entry : *table)
+            {
+                out.putString(entry.first);
+                putTotals(entry.second);
+            }
+        }
+        putTotals(overall);
+    }
+
+    void decode(WalCursor &in)
+    {
+        clear();
+        auto getTotals = [&in](BookingTotals &t)
+        {
+            t.paidBookings = in.getI32();
+            t.unpaidBookings = in.getI32();
+            t.revenue = getMoney(in);
+        };
+        uint64_t count = in.getU64();
+        for (uint64_t i = 0; i < count && in.ok(); ++i)
+        {
+            FlightStats &stats = flights[in.getI32()];
+            stats.route = in.getString();
+            stats.date = in.getString();
+            stats.bookedSeats = in.getI32();
+            stats.availableSeats = in.getI32();
+            stats.removed = in.getU8() != 0;
+            getTotals(stats.totals);
+        }
+        for (auto *table : {&routes, &days})
+        {
+            count = in.getU64();
+            for (uint64_t i = 0; i < count && in.ok(); ++i)
+            {
+                string key = in.getString();
+                getTotals((*table)[key]);
+            }
+        }
+        getTotals(overall);
+    }
+};
+
+BookingStats bookingStats;
+
+// Write-ahead log helpers: each state change is committed to bookings.wal
+// before the user is told it succeeded
+void logCommit(WalRecordType type, const WalBuffer &payload)
+{
+    if (bookingLog.isOpen() && !bookingLog.commit(type, payload))
+        cout << "Warning: could not write to the booking log.\n";
+}
+
+void logFlightAdd(const Flight &flight)
+{
+    bookingStats.flightAdded(flight);
+    WalBuffer payload;
+    payload.putI32(flight.flightID);
+    payload.putString(flight.origin);
+    payload.putString(flight.destination);
+    payload.putString(flight.date);
+    payload.putString(flight.time);
+    putMoney(payload, flight.fare);
+    payload.putI32(flight.availableSeats);
+    logCommit(WalRecordType::FlightAdd, payload);
+}
+
+void logFlightUpdate(int flightID, const string &newTime, const Money &newFare, int newSeats)
+{
+    bookingStats.flightUpdated(flightID, newSeats);
+    WalBuffer payload;
+    payload.putI32(flightID);
+    payload.putString(newTime);
+    putMoney(payload, newFare);
+    payload.putI32(newSeats);
+    logCommit(WalRecordType::FlightUpdate, payload);
+}
+
+void logFlightRemove(int flightID)
+{
+    bookingStats.flightRemoved(flightID);
+    WalBuffer payload;
+    payload.putI32(flightID);
+    logCommit(WalRecordType::FlightRemove, payload);
+}
+
+// Bookings are appended one by one and made durable together by the caller
+uint64_t logBooking(const Passenger &passenger)
+{
+    WalBuffer payload;
+    payload.putI32(passenger.bookingID);
+    payload.putString(passenger.name());
+    payload.putI32(passenger.flightID);
+    payload.putString(passenger.flightDate());
+    payload.putString(passenger.flightTime());
+    putMoney(payload, passenger.fare());
+    return bookingLog.isOpen() ? bookingLog.append(WalRecordType::Book, payload) : 0;
+}
+
+void logWaitlistAdd(const WaitlistEntry &entry)
+{
+    WalBuffer payload;
+    payload.putI32(entry.waitID);
+    payload.putI32(entry.flightID);
+    payload.putI32(entry.priorityClass);
+    payload.putU64(entry.sequence);
+    payload.putU32(static_cast<uint32_t>(entry.passengerNames.size()));
+    for (const string &name : entry.passengerNames)
+        payload.putString(name);
+    logCommit(WalRecordType::WaitlistAdd, payload);
+}
+
+WaitlistEntry readWaitlistEntry(WalCursor &in)
+{
+    WaitlistEntry entry;
+    entry.waitID = in.getI32();
+    entry.flightID = in.getI32();
+    entry.priorityClass = in.getI32();
+    entry.sequence = in.getU64();
+    uint32_t count = in.getU32();
+    for (uint32_t i = 0; i < count && in.ok(); ++i)
+        entry.passengerNames.push_back(in.getString());
+    return entry;
+}
+
+// Promotions are appended and made durable with the bookings they create
+uint64_t logWaitlistPromote(int waitID)
+{
+    WalBuffer payload;
+    payload.putI32(waitID);
+    return bookingLog.isOpen() ? bookingLog.append(WalRecordType::WaitlistPromote, payload) : 0;
+}
+
+void logCancel(int bookingID, int64_t timestamp)
+{
+    WalBuffer payload;
+    payload.putI32(bookingID);
+    payload.putI64(timestamp);
+    logCommit(WalRecordType::Cancel, payload);
+}
+
+void logPayment(const string &userName, const Money &amount, const vector<int> &bookingIDs, LedgerStatus status,
+                int64_t timestamp, uint64_t requestID)
+{
+    WalBuffer payload;
+    payload.putString(userName);
+    putMoney(payload, amount);
+    payload.putU32(static_cast<uint32_t>(bookingIDs.size()));
+    for (int id : bookingIDs)
+        payload.putI32(id);
+    payload.putU8(static_cast<uint8_t>(status));
+    payload.putI64(timestamp);
+    payload.putU64(requestID);
+    logCommit(WalRecordType::Pay, payload);
+}
+
+// Apply a payment outcome to its bookings and the ledger: one entry per
+// booking still waiting for payment, which an approval also marks paid.
+// Shared by the live path and log replay so both record the same entries.
+void applyPayment(BookingLinkedList &bookingList, const string &payer, const vector<int> &bookingIDs,
+                  LedgerStatus status, int64_t timestamp, uint64_t requestID)
+{
+    for (int id : bookingIDs)
+    {
+        Passenger *booking = bookingList.findBooking(id);
+        if (!booking || booking->isPaid()) // cancelled while authorizing
+            continue;
+        if (status == LedgerStatus::Approved)
+        {
+            booking->markPaid(booking->fare());
+            bookingStats.paid(*booking);
+        }
+        paymentLedger.append(payer, id, booking->fare(), status, timestamp, requestID);
+    }
+}
+
+// Ledger entry for cancelling a booking that had been paid for
+void recordRefund(const Passenger &removed, int64_t timestamp)
+{
+    if (!removed.isPaid())
+        return;
+    const string *payer = paymentLedger.payerOf(removed.bookingID);
+    paymentLedger.append(payer ? *payer : removed.name(), removed.bookingID, removed.paymentAmount(),
+                         LedgerStatus::Refunded, timestamp, 0);
+}
+
+// Rebuild flights, bookings and the payment ledger from a log file, skipping
+// records at or before afterLSN (already in the snapshot). lastLSN is raised
+// to the newest record seen. Returns false if nothing was applied.
+bool replayBookingLog(const string &path, uint64_t afterLSN, FlightBST &flightBST, BookingLinkedList &bookingList,
+                      uint64_t &lastLSN, long *validBytes = nullptr)
+{
+    size_t applied = 0;
+    uint64_t fileLSN = WriteAheadLog::replay(
+        path, [&](uint64_t lsn, WalRecordType type, WalCursor &in)
+        {
+            if (lsn <= afterLSN)
+                return;
+            applied++;
+            switch (type)
+            {
+            case WalRecordType::FlightAdd:
+            {
+                Flight flight;
+                flight.flightID = in.getI32();
+                flight.origin = in.getString();
+                flight.destination = in.getString();
+                flight.date = in.getString();
+                flight.time = in.getString();
+                flight.fare = getMoney(in);
+                flight.availableSeats = in.getI32();
+                flightBST.insertFlight(flight);
+                bookingStats.flightAdded(flight);
+                break;
+            }
+            case WalRecordType::FlightUpdate:
+            {
+                int flightID = in.getI32();
+                string newTime = in.getString();
+                Money newFare = getMoney(in);
+                int newSeats = in.getI32();
+                flightBST.updateFlight(flightID, newTime, newFare, newSeats);
+                bookingStats.flightUpdated(flightID, newSeats);
+                break;
+            }
+            case WalRecordType::FlightRemove:
+            {
+                int flightID = in.getI32();
+                flightBST.removeFlight(flightID);
+                bookingStats.flightRemoved(flightID);
+                waitlist.clearFlight(flightID);
+                break;
+            }
+            case WalRecordType::Book:
+            {
+                int bookingID = in.getI32();
+                string name = in.getString();
+                int flightID = in.getI32();
+                string date = in.getString();
+                string time = in.getString();
+                Money fare = getMoney(in);
+                flightBST.bookSeats(flightID, 1);
+                flightSchedule().remember(flightID, date, time);
+                Passenger booking(bookingID, name, flightID, fare);
+                bookingStats.booked(booking);
+                bookingList.addBooking(move(booking));
+                bookingIDCounter = max(bookingIDCounter, bookingID + 1);
+                break;
+            }
+            case WalRecordType::Cancel:
+            {
+                Passenger removed(0, "", 0, Money());
+                int bookingID = in.getI32();
+                int64_t timestamp = in.remaining() > 0 ? in.getI64() : 0; // not logged before the ledger
+                if (bookingList.cancelBooking(bookingID, &removed))
+                {
+                    flightBST.releaseSeats(removed.flightID, 1);
+                    bookingStats.cancelled(removed);
+                    recordRefund(removed, timestamp);
+                }
+                break;
+            }
+            case WalRecordType::Pay:
+            {
+                string userName = in.getString();
+                // Version 1 logged the truncated whole-rupee amount
+                if (in.formatVersion() < 2)
+                    in.getI32();
+                else
+                    getMoney(in);
+                uint32_t count = in.getU32();
+                vector<int> bookingIDs;
+                for (uint32_t i = 0; i < count && in.ok(); ++i)
+                    bookingIDs.push_back(in.getI32());
+
+                // Records from before the ledger were always approvals with no time
+                LedgerStatus status = LedgerStatus::Approved;
+                int64_t timestamp = 0;
+                uint64_t requestID = 0;
+                if (in.remaining() > 0)
+                {
+                    status = static_cast<LedgerStatus>(in.getU8());
+                    timestamp = in.getI64();
+                    requestID = in.getU64();
+                }
+                applyPayment(bookingList, userName, bookingIDs, status, timestamp, requestID);
+                break;
+            }
+            case WalRecordType::Archive:
+                bookingList.removeFlightBookings(in.getI32());
+                break;
+            case WalRecordType::WaitlistAdd:
+                waitlist.restore(readWaitlistEntry(in));
+                break;
+            case WalRecordType::WaitlistPromote:
+                waitlist.withdraw(in.getI32()); // the Book records that follow recreate the seats
+                break;
+            } },
+        validBytes);
+    lastLSN = max(lastLSN, fileLSN);
+    return applied > 0;
+}
+
+// Snapshot body: counters, flights, names, flight dates, bookings and the
+// payment ledger. Runs on the snapshot thread, so flight dates come from a
+// copy of the schedule, and only the first nameCount names are read: the
+// pool may grow meanwhile, but names already in it do not move.
+void encodeSnapshot(int nextFlightID, const vector<Flight> &flights, size_t nameCount,
+                    const BookingLinkedList::Image &bookings, const FlightSchedule &schedule,
+                    const PaymentLedger::Image &payments, const BookingStats &stats, const Waitlist &queued,
+                    WalBuffer &out)
+{
+    out.bytes.reserve(64 + flights.size() * 64 + nameCount * 24 + bookings.size() * 30 + payments.entries.size() * 34);
+    out.putI32(nextFlightID);
+    out.putI32(bookingIDCounter);
+
+    out.putU64(flights.size());
+    for (const Flight &flight : flights)
+    {
+        out.putI32(flight.flightID);
+        out.putString(flight.origin);
+        out.putString(flight.destination);
+        out.putString(flight.date);
+        out.putString(flight.time);
+        putMoney(out, flight.fare);
+        out.putI32(flight.availableSeats);
+    }
+
+    // Bookings refer to names by their ID in the pool
+    out.putU64(nameCount);
+    for (size_t id = 0; id < nameCount; ++id)
+        out.putString(passengerNames().get(static_cast<uint32_t>(id)));
+
+    uint64_t scheduled = 0;
+    schedule.forEach([&scheduled](int, const FlightSlot &)
+                     { scheduled++; });
+    out.putU64(scheduled);
+    schedule.forEach([&out](int flightID, const FlightSlot &slot)
+                     {
+                         out.putI32(flightID);
+                         out.putString(slot.date);
+                         out.putString(slot.time); });
+
+    out.putU64(bookings.size());
+    bookings.forEach([&out](const Passenger &booking)
+                     {
+                         out.putI32(booking.bookingID);
+                         out.putU32(booking.nameID);
+                         out.putI32(booking.flightID);
+                         putMoney(out, booking.fare());
+                         out.putU8(booking.isPaid() ? 1 : 0);
+                         putMoney(out, booking.paymentAmount()); });
+
+    payments.encode(out);
+
+    stats.encode(out);
+
+    uint64_t waiting = 0;
+    queued.forEach([&waiting](const WaitlistEntry &)
+                   { waiting++; });
+    out.putU64(waiting);
+    queued.forEach([&out](const WaitlistEntry &entry)
+                     {
+                       out.putI32(entry.waitID);
+                       out.putI32(entry.flightID);
+                       out.putI32(entry.priorityClass);
+                       out.putU64(entry.sequence);
+                       out.putU32(static_cast<uint32_t>(entry.passengerNames.size()));
+                       for (const string &name : entry.passengerNames)
+                           out.putString(name); });
+}
+
+// Load the latest snapshot into empty structures. Returns false if there is none.
+bool loadSnapshot(FlightBST &flightBST, BookingLinkedList &bookingList, uint64_t &lsn)
+{
+    vector<uint8_t> body;
+    uint32_t version;
+    if (!readSnapshotFile(SNAPSHOT_FILE, lsn, body, version))
+        return false;
+
+    WalCursor in(body.data(), body.size(), version);
+    int nextFlightID = in.getI32();
+    bookingIDCounter = in.getI32();
+
+    uint64_t flightCount = in.getU64();
+    for (uint64_t i = 0; i < flightCount && in.ok(); ++i)
+    {
+        Flight flight;
+        flight.flightID = in.getI32();
+        flight.origin = in.getString();
+        flight.destination = in.getString();
+        flight.date = in.getString();
+        flight.time = in.getString();
+        flight.fare = getMoney(in);
+        flight.availableSeats = in.getI32();
+        flightBST.insertFlight(flight);
+    }
+    flightBST.setNextFlightID(nextFlightID);
+
+    bool intact = true;
+    if (version >= 4)
+    {
+        // Names and flight dates are stored once and bookings refer to them
+        vector<uint32_t> nameIDs;
+        uint64_t nameCount = in.getU64();
+        for (uint64_t i = 0; i < nameCount && in.ok(); ++i)
+            nameIDs.push_back(passengerNames().intern(in.getString()));
+
+        uint64_t scheduled = in.getU64();
+        for (uint64_t i = 0; i < scheduled && in.ok(); ++i)
+        {
+            int flightID = in.getI32();
+            string date = in.getString();
+            string time = in.getString();
+            flightSchedule().remember(flightID, date, time);
+        }
+
+        uint64_t bookingCount = in.getU64();
+        for (uint64_t i = 0; i < bookingCount && in.ok(); ++i)
+        {
+            int bookingID = in.getI32();
+            uint32_t nameRef = in.getU32();
+            int flightID = in.getI32();
+            Money fare = getMoney(in);
+            bool paid = in.getU8() != 0;
+            Money amount = getMoney(in);
+            if (nameRef >= nameIDs.size())
+            {
+                intact = false;
+                break;
+            }
+            Passenger booking(bookingID, nameIDs[nameRef], flightID, fare);
+            if (paid)
+                booking.markPaid(amount);
+            bookingList.addBooking(booking);
+        }
+    }
+    else
+    {
+        uint64_t bookingCount = in.getU64();
+        for (uint64_t i = 0; i < bookingCount && in.ok(); ++i)
+        {
+            int bookingID = in.getI32();
+            string name = in.getString();
+            int flightID = in.getI32();
+            string date = in.getString();
+            string time = in.getString();
+            Money fare = getMoney(in);
+            flightSchedule().remember(flightID, date, time);
+            Passenger booking(bookingID, name, flightID, fare);
+            bool paid = in.getU8() != 0;
+            Money amount = getMoney(in);
+            if (paid)
+                booking.markPaid(amount);
+            bookingList.addBooking(booking);
+        }
+    }
+
+    if (version >= 3)
+    {
+        paymentLedger.decode(in);
+    }
+    else
+    {
+        // Older snapshots kept only the last payment text per payer. Carry
+        // the paid bookings into the ledger as approvals with no known time.
+        uint64_t paymentCount = in.getU64();
+        for (uint64_t i = 0; i < paymentCount && in.ok(); ++i)
+        {
+            in.getString();
+            in.getString();
+        }
+        vector<Passenger> bookings;
+        bookingList.collectBookings(bookings);
+        for (const Passenger &booking : bookings)
+            if (booking.isPaid())
+                paymentLedger.append(booking.name(), booking.bookingID, booking.paymentAmount(), LedgerStatus::Approved,
+                                     0, 0);
+    }
+
+    // Snapshots written before the dashboard views existed end here
+    if (in.remaining() > 0)
+    {
+        bookingStats.decode(in);
+    }
+    else
+    {
+        vector<Flight> flights;
+        vector<Passenger> bookings;
+        flightBST.collectFlights(flights);
+        bookingList.collectBookings(bookings);
+        bookingStats.rebuild(flights, bookings);
+    }
+
+    if (in.remaining() > 0)
+    {
+        uint64_t waiting = in.getU64();
+        for (uint64_t i = 0; i < waiting && in.ok(); ++i)
+            waitlist.restore(readWaitlistEntry(in));
+    }
+
+    lastSnapshotLSN = lsn;
+    return in.ok() && intact;
+}
+
+// Capture a consistent copy of the state and write it as a snapshot.
+// In the background case the log is rotated at the capture point and the
+// copy is encoded and written on another thread; the archived log is
+// deleted once the snapshot is durable. If an earlier snapshot failed, its
+// archive is still there and the log is not rotated: the new snapshot
+// covers the archive too, and deletes it once written.
+// Returns false if a synchronous snapshot could not be written.
+bool takeSnapshot(FlightBST &flightBST, BookingLinkedList &bookingList, bool background)
+{
+    if (snapshotter.isBusy())
+        return false;
+
+    // Bookings and payments are captured by sharing their chunks; the rest
+    // is copied, and grows with flights and waiting requests, not bookings
+    auto flights = make_shared<vector<Flight>>();
+    auto bookings = make_shared<BookingLinkedList::Image>(bookingList.image());
+    auto schedule = make_shared<FlightSchedule>(flightSchedule());
+    auto payments = make_shared<PaymentLedger::Image>(paymentLedger.image());
+    auto stats = make_shared<BookingStats>(bookingStats);
+    auto queued = make_shared<Waitlist>(waitlist);
+    flightBST.collectFlights(*flights);
+    int nextFlightID = flightBST.nextFlightID();
+    size_t nameCount = passengerNames().size();
+    uint64_t lsn = bookingLog.lastLSN();
+
+    auto job = [=]
+    {
+        WalBuffer body;
+        encodeSnapshot(nextFlightID, *flights, nameCount, *bookings, *schedule, *payments, *stats, *queued, body);
+        if (!writeSnapshotFile(SNAPSHOT_FILE, lsn, body.bytes))
+        {
+            failedSnapshotLSN = lsn;
+            return false;
+        }
+        lastSnapshotLSN = lsn;
+        std::remove(BOOKING_LOG_ARCHIVE.c_str());
+        return true;
+    };
+
+    if (!background)
+        return job();
+    bookingLog.rotate(BOOKING_LOG_ARCHIVE);
+    return snapshotter.start([job]
+                             { job(); });
+}
+
+// Take a background snapshot once enough records have been logged since
+// the last one, or since the last attempt if that could not be written
+void maybeSnapshot(FlightBST &flightBST, BookingLinkedList &bookingList)
+{
+    uint64_t since = max(lastSnapshotLSN.load(), failedSnapshotLSN.load());
+    if (bookingLog.isOpen() && bookingLog.lastLSN() - since >= snapshotInterval)
+        takeSnapshot(flightBST, bookingList, true);
+}
+
+// Read a fare typed by staff, e.g. 18400 or 18400.50, asking again until it parses
+Money readFare()
+{
+    string text;
+    Money fare;
+    cin >> text;
+    while (!parseMoney(text, Currency::PKR, fare) || fare.minor < 0)
+    {
+        cout << "Invalid fare. Please enter an amount such as 18400 or 18400.50: ";
+        cin >> text;
+    }
+    return fare;
+}
+
+// Collect card details and queue the payment for authorization. The
+// bookings are marked paid once the result is applied by applyPaymentResults.
+void processPayment(const string &userName, const Money &amount, const vector<int> &bookingIDs)
 {
     string bankName, cardHolder, cardNumber, expiryDate, cvv;
 
@@ -330,95 +1317,708 @@ bool processPayment(const string &userName, int fare)
     cin.ignore();
     getline(cin, bankName);
 
-    cout << "Enter Cardholder Name: ";
-    getline(cin, cardHolder);
+    cout << "Enter Cardholder Name: ";
+    getline(cin, cardHolder);
+
+    // Reject bad cards here rather than after a gateway round trip
+    cout << "Enter Card Number: ";
+    cin >> cardNumber;
+    for (CardError error = validateCardNumber(cardNumber); error != CardError::None; error = validateCardNumber(cardNumber))
+    {
+        cout << cardErrorMessage(error) << ". Please enter a valid card number: ";
+        cin >> cardNumber;
+    }
+    cout << cardNetworkName(cardNetwork(cardNumber)) << " card accepted.\n";
+
+    cout << "Enter Expiry Date (MM/YY): ";
+    cin >> expiryDate;
+    for (CardError error = validateExpiry(expiryDate); error != CardError::None; error = validateExpiry(expiryDate))
+    {
+        cout << cardErrorMessage(error) << ". Please enter the expiry date (MM/YY): ";
+        cin >> expiryDate;
+    }
+
+    cout << "Enter CVV (3 digits): ";
+    cin >> cvv;
+    while (cvv.length() != 3 || !all_of(cvv.begin(), cvv.end(), ::isdigit))
+    {
+        cout << "Invalid CVV. Please enter a 3-digit CVV: ";
+        cin >> cvv;
+    }
+
+    PaymentRequest request;
+    request.idempotencyKey = paymentKey(userName, bookingIDs, amount);
+    request.payer = userName;
+    request.amount = amount;
+    request.bookingIDs = bookingIDs;
+    request.cardNumber = cardNumber;
+    request.expiryDate = expiryDate;
+    paymentPipeline.submit(request);
+    if (request.duplicate)
+    {
+        cout << "These bookings were already submitted for payment as payment " << request.requestID
+             << "; you will not be charged again.\n";
+        return;
+    }
+    bookingsAwaitingPayment.insert(bookingIDs.begin(), bookingIDs.end());
+    cout << "Payment " << request.requestID << " submitted for authorization. "
+         << "Your bookings are confirmed once it is approved.\n";
+}
+
+// Apply finished authorizations: every outcome is logged and entered in the
+// ledger; approved payments also mark their bookings paid
+void applyPaymentResults(BookingLinkedList &bookingList)
+{
+    paymentPipeline.drainCompleted([&bookingList](const PaymentRequest &request, const PaymentResult &result)
+                                   {
+        LedgerStatus status = result.approved()                          ? LedgerStatus::Approved
+                              : result.status == PaymentStatus::Declined ? LedgerStatus::Declined
+                                                                         : LedgerStatus::Failed;
+        int64_t timestamp = ledgerNow();
+        for (int id : request.bookingIDs)
+            bookingsAwaitingPayment.erase(id);
+        applyPayment(bookingList, request.payer, request.bookingIDs, status, timestamp, request.requestID);
+        logPayment(request.payer, request.amount, request.bookingIDs, status, timestamp, request.requestID);
+
+        if (!result.approved())
+        {
+            cout << "\nPayment " << request.requestID << " of " << request.amount << " failed: " << result.message
+                 << ". The bookings remain unpaid; choose \"Pay for pending bookings\" to try again.\n";
+            return;
+        }
+        cout << "\nPayment " << request.requestID << " of " << request.amount << " approved (" << result.reference
+             << "). Thank you for choosing GIKI Airlines.\n"; });
+}
+
+// Wait for payments still being authorized and apply them (used at exit)
+void finishPayments(BookingLinkedList &bookingList)
+{
+    size_t pending = paymentPipeline.pending();
+    if (pending > 0)
+    {
+        cout << "Waiting for " << pending << " payment(s) to complete...\n";
+        paymentPipeline.waitIdle();
+    }
+    applyPaymentResults(bookingList);
+}
+
+// Pay for bookings whose earlier payment was declined or failed. Bookings
+// already paid or still being authorized are skipped.
+void payPendingBookings(BookingLinkedList &bookingList)
+{
+    int count;
+    cout << "How many bookings do you want to pay for? ";
+    cin >> count;
+
+    vector<int> bookingIDs;
+    string payer;
+    Money total;
+    for (int i = 1; i <= count; ++i)
+    {
+        int bookingID;
+        cout << "Enter Booking ID: ";
+        cin >> bookingID;
+
+        Passenger *booking = bookingList.findBooking(bookingID);
+        if (booking == nullptr)
+            cout << "Booking ID " << bookingID << " not found.\n";
+        else if (booking->isPaid())
+            cout << "Booking ID " << bookingID << " is already paid.\n";
+        else if (bookingsAwaitingPayment.count(bookingID) > 0)
+            cout << "Booking ID " << bookingID << " already has a payment being authorized.\n";
+        else if (find(bookingIDs.begin(), bookingIDs.end(), bookingID) != bookingIDs.end())
+            cout << "Booking ID " << bookingID << " was already entered.\n";
+        else if (!bookingIDs.empty() && booking->fare().currency != total.currency)
+            cout << "Booking ID " << bookingID << " is priced in another currency; pay for it separately.\n";
+        else
+        {
+            if (bookingIDs.empty())
+            {
+                payer = booking->name();
+                total = booking->fare();
+            }
+            else
+                total += booking->fare();
+            bookingIDs.push_back(bookingID);
+        }
+    }
+
+    if (bookingIDs.empty())
+    {
+        cout << "No bookings to pay for.\n";
+        return;
+    }
+    cout << "Proceeding to payment of " << total << "...\n";
+    processPayment(payer, total, bookingIDs);
+}
+
+// Create one booking per passenger on an already reserved flight and append
+// them to the log. Returns the LSN of the last record for the caller to wait on.
+uint64_t addBookings(BookingLinkedList &bookingList, const Flight &flight, const vector<string> &passengerNames,
+                     vector<int> &bookingIDs)
+{
+    uint64_t lastLSN = 0;
+    for (const auto &name : passengerNames)
+    {
+        Passenger newPassenger(bookingIDCounter++, name, flight.flightID, flight.fare);
+        bookingList.addBooking(newPassenger);
+        bookingIDs.push_back(newPassenger.bookingID);
+        lastLSN = logBooking(newPassenger);
+        bookingStats.booked(newPassenger);
+    }
+    return lastLSN;
+}
+
+// Hand freed seats on a flight to waitlisted requests, best priority first.
+// All promotions of one call share a single durable log write. The new
+// bookings stay unpaid until paid through payPendingBookings.
+void promoteWaitlist(FlightBST &flightBST, BookingLinkedList &bookingList, int flightID)
+{
+    Flight flight;
+    try
+    {
+        flight = flightBST.getFlightByID(flightID);
+    }
+    catch (const runtime_error &)
+    {
+        return;
+    }
+
+    vector<WaitlistEntry> promoted = waitlist.promote(flightID, flight.availableSeats);
+    uint64_t lastLSN = 0;
+    for (const WaitlistEntry &entry : promoted)
+    {
+        flightBST.bookSeats(flightID, entry.seats());
+        logWaitlistPromote(entry.waitID);
+        vector<int> bookingIDs;
+        lastLSN = addBookings(bookingList, flight, entry.passengerNames, bookingIDs);
+
+        cout << "Waitlist request " << entry.waitID << " promoted on Flight ID " << flightID << ". Booking IDs:";
+        for (int id : bookingIDs)
+            cout << " " << id;
+        cout << " (payment pending; pay with \"Pay for pending bookings\")\n";
+    }
+    if (lastLSN && !bookingLog.waitDurable(lastLSN))
+        cout << "Warning: could not write to the booking log.\n";
+}
+
+// Booking function to use the original fare for payment
+void bookFlight(FlightBST &flightBST, BookingLinkedList &bookingList)
+{
+    int flightID, numSeats;
+    string passengerName;
+    vector<string> passengerNames;
+
+    cout << "Enter Flight ID to book: ";
+    cin >> flightID;
+
+    cout << "Enter number of seats to book: ";
+    cin >> numSeats;
+
+    // Collect passenger names
+    for (int i = 1; i <= numSeats; ++i)
+    {
+        cout << "Enter passenger " << i << "'s name: ";
+        cin.ignore();
+        getline(cin, passengerName);
+        passengerNames.push_back(passengerName);
+    }
+
+    // Attempt to book the flight
+    if (flightBST.bookSeats(flightID, numSeats))
+    {
+        cout << "Booking successful! The following passengers are booked on Flight ID: " << flightID << endl;
+        for (const auto &name : passengerNames)
+        {
+            cout << "- " << name << endl;
+        }
+
+        // Use the original fare for payment, charged once per seat
+        Flight bookedFlight = flightBST.getFlightByID(flightID); // Retrieve the flight details
+        Money total = bookedFlight.fare * numSeats;
+
+        // Add each passenger to the booking linked list
+        vector<int> bookingIDs;
+        uint64_t lastLSN = addBookings(bookingList, bookedFlight, passengerNames, bookingIDs);
+
+        // One durable write covers every passenger in this booking
+        if (lastLSN && !bookingLog.waitDurable(lastLSN))
+            cout << "Warning: could not write to the booking log.\n";
+
+        cout << "Passengers added to booking list. Booking IDs:";
+        for (int id : bookingIDs)
+            cout << " " << id;
+        cout << "\n";
+
+        // Proceed to payment
+        cout << "Proceeding to payment of " << total << "...\n";
+        processPayment(passengerNames[0], total, bookingIDs); // Use first passenger for payment
+    }
+    else
+    {
+        cout << "Booking failed. Please try again.\n";
+
+        // Offer the waitlist when the flight exists but is full
+        try
+        {
+            flightBST.getFlightByID(flightID);
+        }
+        catch (const runtime_error &)
+        {
+            return;
+        }
+
+        size_t ahead = waitlist.waiting(flightID);
+        if (ahead > 0)
+            cout << ahead << " request(s) are already waiting for this flight.\n";
+
+        int join;
+        cout << "Join the waitlist for this flight? (1 for Yes, 0 for No): ";
+        cin >> join;
+        if (join == 1)
+        {
+            int priorityClass;
+            cout << "Enter priority class (1 = Business, 2 = Premium, 3 = Economy): ";
+            cin >> priorityClass;
+            priorityClass = max(1, min(3, priorityClass));
+
+            WaitlistEntry entry = waitlist.add(flightID, priorityClass, passengerNames);
+            logWaitlistAdd(entry);
+            cout << "Added to the waitlist. Request ID: " << entry.waitID << endl;
+        }
+    }
+}
+
+// Cancel a booking and give its seat back to the flight
+void cancelBooking(FlightBST &flightBST, BookingLinkedList &bookingList)
+{
+    int bookingID;
+    cout << "Enter Booking ID to cancel: ";
+    cin >> bookingID;
+
+    Passenger removed(0, "", 0, Money());
+    if (bookingList.cancelBooking(bookingID, &removed))
+    {
+        int64_t timestamp = ledgerNow();
+        flightBST.releaseSeats(removed.flightID, 1);
+        logCancel(bookingID, timestamp);
+        bookingStats.cancelled(removed);
+        recordRefund(removed, timestamp);
+        cout << "Booking " << bookingID << " for " << removed.name() << " cancelled.\n";
+        promoteWaitlist(flightBST, bookingList, removed.flightID);
+    }
+    else
+    {
+        cout << "Booking not found.\n";
+    }
+}
+
+// Print one archived booking straight from the mapped file
+void displayArchivedBooking(const BookingRecord &record)
+{
+    cout << "Booking ID: " << record.bookingID
+         << ", Passenger: " << bookingHistory.name(record)
+         << ", Flight ID: " << record.flightID
+         << ", Date: " << fixedField(record.flightDate, sizeof(record.flightDate))
+         << ", Time: " << fixedField(record.flightTime, sizeof(record.flightTime))
+         << ", Fare: " << bookingHistory.fare(record)
+         << ", Paid: " << (record.isPaid ? "Yes" : "No")
+         << ", Amount Paid: " << bookingHistory.paymentAmount(record) << "\n";
+}
+
+void displayArchivedBooking(const BookingFileEntry &entry)
+{
+    cout << "Booking ID: " << entry.bookingID
+         << ", Passenger: " << entry.name
+         << ", Flight ID: " << entry.flightID
+         << ", Date: " << entry.flightDate
+         << ", Time: " << entry.flightTime
+         << ", Fare: " << entry.fare
+         << ", Paid: " << (entry.isPaid ? "Yes" : "No")
+         << ", Amount Paid: " << entry.paymentAmount << "\n";
+}
+
+// Report archived bookings: every flight when flightID is 0, otherwise one
+// flight found through the file's directory and the compressed blocks'
+// flight ranges. Returns how many bookings were shown.
+uint64_t displayArchivedBookings(int flightID)
+{
+    uint64_t shown = 0;
+    if (bookingHistory.isOpen())
+    {
+        const BookingRecord *first = bookingHistory.records();
+        const BookingRecord *last = first + bookingHistory.recordCount();
+        if (flightID != 0)
+            tie(first, last) = bookingHistory.flightRecords(flightID);
+        for (const BookingRecord *record = first; record != last; ++record)
+            displayArchivedBooking(*record);
+        shown += last - first;
+    }
+
+    BookingArchiveReader archive;
+    ArchiveBlock block;
+    if (archive.open(BOOKING_ARCHIVE_FILE))
+    {
+        int minFlight = flightID == 0 ? INT32_MIN : flightID;
+        int maxFlight = flightID == 0 ? INT32_MAX : flightID;
+        while (archive.next(block, minFlight, maxFlight))
+        {
+            uint32_t first = 0, last = block.rows;
+            if (flightID != 0 && !block.flightRange(flightID, first, last))
+                continue;
+            block.decodeRows(first, last, [](const BookingFileEntry &entry)
+                             { displayArchivedBooking(entry); });
+            shown += last - first;
+        }
+    }
+
+    if (shown == 0)
+        cout << "No archived bookings found.\n";
+    return shown;
+}
+
+// Every record in the history file, in file order
+vector<BookingFileEntry> historyEntries()
+{
+    vector<BookingFileEntry> entries;
+    if (!bookingHistory.isOpen())
+        return entries;
+    entries.reserve(bookingHistory.recordCount());
+    const BookingRecord *records = bookingHistory.records();
+    for (uint64_t i = 0; i < bookingHistory.recordCount(); ++i)
+    {
+        const BookingRecord &r = records[i];
+        entries.push_back({r.bookingID, r.flightID, bookingHistory.name(r),
+                           fixedField(r.flightDate, sizeof(r.flightDate)),
+                           fixedField(r.flightTime, sizeof(r.flightTime)),
+                           bookingHistory.fare(r), r.isPaid != 0, bookingHistory.paymentAmount(r)});
+    }
+    return entries;
+}
+
+// Move everything in the history file into the compressed archive, whose
+// blocks are appended rather than rewritten. False if the archive could
+// not be written, in which case the history file is kept.
+bool moveHistoryToArchive(uint64_t &moved)
+{
+    moved = 0;
+    if (!bookingHistory.isOpen() || bookingHistory.recordCount() == 0)
+        return true;
+
+    vector<BookingFileEntry> entries = historyEntries();
+    if (!appendToArchive(BOOKING_ARCHIVE_FILE, entries))
+        return false;
+    bookingHistory.close();
+    std::remove(BOOKING_HISTORY_FILE.c_str());
+    moved = entries.size();
+    return true;
+}
+
+void compressBookingHistory()
+{
+    uint64_t moved;
+    if (!moveHistoryToArchive(moved))
+        cout << "Error writing to " << BOOKING_ARCHIVE_FILE << ".\n";
+    else if (moved == 0)
+        cout << "No archived bookings to compress.\n";
+    else
+        cout << moved << " booking(s) compressed into " << BOOKING_ARCHIVE_FILE << ".\n";
+}
+
+// True once a scheduled departure, in local time, has passed
+bool flightDeparted(const string &date, const string &time)
+{
+    tm today = localToday();
+    char now[32];
+    strftime(now, sizeof(now), "%Y-%m-%d %H:%M", &today);
+    return date + " " + time < now;
+}
 
-    cout << "Enter Card Number (16 digits): ";
-    cin >> cardNumber;
-    while (cardNumber.length() != 16 || !all_of(cardNumber.begin(), cardNumber.end(), ::isdigit))
+// Move a completed flight's bookings out of memory into the history file.
+// The history file is written before the Archive log record, so a crash in
+// between leaves the bookings both live and in the file; see
+// dropUnloggedHistory for how recovery settles that.
+void archiveFlightBookings(BookingLinkedList &bookingList, int flightID)
+{
+    vector<Passenger> bookings;
+    bookingList.collectBookings(bookings, flightID);
+    if (bookings.empty())
     {
-        cout << "Invalid card number. Please enter a 16-digit card number: ";
-        cin >> cardNumber;
+        cout << "No bookings to archive for Flight ID: " << flightID << endl;
+        return;
     }
 
-    cout << "Enter Expiry Date (MM/YY): ";
-    cin >> expiryDate;
-
-    cout << "Enter CVV (3 digits): ";
-    cin >> cvv;
-    while (cvv.length() != 3 || !all_of(cvv.begin(), cvv.end(), ::isdigit))
+    // Only flights that are over are archived: the bookings of one that has
+    // not left can still be cancelled or paid for
+    if (!flightDeparted(bookings[0].flightDate(), bookings[0].flightTime()))
     {
-        cout << "Invalid CVV. Please enter a 3-digit CVV: ";
-        cin >> cvv;
+        cout << "Flight ID " << flightID << " has not departed yet and cannot be archived.\n";
+        return;
+    }
+    size_t unpaid = count_if(bookings.begin(), bookings.end(), [](const Passenger &p)
+                             { return !p.isPaid(); });
+    if (unpaid > 0)
+    {
+        cout << "Flight ID " << flightID << " has " << unpaid
+             << " unpaid booking(s). Settle or cancel them before archiving.\n";
+        return;
     }
 
-    // Simulate a delay to process payment
-    cout << "Processing payment...\n";
-    (std::chrono::seconds(3)); // 3 seconds delay
+    // The history file is rewritten whole on each archive, so once it is
+    // large it is folded into the compressed archive first. That keeps each
+    // rewrite bounded instead of growing with all history archived so far.
+    // If the archive cannot take it, the history file just keeps growing.
+    uint64_t folded;
+    if (bookingHistory.recordCount() >= HISTORY_FOLD_RECORDS && !moveHistoryToArchive(folded))
+        cout << "Warning: could not move archived bookings into " << BOOKING_ARCHIVE_FILE << ".\n";
+
+    // Rewrite the file with the old records plus the new ones
+    vector<BookingFileEntry> entries = historyEntries();
+    for (const Passenger &p : bookings)
+        entries.push_back({p.bookingID, p.flightID, p.name(), p.flightDate(), p.flightTime(), p.fare(), p.isPaid(), p.paymentAmount()});
+
+    bookingHistory.close(); // a mapped file cannot be replaced on Windows
+    bool written = writeBookingFile(BOOKING_HISTORY_FILE, entries);
+    bookingHistory.open(BOOKING_HISTORY_FILE);
+    if (!written)
+    {
+        cout << "Error writing to " << BOOKING_HISTORY_FILE << ".\n";
+        return;
+    }
 
-    // Always make payment successful
-    cout << "Payment successful!\n";
+    // Only forget the bookings once the history file holds them
+    bookingList.removeFlightBookings(flightID);
+    WalBuffer payload;
+    payload.putI32(flightID);
+    logCommit(WalRecordType::Archive, payload);
+    cout << bookings.size() << " booking(s) of Flight ID " << flightID << " archived.\n";
+}
 
-    // Save payment history for auditing
-    paymentHistory[userName] = "Paid " + to_string(fare) + " PKR.";
-    return true;
+// After recovery, drop history records of bookings that are still live.
+// They come from an archive whose log record never made it to disk, so the
+// log says the bookings were not archived and the live copies stand.
+void dropUnloggedHistory(BookingLinkedList &bookingList)
+{
+    vector<BookingFileEntry> entries = historyEntries();
+    size_t kept = 0;
+    for (const BookingFileEntry &entry : entries)
+    {
+        if (!bookingList.findBooking(entry.bookingID))
+            entries[kept++] = entry;
+    }
+    if (kept == entries.size())
+        return;
+
+    size_t dropped = entries.size() - kept;
+    entries.resize(kept);
+    bookingHistory.close();
+    bool written = writeBookingFile(BOOKING_HISTORY_FILE, entries);
+    bookingHistory.open(BOOKING_HISTORY_FILE);
+    if (!written)
+        cout << "Warning: could not remove " << dropped << " unfinished archive record(s) from "
+             << BOOKING_HISTORY_FILE << ".\n";
 }
 
-// Booking function to use the original fare for payment
-void bookFlight(FlightBST &flightBST, BookingLinkedList &bookingList)
+// Admin dashboard: reads the maintained views, never the booking list
+void displayDashboard()
 {
-    int flightID, numSeats;
-    string passengerName;
-    vector<string> passengerNames;
+    const BookingTotals &total = bookingStats.total();
+    cout << "\n==== Revenue Dashboard ====\n";
+    cout << "Total revenue: " << total.revenue
+         << ", Paid bookings: " << total.paidBookings
+         << ", Unpaid bookings: " << total.unpaidBookings << "\n";
+
+    cout << "\nPer flight:\n";
+    map<int, const FlightStats *> flights; // sorted by flight ID for display
+    for (const auto &entry : bookingStats.perFlight())
+        flights[entry.first] = &entry.second;
+    for (const auto &entry : flights)
+    {
+        const FlightStats &stats = *entry.second;
+        cout << "Flight ID: " << entry.first << (stats.removed ? " (removed)" : "")
+             << ", Route: " << stats.route << ", Date: " << stats.date
+             << ", Booked: " << stats.bookedSeats << ", Available: " << stats.availableSeats
+             << ", Load Factor: " << BookingStats::loadFactor(stats) << "%"
+             << ", Paid: " << stats.totals.paidBookings << ", Unpaid: " << stats.totals.unpaidBookings
+             << ", Revenue: " << stats.totals.revenue << "\n";
+    }
 
-    cout << "Enter Flight ID to book: ";
-    cin >> flightID;
+    cout << "\nPer route:\n";
+    for (const auto &entry : map<string, BookingTotals>(bookingStats.perRoute().begin(), bookingStats.perRoute().end()))
+        cout << entry.first << ": Revenue: " << entry.second.revenue << ", Paid: " << entry.second.paidBookings
+             << ", Unpaid: " << entry.second.unpaidBookings << "\n";
+
+    cout << "\nPer day:\n";
+    for (const auto &entry : map<string, BookingTotals>(bookingStats.perDay().begin(), bookingStats.perDay().end()))
+        cout << entry.first << ": Revenue: " << entry.second.revenue << ", Paid: " << entry.second.paidBookings
+             << ", Unpaid: " << entry.second.unpaidBookings << "\n";
+
+    PaymentPipeline::Stats payments = paymentPipeline.stats();
+    cout << "\nPayment gateway (this session):\n";
+    cout << "Circuit breaker: " << breakerStateName(paymentPipeline.breakerState())
+         << ", Trips: " << payments.breakerTrips
+         << ", Completed: " << payments.requests
+         << ", Pending: " << paymentPipeline.pending()
+         << ", Gateway calls: " << payments.gatewayCalls
+         << ", Retries: " << payments.retries
+         << ", Rejected while open: " << payments.rejected
+         << ", Duplicates: " << payments.duplicates
+         << ", Invalid cards: " << payments.invalidCards << "\n";
+}
 
-    cout << "Enter number of seats to book: ";
-    cin >> numSeats;
+// Payment audit: ledger entries for a payer, a booking or a date range,
+// with what was collected and refunded in each currency
+void auditPayments()
+{
+    int choice;
+    cout << "\n==== Payment Audit ====\n";
+    cout << "1. Payments by payer\n";
+    cout << "2. Payments for a booking\n";
+    cout << "3. Payments between two dates\n";
+    cout << "Enter your choice: ";
+    cin >> choice;
 
-    // Collect passenger names
-    for (int i = 1; i <= numSeats; ++i)
+    Money collected[2] = {Money(0, Currency::PKR), Money(0, Currency::USD)};
+    Money refunded[2] = {Money(0, Currency::PKR), Money(0, Currency::USD)};
+    size_t shown = 0, unsuccessful = 0;
+    auto show = [&](const LedgerEntry &entry)
     {
-        cout << "Enter passenger " << i << "'s name: ";
+        cout << formatLedgerTime(entry.timestamp)
+             << ", Booking ID: " << entry.bookingID
+             << ", Payer: " << paymentLedger.payerName(entry.payerID)
+             << ", Amount: " << entry.amount
+             << ", Status: " << ledgerStatusName(entry.status);
+        if (entry.requestID)
+            cout << ", Payment: " << entry.requestID;
+        cout << "\n";
+
+        size_t currency = static_cast<size_t>(entry.amount.currency) & 1;
+        if (entry.status == LedgerStatus::Approved)
+            collected[currency] += entry.amount;
+        else if (entry.status == LedgerStatus::Refunded)
+            refunded[currency] += entry.amount;
+        else
+            unsuccessful++;
+        shown++;
+    };
+
+    switch (choice)
+    {
+    case 1:
+    {
+        string payer;
+        cout << "Enter payer name: ";
         cin.ignore();
-        getline(cin, passengerName);
-        passengerNames.push_back(passengerName);
+        getline(cin, payer);
+        paymentLedger.forPayer(payer, show);
+        break;
     }
-
-    // Attempt to book the flight
-    if (flightBST.bookSeats(flightID, numSeats))
+    case 2:
     {
-        cout << "Booking successful! The following passengers are booked on Flight ID: " << flightID << endl;
-        for (const auto &name : passengerNames)
-        {
-            cout << "- " << name << endl;
-        }
-
-        // Use the original fare for payment
-        Flight bookedFlight = flightBST.getFlightByID(flightID); // Retrieve the flight details
-        double fare = bookedFlight.fare;                         // Fare in PKR
-
-        // Add each passenger to the booking linked list
-        for (const auto &name : passengerNames)
+        int bookingID;
+        cout << "Enter Booking ID: ";
+        cin >> bookingID;
+        paymentLedger.forBooking(bookingID, show);
+        break;
+    }
+    case 3:
+    {
+        string fromText, toText;
+        int64_t from, to;
+        cout << "Enter start date (YYYY-MM-DD): ";
+        cin >> fromText;
+        cout << "Enter end date (YYYY-MM-DD, inclusive): ";
+        cin >> toText;
+        if (!parseLedgerDate(fromText, from) || !parseLedgerDate(toText, to))
         {
-            Passenger newPassenger(name, flightID, bookedFlight.time, bookedFlight.date, fare);
-            bookingList.addBooking(newPassenger);
+            cout << "Invalid date.\n";
+            return;
         }
+        paymentLedger.forRange(from, to + 86400000, show);
+        break;
+    }
+    default:
+        cout << "Invalid choice.\n";
+        return;
+    }
 
-        cout << "Passengers added to booking list.\n";
+    if (shown == 0)
+    {
+        cout << "No payments found.\n";
+        return;
+    }
+    cout << shown << " entries, " << unsuccessful << " declined or failed\n";
+    for (size_t currency = 0; currency < 2; ++currency)
+        if (!collected[currency].isZero() || !refunded[currency].isZero())
+            cout << "Collected: " << collected[currency] << ", Refunded: " << refunded[currency]
+                 << ", Net: " << collected[currency] - refunded[currency] << "\n";
+}
 
-        // Proceed to payment
-        cout << "Proceeding to payment...\n";
-        if (processPayment(passengerNames[0], static_cast<int>(fare))) // Use first passenger for payment
+// Cross-check live and archived bookings against the payment ledger and
+// every flight's seat counts, and report what disagrees
+void reconcileBookings(FlightBST &flightBST, BookingLinkedList &bookingList)
+{
+    unordered_map<int, ReconcileFlight> flightMap;
+    vector<Flight> flights;
+    flightBST.collectFlights(flights);
+    for (const Flight &flight : flights)
+        flightMap[flight.flightID] = {flight.flightID, true, flight.availableSeats, false, 0, 0};
+    for (const auto &entry : bookingStats.perFlight())
+    {
+        ReconcileFlight &flight = flightMap.emplace(entry.first, ReconcileFlight{entry.first, false, 0, false, 0, 0}).first->second;
+        flight.tracked = true;
+        flight.trackedBooked = entry.second.bookedSeats;
+        flight.trackedAvailable = entry.second.availableSeats;
+    }
+    vector<ReconcileFlight> flightList;
+    flightList.reserve(flightMap.size());
+    for (const auto &entry : flightMap)
+        flightList.push_back(entry.second);
+
+    vector<Passenger> live;
+    bookingList.collectBookings(live);
+    vector<ReconcileBooking> bookings;
+    bookings.reserve(live.size() + (bookingHistory.isOpen() ? bookingHistory.recordCount() : 0));
+    for (const Passenger &p : live)
+        bookings.push_back({p.bookingID, p.flightID, false, p.isPaid(), p.fare(), p.paymentAmount()});
+
+    if (bookingHistory.isOpen())
+    {
+        const BookingRecord *records = bookingHistory.records();
+        for (uint64_t i = 0; i < bookingHistory.recordCount(); ++i)
         {
-            cout << "Payment and booking successfully completed. Thank you for choosing GIKI Airlines.\n";
+            const BookingRecord &r = records[i];
+            bookings.push_back({r.bookingID, r.flightID, true, r.isPaid != 0, bookingHistory.fare(r),
+                                bookingHistory.paymentAmount(r)});
         }
     }
-    else
+    BookingArchiveReader archive;
+    ArchiveBlock block;
+    if (archive.open(BOOKING_ARCHIVE_FILE))
+        while (archive.next(block, INT32_MIN, INT32_MAX))
+            block.decodeRows(0, block.rows, [&bookings](const BookingFileEntry &e)
+                             { bookings.push_back({e.bookingID, e.flightID, true, e.isPaid, e.fare, e.paymentAmount}); });
+
+    ReconcileReport report = Reconciler::run(flightList, bookings, paymentLedger);
+
+    cout << "\n==== Reconciliation ====\n";
+    cout << "Checked " << report.bookingsChecked << " bookings on " << report.flightsChecked << " flights against "
+         << paymentLedger.size() << " ledger entries in " << report.seconds << "s (" << report.threads
+         << " threads)\n";
+    for (size_t kind = 0; kind < static_cast<size_t>(IssueKind::IssueKindCount); ++kind)
+        cout << issueKindName(static_cast<IssueKind>(kind)) << ": " << report.counts[kind] << "\n";
+
+    const size_t shownLimit = 100;
+    for (size_t i = 0; i < report.issues.size() && i < shownLimit; ++i)
     {
-        cout << "Booking failed. Please try again.\n";
+        const ReconcileIssue &issue = report.issues[i];
+        cout << issueKindName(issue.kind) << " - Flight ID: " << issue.flightID;
+        if (issue.bookingID)
+            cout << ", Booking ID: " << issue.bookingID;
+        cout << ": " << issue.detail << "\n";
     }
+    if (report.issues.size() > shownLimit)
+        cout << "... and " << report.issues.size() - shownLimit << " more\n";
 }
 
 /*void displayPassengerBookings(BookingLinkedList &bookingList)
@@ -429,25 +2029,55 @@ void bookFlight(FlightBST &flightBST, BookingLinkedList &bookingList)
 // Add default flights
 void addDefaultFlights(FlightBST &flightBST)
 {
-    flightBST.addFlight("Lahore", "Islamabad", "2024-12-15", "08:00", 18400.0, 50);
-    flightBST.addFlight("Islamabad", "Karachi", "2024-12-15", "12:00", 45150.0, 60);
-    flightBST.addFlight("Karachi", "Lahore", "2024-12-15", "16:00", 67120.0, 40);
+    int ids[] = {
+        flightBST.addFlight("Lahore", "Islamabad", "2024-12-15", "08:00", Money::fromMajor(18400), 50),
+        flightBST.addFlight("Islamabad", "Karachi", "2024-12-15", "12:00", Money::fromMajor(45150), 60),
+        flightBST.addFlight("Karachi", "Lahore", "2024-12-15", "16:00", Money::fromMajor(67120), 40)};
+    for (int id : ids)
+        logFlightAdd(flightBST.getFlightByID(id));
 }
 
-void mainMenu(FlightBST &flightBST, BookingLinkedList &bookingList);
+void mainMenu(FlightBST &flightBST, BookingLinkedList &bookingList, const string &session = "");
+
+// Whether the menu's session is still live and its user has permission to
+// use the menu; if not the user is sent back to the main menu
+bool sessionAllows(const string &session, Permissions permission)
+{
+    Session current;
+    if (!sessions.find(session, current))
+    {
+        cout << "Your session has ended. Please log in again.\n";
+        return false;
+    }
+    if (!current.allows(permission))
+    {
+        cout << "Your account does not have access to this menu.\n";
+        return false;
+    }
+    return true;
+}
 
 // Main menu for the passenger
-void mainMenuPassenger(FlightBST &flightBST, BookingLinkedList &bookingList)
+void mainMenuPassenger(FlightBST &flightBST, BookingLinkedList &bookingList, const string &session)
 {
     while (true)
     {
+        if (!sessionAllows(session, PERMIT_PASSENGER_MENU))
+        {
+            mainMenu(flightBST, bookingList, session);
+            return;
+        }
+        maybeSnapshot(flightBST, bookingList);
+        applyPaymentResults(bookingList);
         int choice;
         cout << "\nWelcome to GIKI Flights!\n";
         cout << "1. View all available flights\n";
         cout << "2. Search for flights\n";
         cout << "3. Book a flight\n"; // New option
-        cout << "4. Return to Main Menu\n";
-        cout << "5. Exit\n";
+        cout << "4. Cancel a booking\n";
+        cout << "5. Pay for pending bookings\n";
+        cout << "6. Return to Main Menu\n";
+        cout << "7. Exit\n";
         cout << "Enter your choice: ";
         cin >> choice;
 
@@ -477,22 +2107,35 @@ void mainMenuPassenger(FlightBST &flightBST, BookingLinkedList &bookingList)
             break;
 
         case 4:
-            mainMenu(flightBST, bookingList); // //return to menu
+            cancelBooking(flightBST, bookingList);
             break;
         case 5:
+            payPendingBookings(bookingList);
+            break;
+        case 6:
+            mainMenu(flightBST, bookingList, session); // //return to menu
+            break;
+        case 7:
             cout << "Thank you for using GIKI Airlines. Goodbye!\n";
             return;
         default:
             cout << "Invalid choice. Please try again.\n";
-            mainMenu(flightBST, bookingList);
+            mainMenu(flightBST, bookingList, session);
         }
     }
 }
 
-void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
+void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList, const string &session)
 {
     while (true)
     {
+        if (!sessionAllows(session, PERMIT_STAFF_MENU))
+        {
+            mainMenu(flightBST, bookingList, session);
+            return;
+        }
+        maybeSnapshot(flightBST, bookingList);
+        applyPaymentResults(bookingList);
         int choice;
         cout << "\nWelcome, Airline Staff!\n";
         cout << "1. View all available flights\n";
@@ -512,7 +2155,7 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
         case 2:
         {
             string origin, destination, date, time;
-            double fare;
+            Money fare;
             int seats;
 
             cout << "Enter Origin: ";
@@ -529,12 +2172,13 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
             getline(cin, time);
 
             cout << "Enter Fare: ";
-            cin >> fare;
+            fare = readFare();
 
             cout << "Enter Available Seats: ";
             cin >> seats;
 
-            flightBST.addFlight(origin, destination, date, time, fare, seats);
+            int newID = flightBST.addFlight(origin, destination, date, time, fare, seats);
+            logFlightAdd(flightBST.getFlightByID(newID));
             cout << "Flight added successfully!\n";
             break;
         }
@@ -542,7 +2186,7 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
         {
             int flightID;
             string newTime;
-            double newFare;
+            Money newFare;
             int newSeats;
 
             cout << "Enter Flight ID to update: ";
@@ -553,13 +2197,17 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
             getline(cin, newTime);
 
             cout << "Enter new Fare: ";
-            cin >> newFare;
+            newFare = readFare();
 
             cout << "Enter new Available Seats: ";
             cin >> newSeats;
 
             if (flightBST.updateFlight(flightID, newTime, newFare, newSeats))
+            {
+                logFlightUpdate(flightID, newTime, newFare, newSeats);
                 cout << "Flight updated successfully!\n";
+                promoteWaitlist(flightBST, bookingList, flightID);
+            }
             else
                 cout << "Flight not found!\n";
             break;
@@ -571,7 +2219,11 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
             cin >> flightID;
 
             if (flightBST.removeFlight(flightID))
+            {
+                logFlightRemove(flightID);
+                waitlist.clearFlight(flightID);
                 cout << "Flight removed successfully!\n";
+            }
             else
                 cout << "Flight not found!\n";
             break;
@@ -579,7 +2231,7 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
         case 5:
         {
             cout << "Returning to Main Menu\n";
-            mainMenu(flightBST, bookingList);
+            mainMenu(flightBST, bookingList, session);
         }
         case 6:
         {
@@ -588,22 +2240,37 @@ void mainMenuStaff(FlightBST &flightBST, BookingLinkedList &bookingList)
         }
         default:
             cout << "Invalid choice. Please try again.\n";
-            mainMenuStaff(flightBST, bookingList);
+            mainMenuStaff(flightBST, bookingList, session);
         }
     }
 }
 
-void mainMenuAdmin(FlightBST &flightBST, BookingLinkedList &bookingList)
+void mainMenuAdmin(FlightBST &flightBST, BookingLinkedList &bookingList, const string &session)
 {
     while (true)
     { // Menu loop
+        if (!sessionAllows(session, PERMIT_ADMIN_MENU))
+        {
+            mainMenu(flightBST, bookingList, session);
+            return;
+        }
+        maybeSnapshot(flightBST, bookingList);
+        applyPaymentResults(bookingList);
         int choice;
         cout << "\n==== Admin Controls ====\n";
         cout << "1. Add a new user\n";
         cout << "2. Remove a user\n";
         cout << "3. View system-wide booking and payment data\n";
-        cout << "4. Go back to main menu\n";
-        cout << "5. Exit the program\n";
+        cout << "4. Archive bookings of a flight\n";
+        cout << "5. View archived bookings of a flight\n";
+        cout << "6. Compress archived bookings\n";
+        cout << "7. View revenue and load-factor dashboard\n";
+        cout << "8. Audit payments\n";
+        cout << "9. Reconcile bookings, payments and seats\n";
+        cout << "10. Import users from a file\n";
+        cout << "11. Export users to a file\n";
+        cout << "12. Go back to main menu\n";
+        cout << "13. Exit the program\n";
         cout << "Enter your choice: ";
         cin >> choice;
 
@@ -611,10 +2278,18 @@ void mainMenuAdmin(FlightBST &flightBST, BookingLinkedList &bookingList)
         {
         case 1:
         {
-            string role;
-            cout << "Enter role (Passenger/Staff/Admin): ";
-            cin >> role;
-            addUser(role); // Ensure this function is implemented
+            int roleChoice;
+            cout << "Select the new user's role:\n";
+            cout << "1. Passenger\n2. Airline Staff\n3. Admin\n";
+            cout << "Enter your choice: ";
+            cin >> roleChoice;
+            if (roleChoice < 1 || roleChoice > 3)
+            {
+                cout << "Invalid role. Please choose 1, 2 or 3.\n";
+                break;
+            }
+            const UserRole roles[] = {UserRole::Passenger, UserRole::Staff, UserRole::Admin};
+            addUser(roles[roleChoice - 1]);
             break;
         }
         case 2:
@@ -625,18 +2300,67 @@ void mainMenuAdmin(FlightBST &flightBST, BookingLinkedList &bookingList)
         case 3:
         {
             bookingList.displayBookingsWithPayments(); // Display booking and payment details
+            cout << "Archived bookings:\n";
+            displayArchivedBookings(0);
             break;
         }
         case 4:
+        {
+            int flightID;
+            cout << "Enter Flight ID to archive: ";
+            cin >> flightID;
+            archiveFlightBookings(bookingList, flightID);
+            break;
+        }
+        case 5:
+        {
+            int flightID;
+            cout << "Enter Flight ID: ";
+            cin >> flightID;
+            displayArchivedBookings(flightID);
+            break;
+        }
+        case 6:
+        {
+            compressBookingHistory();
+            break;
+        }
+        case 7:
+        {
+            displayDashboard();
+            break;
+        }
+        case 8:
+        {
+            auditPayments();
+            break;
+        }
+        case 9:
+        {
+            reconcileBookings(flightBST, bookingList);
+            break;
+        }
+        case 10:
+        {
+            importUsersFromFile();
+            break;
+        }
+        case 11:
+        {
+            exportUsersToFile();
+            break;
+        }
+        case 12:
         {
             cout << "Returning to main menu...\n";
-            mainMenu(flightBST, bookingList);
+            mainMenu(flightBST, bookingList, session);
 
             // Exit the admin menu and go back
         }
-        case 5:
+        case 13:
         {
             cout << "Exiting the program. Goodbye!\n";
+            finishPayments(bookingList);
             exit(0); // Terminate the program
         }
         default:
@@ -645,38 +2369,8 @@ void mainMenuAdmin(FlightBST &flightBST, BookingLinkedList &bookingList)
     }
 }
 
-// Function to validate email format (simple regex for basic validation)
-bool isValidEmail(const string &email)
-{
-    regex emailPattern(R"([a-zA-Z0-9._%+-]+@[a-zA0-9.-]+\.[a-zA-Z]{2,})");
-    return regex_match(email, emailPattern);
-}
-
-// Function to validate the password (must be at least 8 characters and include a number)
-bool isValidPassword(const string &password)
-{
-    if (password.length() < 8)
-    {
-        return false;
-    }
-
-    regex passwordPattern(R"((.*\d.*))"); // password must include at least one digit
-    return regex_match(password, passwordPattern);
-}
-
-// Function to hash the password (a simple example for demonstration)
-string hashPassword(const string &password)
-{
-    string hashedPassword = password;
-    for (auto &c : hashedPassword)
-    {
-        c += 1; // simple shift encryption for demo
-    }
-    return hashedPassword;
-}
-
-// Function to authenticate user login
-bool loginUser(string &emailOut, string &nameOut)
+// Function to authenticate user login; on success a session is started for the menus
+bool loginUser(string &sessionOut)
 {
     string email, password;
 
@@ -686,28 +2380,52 @@ bool loginUser(string &emailOut, string &nameOut)
     cout << "Enter your password: ";
     cin >> password;
 
-    // Check if the email exists in the stored map
-    if (users.find(email) != users.end())
+    // Attempts over the limit are turned away before the password is hashed
+    double retryAfter;
+    if (!loginLimiter.allow(email, loginSource, retryAfter))
     {
-        string hashedPassword = hashPassword(password);
+        cout << "Too many login attempts. Please try again in " << static_cast<long>(ceil(retryAfter))
+             << " seconds.\n";
+        return false;
+    }
 
-        if (users[email].first == hashedPassword)
-        {
-            cout << "Login successful! Welcome, " << users[email].second << "!\n";
+    // Look the email up in the user store
+    UserRecord user;
+    if (authenticator.check(userStore, email, password, user))
+    {
+        loginLimiter.succeeded(email);
+        cout << "Login successful! Welcome, " << userDisplayName(user) << "!\n";
 
-            // Pass the email and name back to the caller
-            emailOut = email;
-            nameOut = users[email].second;
-            return true;
-        }
+        // Pass the session back to the caller
+        sessionOut = sessions.issue(user);
+        return true;
     }
 
     cout << "Login failed! Incorrect email or password.\n";
     return false;
 }
 
+// Open the menu for role as the user of session; the menu checks that the user may use it
+void openRoleMenu(FlightBST &flightBST, BookingLinkedList &bookingList, UserRole role, const string &session)
+{
+    switch (role)
+    {
+    case UserRole::Passenger:
+        mainMenuPassenger(flightBST, bookingList, session);
+        break;
+    case UserRole::Staff:
+        mainMenuStaff(flightBST, bookingList, session);
+        break;
+    case UserRole::Admin:
+        mainMenuAdmin(flightBST, bookingList, session);
+        break;
+    default:
+        break;
+    }
+}
+
 // Function to register a new user
-void registerUser(FlightBST &flightBST, BookingLinkedList &bookingList, const string &role)
+void registerUser(FlightBST &flightBST, BookingLinkedList &bookingList, UserRole role)
 {
     string name, email, password;
 
@@ -719,64 +2437,56 @@ void registerUser(FlightBST &flightBST, BookingLinkedList &bookingList, const st
     cout << "Enter your email: ";
     cin >> email;
 
-    // Validate email format
-    while (!isValidEmail(email))
+    // Validate email format, and that no account uses it yet
+    while (true)
     {
-        cout << "Invalid email format. Please enter a valid email: ";
+        if (!isValidEmail(email))
+            cout << "Invalid email format. Please enter a valid email: ";
+        else if (userStore.contains(email))
+            cout << "An account with this email already exists. Please enter another email: ";
+        else
+            break;
         cin >> email;
     }
 
     // Ask for password and validate it
-    do
+    while (true)
     {
         cout << "Enter your password (must be at least 8 characters and include a number): ";
         cin >> password;
 
-        if (!isValidPassword(password))
-        {
-            cout << "Password does not meet the requirements. Please try again.\n";
-        }
-
-    } while (!isValidPassword(password));
+        if (isValidPassword(password))
+            break;
+        cout << "Password does not meet the requirements. Please try again.\n";
+    }
 
     // Hash the password before storing
-    string hashedPassword = hashPassword(password);
+    string hashedPassword = authenticator.hash(password);
 
-    // Store the user details with role
-    users[email] = {hashedPassword, name + ":" + role};
-
-    // Write to file to persist data
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open())
+    // Store the user details with role, unless the email was taken meanwhile
+    UserRecord user{email, hashedPassword, name, role};
+    UserInsert added = userStore.insert(user);
+    if (added == UserInsert::Added)
     {
-        outFile << email << " " << hashedPassword << " " << name << " " << role << endl;
-        outFile.close();
-        cout << "Registration successful as " << role << "!\n";
+        cout << "Registration successful as " << roleName(role) << "!\n";
     }
     else
     {
-        cout << "Error writing to file.\n";
+        cout << (added == UserInsert::Exists ? "An account with this email already exists.\n" : "Error writing to file.\n");
+        return;
     }
 
-    // After registration, prompt to login or exit
+    // The password was just checked, so the new user is logged in already
+    string session = sessions.issue(user);
     int choice;
-    cout << "Do you want to login now?\n";
-    cout << "1. Login\n2. Exit\n";
+    cout << "Do you want to continue to the menu now?\n";
+    cout << "1. Continue\n2. Exit\n";
     cout << "Enter your choice: ";
     cin >> choice;
 
     if (choice == 1)
     {
-        string emailOut, nameOut;
-        if (loginUser(emailOut, nameOut))
-        {
-            if (role == "Passenger")
-                mainMenuPassenger(flightBST, bookingList);
-            else if (role == "Airline Staff")
-                mainMenuStaff(flightBST, bookingList);
-            else if (role == "Admin")
-                mainMenuAdmin(flightBST, bookingList);
-        }
+        openRoleMenu(flightBST, bookingList, role, session);
     }
     else
     {
@@ -784,7 +2494,7 @@ void registerUser(FlightBST &flightBST, BookingLinkedList &bookingList, const st
     }
 }
 
-void addUser(const string &role)
+void addUser(UserRole role)
 {
     string name, email, password;
     cout << "Enter user name: ";
@@ -792,21 +2502,39 @@ void addUser(const string &role)
     getline(cin, name);
     cout << "Enter user email: ";
     cin >> email;
-    cout << "Enter password: ";
-    cin >> password;
 
-    // Validate email and password, hash password, and store user
-    string hashedPassword = hashPassword(password);
-    users[email] = {hashedPassword, name + ":" + role};
+    // Validate email format, and that no account uses it yet
+    while (true)
+    {
+        if (!isValidEmail(email))
+            cout << "Invalid email format. Please enter a valid email: ";
+        else if (userStore.contains(email))
+            cout << "An account with this email already exists. Please enter another email: ";
+        else
+            break;
+        cin >> email;
+    }
 
-    // Write to file
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open())
+    // Ask for password and validate it
+    while (true)
     {
-        outFile << email << " " << hashedPassword << " " << name << " " << role << endl;
-        outFile.close();
+        cout << "Enter password (must be at least 8 characters and include a number): ";
+        cin >> password;
+
+        if (isValidPassword(password))
+            break;
+        cout << "Password does not meet the requirements. Please try again.\n";
     }
-    cout << "User added successfully.\n";
+
+    // Hash the password and store the user, unless the email was taken meanwhile
+    string hashedPassword = authenticator.hash(password);
+    UserInsert added = userStore.insert({email, hashedPassword, name, role});
+    if (added == UserInsert::Added)
+        cout << "User added successfully.\n";
+    else if (added == UserInsert::Exists)
+        cout << "An account with this email already exists.\n";
+    else
+        cout << "Error writing to file.\n";
 }
 
 void removeUser()
@@ -815,11 +2543,10 @@ void removeUser()
     cout << "Enter the email of the user to remove: ";
     cin >> email;
 
-    if (users.find(email) != users.end())
+    // Writes a tombstone to the user store and logs the user out
+    if (userStore.erase(email))
     {
-        users.erase(email);
-
-        // Remove from file (you would need to rewrite the file without this user)
+        sessions.revokeUser(email);
         cout << "User removed successfully.\n";
     }
     else
@@ -828,7 +2555,44 @@ void removeUser()
     }
 }
 
-void mainMenu(FlightBST &flightBST, BookingLinkedList &bookingList)
+// Add every account in a file at once; see userimport.h for the format
+void importUsersFromFile()
+{
+    string path;
+    cout << "Enter the file to import (one \"email password name role\" per line): ";
+    cin >> path;
+
+    UserImport report = importUsers(userStore, path);
+    if (!report.opened)
+    {
+        cout << "Could not open " << path << ".\n";
+        return;
+    }
+    cout << report.added << " users imported from " << report.lines << " lines in " << report.seconds << "s ("
+         << report.hashed << " passwords hashed on " << report.threads << " threads).\n";
+    for (size_t i = 0; i < report.errors.size() && i < 5; ++i)
+        cout << "Skipped line " << report.errors[i].line << ": " << report.errors[i].reason << "\n";
+    if (report.errors.size() > 5)
+        cout << report.errors.size() - 5 << " more lines skipped.\n";
+}
+
+// Write every account, with its stored password hash, to a file that importUsersFromFile reads back
+void exportUsersToFile()
+{
+    string path;
+    cout << "Enter the file to export to: ";
+    cin >> path;
+
+    size_t count;
+    if (exportUsers(userStore, path, count))
+        cout << count << " users exported to " << path << ".\n";
+    else
+        cout << "Error writing to file.\n";
+}
+
+// Pick a role, then register, log in, or carry on as the user of a
+// session that is still live
+void mainMenu(FlightBST &flightBST, BookingLinkedList &bookingList, const string &session)
 {
     string roleChoice;
     cout << "Welcome to GIKI Airlines!\n";
@@ -836,84 +2600,246 @@ void mainMenu(FlightBST &flightBST, BookingLinkedList &bookingList)
     cout << "1. Passenger\n2. Airline Staff\n3. Admin\n";
     cin >> roleChoice;
 
+    UserRole role;
     if (roleChoice == "1")
+        role = UserRole::Passenger;
+    else if (roleChoice == "2")
+        role = UserRole::Staff;
+    else if (roleChoice == "3")
+        role = UserRole::Admin;
+    else
     {
-        string subChoice;
-        cout << "1. Register\n2. Login\nEnter your choice: ";
-        cin >> subChoice;
+        cout << "Invalid role selected. Exiting...\n";
+        return;
+    }
 
-        if (subChoice == "1")
-        {
-            registerUser(flightBST, bookingList, "Passenger");
-        }
-        else if (subChoice == "2")
-        {
-            string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuPassenger(flightBST, bookingList);
-        }
+    Session current;
+    bool loggedIn = sessions.find(session, current);
+    string subChoice;
+    cout << "1. Register\n2. Login\n";
+    if (loggedIn)
+        cout << "3. Continue as " << userDisplayName(current.user()) << "\n";
+    cout << "Enter your choice: ";
+    cin >> subChoice;
+
+    if (subChoice == "1")
+    {
+        // Only passengers sign themselves up; staff and admin accounts come
+        // from addUser or an import
+        if (role == UserRole::Passenger)
+            registerUser(flightBST, bookingList, role);
+        else
+            cout << roleName(role) << " accounts are created by an admin. Please log in instead.\n";
     }
-    else if (roleChoice == "2")
+    else if (subChoice == "2")
     {
-        string subChoice;
-        cout << "1. Register\n2. Login\nEnter your choice: ";
-        cin >> subChoice;
-
-        if (subChoice == "1")
-        {
-            registerUser(flightBST, bookingList, "Airline Staff");
-        }
-        else if (subChoice == "2")
+        string newSession;
+        if (loginUser(newSession))
         {
-            string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuStaff(flightBST, bookingList);
+            sessions.revoke(session); // logging in again replaces the old session
+            openRoleMenu(flightBST, bookingList, role, newSession);
         }
     }
-    else if (roleChoice == "3")
+    else if (subChoice == "3" && loggedIn)
     {
-        string subChoice;
-        cout << "1. Register\n2. Login\nEnter your choice: ";
-        cin >> subChoice;
+        openRoleMenu(flightBST, bookingList, role, session);
+    }
+}
 
-        if (subChoice == "1")
-        {
-            registerUser(flightBST, bookingList, "Admin");
-        }
-        else if (subChoice == "2")
-        {
-            string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuAdmin(flightBST, bookingList);
-        }
+// Read a --name=N flag. Returns true when arg is that flag with a whole
+// number; bad is set when it is that flag with anything else.
+bool wholeFlag(const string &arg, const string &name, unsigned long long &out, bool &bad)
+{
+    if (arg.compare(0, name.size(), name) != 0)
+        return false;
+    const char *text = arg.c_str() + name.size();
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (!isdigit(static_cast<unsigned char>(*text)) || *end != '\0' || errno == ERANGE)
+    {
+        cout << "Usage error: " << name.substr(0, name.size() - 1) << " needs a whole number, not \"" << text << "\".\n";
+        bad = true;
+        return false;
     }
-    else
+    out = value;
+    return true;
+}
+
+// Read a --name=F flag holding a rate, clamped to [0,1]; otherwise as wholeFlag
+bool rateFlag(const string &arg, const string &name, double &out, bool &bad)
+{
+    if (arg.compare(0, name.size(), name) != 0)
+        return false;
+    const char *text = arg.c_str() + name.size();
+    char *end;
+    double value = strtod(text, &end);
+    if (*text == '\0' || *end != '\0' || std::isnan(value))
     {
-        cout << "Invalid role selected. Exiting...\n";
+        cout << "Usage error: " << name.substr(0, name.size() - 1) << " needs a rate from 0 to 1, not \"" << text << "\".\n";
+        bad = true;
+        return false;
     }
+    out = min(1.0, max(0.0, value));
+    return true;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 
     FlightBST flightBST;
     BookingLinkedList bookingList;
-    addDefaultFlights(flightBST);
 
-    // Load the users from file into the map (for persistent storage)
-    ifstream inFile("users.txt");
-    if (inFile.is_open())
+    // Durability level for the booking log: --durability=none|group|sync
+    // Snapshot frequency in log records: --snapshot-every=N
+    // Payment workers and stub gateway behaviour: --payment-workers=N,
+    // --gateway-latency-ms=N (per call), --gateway-item-ms=N (per request),
+    // --gateway-failure-rate=F (0 to 1)
+    // Payment batching: --payment-batch=M items, --payment-batch-wait-ms=N
+    // Injected gateway faults: --gateway-error-rate=F, --gateway-slow-rate=F,
+    // --gateway-slow-ms=N
+    // Resilience: --payment-attempts=N (1 disables retries), --breaker-fail-fast
+    // Password hashing: --kdf-target-ms=N (time one check should take),
+    // --verify-workers=N
+    // Sessions: --session-minutes=N (idle time before a login expires)
+    // Login limits: --login-burst=N (failed tries in a row per account),
+    // --login-refill-s=N (seconds to earn one back); a source gets 4 times both
+    Durability durability = Durability::GroupCommit;
+    size_t paymentWorkers = 4;
+    long gatewayLatency = 3000;
+    long gatewayItemCost = 0;
+    double gatewayFailureRate = 0.0;
+    size_t paymentBatch = 1;
+    long paymentBatchWait = 50;
+    double gatewayErrorRate = 0.0;
+    double gatewaySlowRate = 0.0;
+    long gatewaySlowBy = 12000;
+    RetryPolicy retryPolicy;
+    BreakerPolicy breakerPolicy;
+    long kdfTarget = KDF_TARGET_MS;
+    size_t verifyWorkers = 2;
+    long sessionMinutes = 30;
+    RateLimit accountLimit = LOGIN_ACCOUNT_LIMIT;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        unsigned long long n;
+        bool bad = false;
+        if (wholeFlag(arg, "--snapshot-every=", n, bad))
+            snapshotInterval = max(1ull, n);
+        if (wholeFlag(arg, "--payment-workers=", n, bad))
+            paymentWorkers = max(1ull, n);
+        if (wholeFlag(arg, "--gateway-latency-ms=", n, bad))
+            gatewayLatency = static_cast<long>(n);
+        if (wholeFlag(arg, "--gateway-item-ms=", n, bad))
+            gatewayItemCost = static_cast<long>(n);
+        rateFlag(arg, "--gateway-failure-rate=", gatewayFailureRate, bad);
+        if (wholeFlag(arg, "--payment-batch=", n, bad))
+            paymentBatch = max(1ull, n);
+        if (wholeFlag(arg, "--payment-batch-wait-ms=", n, bad))
+            paymentBatchWait = static_cast<long>(n);
+        rateFlag(arg, "--gateway-error-rate=", gatewayErrorRate, bad);
+        rateFlag(arg, "--gateway-slow-rate=", gatewaySlowRate, bad);
+        if (wholeFlag(arg, "--gateway-slow-ms=", n, bad))
+            gatewaySlowBy = static_cast<long>(n);
+        if (wholeFlag(arg, "--payment-attempts=", n, bad))
+            retryPolicy.maxAttempts = static_cast<unsigned>(max(1ull, n));
+        if (arg == "--breaker-fail-fast")
+            breakerPolicy.queueWhenOpen = false;
+        if (wholeFlag(arg, "--kdf-target-ms=", n, bad))
+            kdfTarget = static_cast<long>(max(1ull, n));
+        if (wholeFlag(arg, "--verify-workers=", n, bad))
+            verifyWorkers = max(1ull, n);
+        if (wholeFlag(arg, "--session-minutes=", n, bad))
+            sessionMinutes = static_cast<long>(max(1ull, n));
+        if (wholeFlag(arg, "--login-burst=", n, bad))
+            accountLimit.burst = static_cast<double>(max(1ull, n));
+        if (wholeFlag(arg, "--login-refill-s=", n, bad))
+            accountLimit.perSecond = 1.0 / max(1ull, n);
+        if (bad)
+            return 1;
+        if (arg == "--durability=none")
+            durability = Durability::None;
+        else if (arg == "--durability=group")
+            durability = Durability::GroupCommit;
+        else if (arg == "--durability=sync")
+            durability = Durability::Sync;
+    }
+
+    // Recover state from the latest snapshot plus the log tail after it,
+    // or start fresh with the default flights
+    uint64_t snapshotLSN = 0;
+    bool recovered = loadSnapshot(flightBST, bookingList, snapshotLSN);
+    uint64_t lastLSN = snapshotLSN;
+    long validBytes = 0;
+    bool archived = replayBookingLog(BOOKING_LOG_ARCHIVE, snapshotLSN, flightBST, bookingList, lastLSN);
+    recovered = replayBookingLog(BOOKING_LOG_FILE, snapshotLSN, flightBST, bookingList, lastLSN, &validBytes) || archived || recovered;
+    uint32_t logVersion = WriteAheadLog::fileVersion(BOOKING_LOG_FILE);
+    if (!bookingLog.open(BOOKING_LOG_FILE, durability, lastLSN, validBytes))
+    {
+        if (logVersion == 0 && !WriteAheadLog::isBlank(BOOKING_LOG_FILE))
+            cout << "Warning: " << BOOKING_LOG_FILE << " is not a log this version can read and was left as it is, "
+                 << "changes will not be saved.\n";
+        else
+            cout << "Warning: could not open the booking log, changes will not be saved.\n";
+    }
+
+    // A log in an older format is not appended to: once a snapshot holds its
+    // records in the current format it is rotated out for a fresh log
+    if (bookingLog.isOpen() && logVersion != 0 && logVersion < WAL_FORMAT_VERSION)
     {
-        string email, password, name;
-        while (inFile >> email >> password >> name)
+        if (takeSnapshot(flightBST, bookingList, false) && bookingLog.rotate(BOOKING_LOG_ARCHIVE))
+        {
+            std::remove(BOOKING_LOG_ARCHIVE.c_str());
+        }
+        else
         {
-            users[email] = {password, name}; // Load stored user data
+            bookingLog.close();
+            cout << "Warning: could not upgrade the booking log, changes will not be saved.\n";
         }
-        inFile.close();
     }
+    if (!recovered)
+        addDefaultFlights(flightBST);
+    bookingHistory.open(BOOKING_HISTORY_FILE);
+    dropUnloggedHistory(bookingList);
+
+    // A snapshot was interrupted: cover the archived log before it can be overwritten
+    ifstream archive(BOOKING_LOG_ARCHIVE);
+    if (archive.is_open())
+    {
+        archive.close();
+        takeSnapshot(flightBST, bookingList, false);
+    }
+
+    // Open the user store; the first time, users.txt is imported into it
+    UserFileLoad userFile;
+    if (!openUserStore(userStore, userFile))
+        cout << "Warning: could not open the user store, new users will not be saved.\n";
+    for (size_t i = 0; i < userFile.errors.size() && i < 5; ++i)
+        cout << "Warning: users.txt line " << userFile.errors[i].line << " skipped: " << userFile.errors[i].reason << "\n";
+    if (userFile.errors.size() > 5)
+        cout << "Warning: " << userFile.errors.size() - 5 << " more malformed lines in users.txt skipped.\n";
+
+    authenticator.start(verifyWorkers, chrono::milliseconds(kdfTarget));
+    sessions.setLifetime(chrono::minutes(sessionMinutes));
+    loginLimiter.setLimits(accountLimit, {accountLimit.burst * 4, accountLimit.perSecond * 4});
+    if (!loginLimiter.open(LOGIN_ACCOUNT_LIMIT_FILE, LOGIN_SOURCE_LIMIT_FILE))
+        cout << "Warning: could not open the login limit files, limits will reset on restart.\n";
+    loginSource = loginSourceName();
+
+    paymentPipeline.resumeRequestIDs(paymentLedger.lastRequestID());
+    paymentPipeline.setBatching(paymentBatch, chrono::milliseconds(paymentBatchWait));
+    paymentPipeline.setRetryPolicy(retryPolicy);
+    paymentPipeline.setBreakerPolicy(breakerPolicy);
+    auto stubGateway = make_shared<StubGateway>(chrono::milliseconds(gatewayLatency), gatewayFailureRate,
+                                                chrono::milliseconds(gatewayItemCost));
+    paymentPipeline.start(make_shared<FaultInjectingGateway>(stubGateway, gatewayErrorRate, gatewaySlowRate,
+                                                             chrono::milliseconds(gatewaySlowBy)),
+                          paymentWorkers);
 
     // Display the main menu
     mainMenu(flightBST, bookingList);
+    finishPayments(bookingList);
 
     return 0;
 }
\ No newline at end of file
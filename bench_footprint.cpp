@@ -0,0 +1,117 @@
+// Memory footprint of in-memory bookings: the old Passenger layout (three
+// std::strings, two doubles, a bool) against the compact 32-byte record.
+//
+// Build: g++ -std=c++17 -O2 bench_footprint.cpp -o bench_footprint
+// Run:   ./bench_footprint [bookings] [distinct names]
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "passengerrecord.h"
+
+using namespace std;
+
+// Count live heap bytes by wrapping the global allocator. GCC cannot see
+// that free() receives what the replacement operator new got from malloc().
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static size_t heapBytes = 0;
+
+void *operator new(size_t size)
+{
+    size_t *block = static_cast<size_t *>(malloc(size + sizeof(size_t)));
+    if (!block)
+        throw bad_alloc();
+    *block = size;
+    heapBytes += size;
+    return block + 1;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (!p)
+        return;
+    size_t *block = static_cast<size_t *>(p) - 1;
+    heapBytes -= *block;
+    free(block);
+}
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+// The booking layout before the compact record
+struct LegacyPassenger
+{
+    int bookingID;
+    string name;
+    int flightID;
+    string flightDate;
+    string flightTime;
+    double fare;
+    bool isPaid;
+    double paymentAmount;
+
+    LegacyPassenger(int id, string n, int f, string d, string t, double fr)
+        : bookingID(id), name(move(n)), flightID(f), flightDate(move(d)), flightTime(move(t)), fare(fr), isPaid(false), paymentAmount(0) {}
+};
+
+// Mix of short names that fit the small-string buffer and longer ones that do not
+static string passengerName(size_t i, size_t distinct)
+{
+    size_t k = i * 2654435761u % distinct;
+    return k % 3 == 0 ? "Passenger Number " + to_string(k) : "P" + to_string(k);
+}
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t distinct = argc > 2 ? strtoull(argv[2], nullptr, 10) : 50000;
+    const int flights = 100;
+
+    for (int f = 1; f <= flights; ++f)
+        flightSchedule().set(f, "2024-12-15", "08:00");
+
+    size_t before = heapBytes;
+    auto start = chrono::steady_clock::now();
+    {
+        vector<LegacyPassenger> legacy;
+        legacy.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            legacy.emplace_back(static_cast<int>(i + 1), passengerName(i, distinct), static_cast<int>(i % flights + 1),
+                                "2024-12-15", "08:00", 18400.0);
+        double elapsed = seconds(start);
+        size_t bytes = heapBytes - before;
+        printf("legacy   sizeof %3zu  total %8.1f MB  %6.1f B/booking  build %.2fs\n",
+               sizeof(LegacyPassenger), bytes / 1e6, double(bytes) / count, elapsed);
+    }
+
+    before = heapBytes;
+    start = chrono::steady_clock::now();
+    {
+        vector<Passenger> compact;
+        compact.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            compact.emplace_back(static_cast<int>(i + 1), passengerName(i, distinct), static_cast<int>(i % flights + 1),
+                                 Money::fromMajor(18400));
+        double elapsed = seconds(start);
+        size_t bytes = heapBytes - before; // includes the name pool
+        printf("compact  sizeof %3zu  total %8.1f MB  %6.1f B/booking  build %.2fs  (%zu interned names)\n",
+               sizeof(Passenger), bytes / 1e6, double(bytes) / count, elapsed, passengerNames().size());
+
+        // Touch every hot record once, as a report over all bookings would
+        start = chrono::steady_clock::now();
+        int64_t revenue = 0;
+        for (const Passenger &p : compact)
+            revenue += p.fareMinor;
+        printf("compact  scan %.3fs (%lld)\n", seconds(start), static_cast<long long>(revenue / 100));
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Password hashing cost and its effect on other work during a login storm.
+//
+// The PBKDF2 code is first checked against the PBKDF2-HMAC-SHA256 test
+// vectors in RFC 7914 section 11. Then the iteration count is calibrated for the target latency and the
+// real verification time is measured. Then booking-like CPU work runs on
+// its own threads while a burst of logins is verified two ways: one thread
+// per login, and through a PasswordVerifier pool. The booking work done
+// per second is compared with a run that has no logins at all.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_kdf.cpp -o bench_kdf
+// Run:   ./bench_kdf [target ms] [logins] [pool threads]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "passwordhash.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Booking threads do small units of CPU work until told to stop
+static double bookingRate(size_t threads, const function<void()> &alongside)
+{
+    atomic<bool> done(false);
+    atomic<uint64_t> units(0);
+    vector<thread> bookings;
+    for (size_t i = 0; i < threads; ++i)
+        bookings.emplace_back([&]
+                              {
+                                  uint64_t x = 1;
+                                  while (!done)
+                                  {
+                                      for (int j = 0; j < 10000; ++j)
+                                          x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                                      units += 1 + (x == 0);
+                                  } });
+    auto start = chrono::steady_clock::now();
+    alongside();
+    double elapsed = seconds(start);
+    done = true;
+    for (thread &booking : bookings)
+        booking.join();
+    return units / elapsed;
+}
+
+// RFC 7914 section 11: PBKDF2-HMAC-SHA256 with a 64 byte output
+static bool matchesTestVectors()
+{
+    struct Vector
+    {
+        const char *password;
+        const char *salt;
+        uint32_t iterations;
+        const char *key;
+    };
+    const Vector vectors[] = {
+        {"passwd", "salt", 1,
+         "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+         "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"},
+        {"Password", "NaCl", 80000,
+         "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+         "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d"},
+    };
+    for (const Vector &vector : vectors)
+    {
+        uint8_t key[64];
+        pbkdf2Sha256(vector.password, reinterpret_cast<const uint8_t *>(vector.salt), strlen(vector.salt),
+                     vector.iterations, key, sizeof(key));
+        if (toHex(key, sizeof(key)) != vector.key)
+        {
+            printf("PBKDF2 does not match RFC 7914 for password \"%s\"\n", vector.password);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    long target = argc > 1 ? atol(argv[1]) : 100;
+    size_t logins = argc > 2 ? strtoull(argv[2], nullptr, 10) : 32;
+    size_t poolThreads = argc > 3 ? strtoull(argv[3], nullptr, 10) : 2;
+    size_t bookingThreads = max(1u, thread::hardware_concurrency());
+
+    if (!matchesTestVectors())
+        return 1;
+    printf("PBKDF2 matches the RFC 7914 test vectors\n");
+
+    auto start = chrono::steady_clock::now();
+    uint32_t iterations = calibrateKdfIterations(chrono::milliseconds(target));
+    double calibration = seconds(start);
+    string stored = hashPassword("correct horse 1", iterations);
+    vector<double> times;
+    for (int i = 0; i < 5; ++i)
+    {
+        start = chrono::steady_clock::now();
+        if (!verifyPassword("correct horse 1", stored) || verifyPassword("correct horse 2", stored))
+        {
+            printf("verification gave the wrong answer\n");
+            return 1;
+        }
+        times.push_back(seconds(start) / 2);
+    }
+    sort(times.begin(), times.end());
+    printf("calibrated %u iterations in %.3fs; one check takes %.1f ms (target %ld ms)\n", iterations, calibration,
+           times[2] * 1000, target);
+
+    double idle = bookingRate(bookingThreads, []
+                              { this_thread::sleep_for(chrono::seconds(1)); });
+
+    double stormSeconds = 0;
+    double perLogin = bookingRate(bookingThreads, [&]
+                                  {
+                                      auto begin = chrono::steady_clock::now();
+                                      vector<thread> checks;
+                                      for (size_t i = 0; i < logins; ++i)
+                                          checks.emplace_back([&]
+                                                              { verifyPassword("guess", stored); });
+                                      for (thread &check : checks)
+                                          check.join();
+                                      stormSeconds = seconds(begin); });
+    double perLoginStorm = stormSeconds;
+
+    PasswordVerifier verifier;
+    verifier.start(poolThreads, iterations);
+    double pooled = bookingRate(bookingThreads, [&]
+                                {
+                                    auto begin = chrono::steady_clock::now();
+                                    vector<future<bool>> checks;
+                                    for (size_t i = 0; i < logins; ++i)
+                                        checks.push_back(verifier.verify("guess", stored));
+                                    for (future<bool> &check : checks)
+                                        check.get();
+                                    stormSeconds = seconds(begin); });
+
+    printf("%zu booking threads, %zu logins at once\n", bookingThreads, logins);
+    printf("no logins          %10.0f units/s\n", idle);
+    printf("thread per login   %10.0f units/s  (%3.0f%%), storm took %.2fs\n", perLogin, 100 * perLogin / idle,
+           perLoginStorm);
+    printf("pool of %-2zu         %10.0f units/s  (%3.0f%%), storm took %.2fs\n", poolThreads, pooled,
+           100 * pooled / idle, stormSeconds);
+    return 0;
+}
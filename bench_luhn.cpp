@@ -0,0 +1,72 @@
+// Luhn checking of 16-digit card numbers: the scalar loop against the
+// batched kernel (SSE2 on x86), with both required to agree on every card.
+//
+// Build: g++ -std=c++17 -O2 bench_luhn.cpp -o bench_luhn
+// Run:   ./bench_luhn [cards]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "cardvalidation.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    const size_t stride = 16;
+
+    // Random numbers with the check digit fixed on about half of them, and
+    // a stray non-digit in a few
+    vector<char> cards(count * stride);
+    mt19937_64 rng(42);
+    for (size_t i = 0; i < count; ++i)
+    {
+        char *card = &cards[i * stride];
+        card[0] = '4';
+        for (size_t j = 1; j < 16; ++j)
+            card[j] = static_cast<char>('0' + rng() % 10);
+        if (rng() % 2)
+            for (char check = '0'; check <= '9'; ++check)
+            {
+                card[15] = check;
+                if (luhnValid(card, 16))
+                    break;
+            }
+        if (rng() % 1000 == 0)
+            card[rng() % 16] = 'x';
+    }
+
+    vector<uint8_t> scalar(count), batched(count);
+    auto start = chrono::steady_clock::now();
+    luhnValidBatchScalar(cards.data(), count, stride, scalar.data());
+    double scalarTime = seconds(start);
+
+    start = chrono::steady_clock::now();
+    luhnValidBatch(cards.data(), count, stride, batched.data());
+    double batchedTime = seconds(start);
+
+    size_t valid = 0, mismatches = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        valid += scalar[i];
+        mismatches += scalar[i] != batched[i];
+    }
+#ifdef CARD_LUHN_SSE2
+    const char *kernel = "SSE2";
+#else
+    const char *kernel = "scalar fallback";
+#endif
+    printf("%zu cards, %zu valid, %zu mismatches\n", count, valid, mismatches);
+    printf("scalar   %.3fs  %7.1f M cards/s\n", scalarTime, count / scalarTime / 1e6);
+    printf("batched  %.3fs  %7.1f M cards/s  (%s, %.1fx)\n", batchedTime, count / batchedTime / 1e6, kernel,
+           scalarTime / batchedTime);
+    return mismatches == 0 ? 0 : 1;
+}
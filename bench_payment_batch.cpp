@@ -0,0 +1,54 @@
+// Payment throughput with and without batching against the stub gateway.
+// A flash sale is modelled as a burst of requests submitted at once.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_payment_batch.cpp -o bench_payment_batch
+// Run:   ./bench_payment_batch [requests] [workers] [call overhead ms] [batch size]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include "payment.h"
+
+using namespace std;
+
+static void run(size_t count, size_t workers, long overhead, size_t batch)
+{
+    PaymentPipeline pipeline;
+    pipeline.setBatching(batch, chrono::milliseconds(20));
+    pipeline.start(make_shared<StubGateway>(chrono::milliseconds(overhead), 0.0), workers);
+
+    auto start = chrono::steady_clock::now();
+    vector<shared_future<PaymentResult>> results;
+    results.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        PaymentRequest request;
+        request.payer = "passenger" + to_string(i);
+        request.amount = Money::fromMajor(18400);
+        request.bookingIDs = {static_cast<int>(i + 1)};
+        request.cardNumber = "4111111111111111";
+        request.expiryDate = "12/99";
+        results.push_back(pipeline.submit(request));
+    }
+    size_t approved = 0;
+    for (shared_future<PaymentResult> &result : results)
+        approved += result.get().approved();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    PaymentPipeline::Stats stats = pipeline.stats();
+    printf("batch %4zu  %6zu approved  %6llu gateway calls  %7.2fs  %9.1f payments/s\n", batch, approved,
+           static_cast<unsigned long long>(stats.gatewayCalls), elapsed, count / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000;
+    size_t workers = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4;
+    long overhead = argc > 3 ? strtol(argv[3], nullptr, 10) : 20;
+    size_t batch = argc > 4 ? strtoull(argv[4], nullptr, 10) : 64;
+
+    run(count, workers, overhead, 1);
+    run(count, workers, overhead, batch);
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Payment resilience against the fault-injecting gateway: how many payments
+// succeed, and what they cost in retries and time, with and without retries
+// and the circuit breaker.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_payment_faults.cpp -o bench_payment_faults
+// Run:   ./bench_payment_faults [requests] [error rate]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include "payment.h"
+
+using namespace std;
+
+struct Scenario
+{
+    const char *name;
+    unsigned attempts;
+    bool queueWhenOpen;
+    bool outage; // gateway down for the first outageLength
+};
+
+static void run(const Scenario &scenario, size_t count, double errorRate)
+{
+    const chrono::milliseconds outageLength(600);
+    auto faults = make_shared<FaultInjectingGateway>(make_shared<StubGateway>(chrono::milliseconds(5), 0.0), errorRate,
+                                                     0.0, chrono::milliseconds(0));
+    PaymentPipeline pipeline;
+    RetryPolicy retry;
+    retry.maxAttempts = scenario.attempts;
+    retry.baseDelay = chrono::milliseconds(10);
+    retry.maxDelay = chrono::milliseconds(200);
+    BreakerPolicy breaker;
+    breaker.cooldown = chrono::milliseconds(200);
+    breaker.queueWhenOpen = scenario.queueWhenOpen;
+    pipeline.setRetryPolicy(retry);
+    pipeline.setBreakerPolicy(breaker);
+    pipeline.start(faults, 8);
+
+    faults->setOutage(scenario.outage);
+    thread restore([&]
+                   { this_thread::sleep_for(outageLength);
+                     faults->setOutage(false); });
+
+    auto start = chrono::steady_clock::now();
+    vector<shared_future<PaymentResult>> results;
+    for (size_t i = 0; i < count; ++i)
+    {
+        PaymentRequest request;
+        request.payer = "passenger" + to_string(i);
+        request.amount = Money::fromMajor(18400);
+        request.bookingIDs = {static_cast<int>(i + 1)};
+        request.cardNumber = "4111111111111111";
+        request.expiryDate = "12/99";
+        results.push_back(pipeline.submit(request));
+    }
+    size_t approved = 0;
+    for (shared_future<PaymentResult> &result : results)
+        approved += result.get().approved();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    restore.join();
+
+    PaymentPipeline::Stats stats = pipeline.stats();
+    printf("%-28s %5zu/%zu approved  %6llu calls  %6llu retries  %6llu rejected  %3llu trips  %6.2fs\n", scenario.name,
+           approved, count, static_cast<unsigned long long>(stats.gatewayCalls),
+           static_cast<unsigned long long>(stats.retries), static_cast<unsigned long long>(stats.rejected),
+           static_cast<unsigned long long>(stats.breakerTrips), elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000;
+    double errorRate = argc > 2 ? atof(argv[2]) : 0.2;
+
+    const Scenario scenarios[] = {
+        {"no retries", 1, true, false},
+        {"retries", 4, true, false},
+        {"outage, fail fast", 4, false, true},
+        {"outage, queue while open", 4, true, true},
+    };
+    for (const Scenario &scenario : scenarios)
+        run(scenario, count, errorRate);
+    return 0;
+}
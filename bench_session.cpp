@@ -0,0 +1,70 @@
+// What a menu action costs to authenticate: looking its session up against
+// checking the password again with the KDF at the calibrated cost. Session
+// lookups are also run from several threads at once over many live
+// sessions, to show the sharded table does not serialize them.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_session.cpp -o bench_session
+// Run:   ./bench_session [sessions] [threads] [kdf target ms]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "session.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    size_t threads = argc > 2 ? strtoull(argv[2], nullptr, 10) : max(1u, thread::hardware_concurrency());
+    long target = argc > 3 ? atol(argv[3]) : 100;
+    const size_t lookupsPerThread = 1000000;
+
+    uint32_t iterations = calibrateKdfIterations(chrono::milliseconds(target));
+    string stored = hashPassword("correct horse 1", iterations);
+    auto start = chrono::steady_clock::now();
+    const int checks = 5;
+    for (int i = 0; i < checks; ++i)
+        if (!verifyPassword("correct horse 1", stored))
+            return 1;
+    double perCheck = seconds(start) / checks;
+
+    SessionManager sessions;
+    vector<string> tokens(count);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+        tokens[i] = sessions.issue(
+            {"user" + to_string(i) + "@giki.edu.pk", "", "Passenger " + to_string(i), UserRole::Passenger});
+    double issueTime = seconds(start);
+
+    atomic<size_t> found(0);
+    vector<thread> pool;
+    start = chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; ++t)
+        pool.emplace_back([&, t]
+                          {
+                              Session session;
+                              size_t hits = 0;
+                              for (size_t i = 0; i < lookupsPerThread; ++i)
+                                  hits += sessions.find(tokens[(i * 7919 + t * 104729) % count], session);
+                              found += hits; });
+    for (thread &worker : pool)
+        worker.join();
+    double lookupTime = seconds(start);
+    size_t lookups = threads * lookupsPerThread;
+
+    printf("password check   %10.3f ms per action (%u iterations)\n", perCheck * 1000, iterations);
+    printf("session issue    %10.3f us each, %zu sessions\n", issueTime / count * 1e6, count);
+    printf("session lookup   %10.3f us per action, %.1f M lookups/s on %zu threads\n",
+           lookupTime / lookupsPerThread * 1e6, lookups / lookupTime / 1e6, threads);
+    return found == lookups ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+// Startup cost of the user store as changes pile up. Every round replaces
+// every user once, as a password rehash sweep would; after each round the
+// index is deleted and the store reopened, which is the worst case for
+// startup since every record in users.db has to be read again. Without
+// compaction that grows with the number of changes ever made; with it,
+// it stays proportional to the live users. The slowest single change is
+// reported too, since compaction runs beside them.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_usercompact.cpp -o bench_usercompact
+// Run:   ./bench_usercompact [accounts] [rounds]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "userstore.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000;
+    size_t rounds = argc > 2 ? strtoull(argv[2], nullptr, 10) : 6;
+    const char *dataPath = "bench_users.db";
+    const char *indexPath = "bench_users.idx";
+    remove(dataPath);
+    remove(indexPath);
+
+    vector<UserRecord> users(count);
+    for (size_t i = 0; i < count; ++i)
+        users[i] = {"user" + to_string(i) + "@giki.edu.pk", "", "Passenger " + to_string(i), UserRole::Passenger};
+
+    UserStore store;
+    if (!store.open(dataPath, indexPath))
+    {
+        printf("could not open the store\n");
+        return 1;
+    }
+    printf("%zu accounts, each replaced once per round\n", count);
+    printf("round  records in users.db  compactions  reopen without index  slowest change\n");
+    for (size_t round = 0; round <= rounds; ++round)
+    {
+        double slowest = 0;
+        for (UserRecord &user : users)
+        {
+            user.password = "pbkdf2-sha256$120000$" + to_string(round) + "$" + user.email;
+            auto start = chrono::steady_clock::now();
+            if (!store.put(user))
+            {
+                printf("write failed\n");
+                return 1;
+            }
+            slowest = max(slowest, seconds(start));
+        }
+
+        store.close();
+        remove(indexPath);
+        auto start = chrono::steady_clock::now();
+        if (!store.open(dataPath, indexPath) || store.size() != count)
+        {
+            printf("reopen lost users\n");
+            return 1;
+        }
+        printf("%5zu  %19llu  %11u  %17.1f ms  %11.2f ms\n", round, static_cast<unsigned long long>(store.recordCount()),
+               store.compactionCount(), seconds(start) * 1000, slowest * 1000);
+    }
+
+    UserRecord user;
+    bool ok = store.find(users[count / 2].email, user) && user.password == users[count / 2].password;
+    store.close();
+    remove(dataPath);
+    remove(indexPath);
+    return ok ? 0 : 1;
+}
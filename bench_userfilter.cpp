@@ -0,0 +1,101 @@
+// Registration checks against the user store's email filter. A store of N
+// accounts is opened fresh and checked for emails nobody has, as each
+// registration does, then for emails that exist, as each login does. For
+// both it reports the time per check and how much of users.idx and
+// users.db became resident: unknown emails should be answered from the
+// filter, a fortieth of the index, while known ones have to probe the
+// slots and read a record. Also reports how often an unknown email got
+// past the filter.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_userfilter.cpp -o bench_userfilter
+// Run:   ./bench_userfilter [accounts] [checks]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "userstore.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Resident set size in MB (Linux only; 0 elsewhere)
+static double residentMB()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1048576.0);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t checks = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000;
+    const char *dataPath = "bench_users.db";
+    const char *indexPath = "bench_users.idx";
+    remove(dataPath);
+    remove(indexPath);
+    {
+        vector<UserRecord> users(count);
+        for (size_t i = 0; i < count; ++i)
+            users[i] = {"user" + to_string(i) + "@giki.edu.pk", "pbkdf2-sha256$120000$" + to_string(i * 7919),
+                        "Passenger " + to_string(i), UserRole::Passenger};
+        UserStore store;
+        if (!store.open(dataPath, indexPath) || !store.putMany(users))
+        {
+            printf("could not build the store\n");
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(21);
+    vector<string> unknown(checks), known(checks);
+    for (size_t i = 0; i < checks; ++i)
+    {
+        unknown[i] = "new" + to_string(rng()) + "@giki.edu.pk";
+        known[i] = "user" + to_string(rng() % count) + "@giki.edu.pk";
+    }
+
+    UserStore store;
+    store.open(dataPath, indexPath);
+    double before = residentMB();
+    size_t found = 0, passed = 0;
+    auto start = chrono::steady_clock::now();
+    for (const string &email : unknown)
+        found += store.contains(email);
+    double unknownTime = seconds(start);
+    double unknownResident = residentMB() - before;
+    for (const string &email : unknown)
+        passed += store.mayContain(email);
+
+    before = residentMB();
+    start = chrono::steady_clock::now();
+    for (const string &email : known)
+        found += store.contains(email);
+    double knownTime = seconds(start);
+    double knownResident = residentMB() - before;
+
+    struct stat st;
+    double indexMB = stat(indexPath, &st) == 0 ? st.st_size / 1048576.0 : 0;
+    store.close();
+    remove(dataPath);
+    remove(indexPath);
+
+    printf("%zu accounts, users.idx %.1f MB of which the filter is %.1f MB\n", count, indexMB, indexMB / 17);
+    printf("unknown emails  %6.3f us per check, %6.1f MB became resident, %.3f%% got past the filter\n",
+           unknownTime / checks * 1e6, unknownResident, 100.0 * passed / checks);
+    printf("known emails    %6.3f us per check, %6.1f MB became resident\n", knownTime / checks * 1e6,
+           knownResident);
+    return found == checks ? 0 : 1;
+}
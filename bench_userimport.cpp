@@ -0,0 +1,99 @@
+// Onboarding a batch of accounts. A file of N pre-hashed accounts (as an
+// export writes them) is imported into an empty store in one batch, and
+// exported again; the same accounts are then added one put() at a time,
+// as addUser does, for a sample of them. A smaller file of plain
+// passwords shows the cost of hashing during an import, which is what
+// bounds a file of plain passwords.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_userimport.cpp -o bench_userimport
+// Run:   ./bench_userimport [accounts] [plain-password accounts] [one-by-one sample]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "userimport.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void removeStore()
+{
+    remove("bench_users.db");
+    remove("bench_users.idx");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    size_t plainCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : 500;
+    size_t sample = argc > 3 ? strtoull(argv[3], nullptr, 10) : 5000;
+    const char *hashedPath = "bench_import_hashed.txt";
+    const char *plainPath = "bench_import_plain.txt";
+    const char *exportPath = "bench_export.txt";
+
+    // Hashing every row at the minimum cost would take as long as the
+    // plain-password case; the rows differ only in their salt, which
+    // costs nothing to vary
+    string stored = hashPassword("partnerPass1", KDF_MIN_ITERATIONS);
+    vector<UserRecord> users(count);
+    {
+        FILE *hashed = fopen(hashedPath, "wb");
+        FILE *plain = fopen(plainPath, "wb");
+        for (size_t i = 0; i < count; ++i)
+        {
+            users[i] = {"staff" + to_string(i) + "@partner.example", stored, "Partner Staff " + to_string(i),
+                        UserRole::Staff};
+            string salt = to_string(1000000000000000ull + i * 7919);
+            users[i].password.replace(users[i].password.find('$', 14) + 1, salt.size(), salt);
+            fprintf(hashed, "%s %s %s %s\n", users[i].email.c_str(), users[i].password.c_str(), users[i].name.c_str(),
+                    roleName(users[i].role));
+            if (i < plainCount)
+                fprintf(plain, "%s partnerPass%zu %s %s\n", users[i].email.c_str(), i, users[i].name.c_str(),
+                        roleName(users[i].role));
+        }
+        fclose(hashed);
+        fclose(plain);
+    }
+
+    removeStore();
+    UserStore store;
+    store.open("bench_users.db", "bench_users.idx");
+    UserImport hashedImport = importUsers(store, hashedPath);
+    auto start = chrono::steady_clock::now();
+    size_t exported = 0;
+    bool exportedOk = exportUsers(store, exportPath, exported);
+    double exportTime = seconds(start);
+    store.close();
+
+    removeStore();
+    store.open("bench_users.db", "bench_users.idx");
+    UserImport plainImport = importUsers(store, plainPath);
+    store.close();
+
+    removeStore();
+    store.open("bench_users.db", "bench_users.idx");
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < sample && i < count; ++i)
+        store.put(users[i]);
+    double perPut = seconds(start) / min(sample, count);
+    store.close();
+    removeStore();
+    remove(hashedPath);
+    remove(plainPath);
+    remove(exportPath);
+
+    printf("%zu pre-hashed accounts imported in %.2fs on %zu threads (%zu skipped)\n", hashedImport.added,
+           hashedImport.seconds, hashedImport.threads, hashedImport.errors.size());
+    printf("%zu accounts exported in %.2fs\n", exported, exportTime);
+    printf("one put() per account: %.3f ms each, %.0fs for %zu accounts\n", perPut * 1000, perPut * count, count);
+    double perHash = plainImport.seconds / max<size_t>(1, plainImport.hashed);
+    printf("%zu plain passwords imported in %.2fs on %zu threads: %.1f ms each, %.0fs for %zu accounts\n",
+           plainImport.added, plainImport.seconds, plainImport.threads, perHash * 1000, perHash * count, count);
+    return hashedImport.added == count && exportedOk && exported == count && plainImport.added == plainCount ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+// Loading users.txt into the user map: the old stream loop (three
+// whitespace-separated tokens per record) against the mapped, chunked
+// loader. The generated file has multi-word names and roles, which the
+// stream loop misreads, so it also reports how many records each one got
+// right.
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_users_load.cpp -o bench_users_load
+// Run:   ./bench_users_load [accounts] [threads]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include "userfile.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t threads = argc > 2 ? strtoull(argv[2], nullptr, 10) : 0;
+    const char *path = "bench_users.txt";
+
+    const char *roles[] = {"Passenger", "Airline Staff", "Admin"};
+    const char *first[] = {"Arsha", "Eiman", "Ali", "Mary Ann", "Zain"};
+    const char *last[] = {"", " Khan", " Malik", " de la Cruz"};
+    mt19937_64 rng(3);
+    {
+        ofstream out(path, ios::binary);
+        char hash[65];
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (int j = 0; j < 64; ++j)
+                hash[j] = "0123456789abcdef"[rng() % 16];
+            hash[64] = 0;
+            out << "user" << i << "@giki.edu.pk pbkdf2-sha256$120000$" << string(hash, 32) << "$" << hash << " "
+                << first[rng() % 5] << last[rng() % 4] << " " << roles[rng() % 3] << "\n";
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    unordered_map<string, pair<string, string>> streamUsers;
+    {
+        ifstream in(path);
+        string email, password, name;
+        while (in >> email >> password >> name)
+            streamUsers[email] = {password, name};
+    }
+    double streamTime = seconds(start);
+    size_t streamRight = 0;
+    for (size_t i = 0; i < count; ++i)
+        streamRight += streamUsers.count("user" + to_string(i) + "@giki.edu.pk");
+    streamUsers = {};
+
+    start = chrono::steady_clock::now();
+    UserMap users;
+    UserFileLoad load = loadUserFile(path, users, threads);
+    double mappedTime = seconds(start);
+
+    size_t mappedRight = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto found = users.find("user" + to_string(i) + "@giki.edu.pk");
+        mappedRight += found != users.end() && found->second.password.size() == 118 && found->second.role != UserRole::None;
+    }
+    remove(path);
+
+    printf("%zu accounts\n", count);
+    printf("stream  %.3fs  %5.1f M lines/s  %zu emails found (roles and second names read as emails)\n", streamTime,
+           count / streamTime / 1e6, streamRight);
+    printf("mapped  %.3fs  %5.1f M lines/s  %zu records right, %zu errors, %zu threads\n", mappedTime,
+           count / mappedTime / 1e6, mappedRight, load.errors.size(), load.threads);
+    return mappedRight == count && load.errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Serving logins from the on-disk user store against loading every
+// account first. Builds a store and a users.txt with the same accounts,
+// then times opening each and looking up a handful of users, and reports
+// the resident memory each approach ends up with (Linux only; 0 elsewhere).
+//
+// Build: g++ -std=c++17 -O2 -pthread bench_userstore.cpp -o bench_userstore
+// Run:   ./bench_userstore [accounts] [lookups]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include "userstore.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Resident set size in MB
+static double residentMB()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1048576.0);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000;
+    const char *dataPath = "bench_users.db";
+    const char *indexPath = "bench_users.idx";
+    const char *textPath = "bench_users.txt";
+    remove(dataPath);
+    remove(indexPath);
+
+    // Same accounts in both formats
+    {
+        mt19937_64 rng(11);
+        vector<UserRecord> users(count);
+        ofstream text(textPath, ios::binary);
+        for (size_t i = 0; i < count; ++i)
+        {
+            users[i].email = "user" + to_string(i) + "@giki.edu.pk";
+            users[i].password = "pbkdf2-sha256$120000$" + to_string(rng()) + "$" + to_string(rng());
+            users[i].name = "Passenger " + to_string(i);
+            users[i].role = UserRole::Passenger;
+            text << users[i].email << " " << users[i].password << " " << users[i].name << " " << roleName(users[i].role) << "\n";
+        }
+        UserStore store;
+        auto start = chrono::steady_clock::now();
+        if (!store.open(dataPath, indexPath) || !store.putMany(users))
+        {
+            printf("could not build the store\n");
+            return 1;
+        }
+        printf("%zu accounts written to the store in %.2fs\n", count, seconds(start));
+    }
+
+    mt19937_64 rng(12);
+    vector<string> wanted(lookups);
+    for (string &email : wanted)
+        email = "user" + to_string(rng() % count) + "@giki.edu.pk";
+
+    double baseline = residentMB();
+    size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    UserStore store;
+    store.open(dataPath, indexPath);
+    double openTime = seconds(start);
+    start = chrono::steady_clock::now();
+    UserRecord user;
+    for (const string &email : wanted)
+        found += store.find(email, user);
+    double lookupTime = seconds(start);
+    double storeResident = residentMB() - baseline;
+    store.close();
+
+    start = chrono::steady_clock::now();
+    UserMap users;
+    loadUserFile(textPath, users);
+    double loadTime = seconds(start);
+    for (const string &email : wanted)
+        found += users.count(email);
+    double mapResident = residentMB() - baseline;
+
+    remove(dataPath);
+    remove(indexPath);
+    remove(textPath);
+    printf("store   open %8.3f ms, %zu lookups %6.2f us each, %7.1f MB resident\n", openTime * 1000, lookups,
+           lookupTime / lookups * 1e6, storeResident);
+    printf("load    all  %8.3f ms,                              %7.1f MB resident\n", loadTime * 1000, mapResident);
+    return found == 2 * lookups ? 0 : 1;
+}
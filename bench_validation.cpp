@@ -0,0 +1,115 @@
+// Registration checks on a bulk import: the old std::regex validators, which
+// compile their pattern on every call, against the table-driven automata in
+// validation.h. The regex copies keep the old domain class [a-zA0-9.-], so
+// addresses with upper-case domain letters are left out of the agreement
+// check; they are the ones the old pattern wrongly rejected.
+//
+// Build: g++ -std=c++17 -O2 bench_validation.cpp -o bench_validation
+// Run:   ./bench_validation [records]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <regex>
+#include <chrono>
+#include <random>
+#include "validation.h"
+
+using namespace std;
+
+static bool regexValidEmail(const string &email)
+{
+    regex emailPattern(R"([a-zA-Z0-9._%+-]+@[a-zA0-9.-]+\.[a-zA-Z]{2,})");
+    return regex_match(email, emailPattern);
+}
+
+static bool regexValidPassword(const string &password)
+{
+    if (password.length() < 8)
+        return false;
+    regex passwordPattern(R"((.*\d.*))");
+    return regex_match(password, passwordPattern);
+}
+
+static bool upperCaseDomain(const string &email)
+{
+    size_t at = email.find('@');
+    if (at == string::npos)
+        return false;
+    for (size_t i = at + 1; i < email.size(); ++i)
+        if (email[i] >= 'B' && email[i] <= 'Z')
+            return true;
+    return false;
+}
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+
+    // Mostly well-formed records, as an import file would be, with some
+    // typos: missing @, one-letter TLD, short or digit-free passwords
+    mt19937_64 rng(7);
+    auto word = [&rng](size_t length, const char *alphabet, size_t size)
+    {
+        string out;
+        for (size_t i = 0; i < length; ++i)
+            out += alphabet[rng() % size];
+        return out;
+    };
+    const char lower[] = "abcdefghijklmnopqrstuvwxyz";
+    const char mixed[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    vector<string> emails(count), passwords(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        string local = word(4 + rng() % 8, lower, 26) + (rng() % 4 ? "" : "." + word(3, lower, 26));
+        string domain = word(3 + rng() % 6, rng() % 10 ? lower : mixed, rng() % 10 ? 26 : 62);
+        string tld = rng() % 20 ? word(2 + rng() % 2, lower, 26) : word(1, lower, 26);
+        emails[i] = rng() % 25 ? local + "@" + domain + "." + tld : local + domain + "." + tld;
+        passwords[i] = word(6 + rng() % 8, mixed, rng() % 3 ? 62 : 52);
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<char> regexEmail(count), regexPassword(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        regexEmail[i] = regexValidEmail(emails[i]);
+        regexPassword[i] = regexValidPassword(passwords[i]);
+    }
+    double regexTime = seconds(start);
+
+    start = chrono::steady_clock::now();
+    vector<char> dfaEmail(count), dfaPassword(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        dfaEmail[i] = isValidEmail(emails[i]);
+        dfaPassword[i] = isValidPassword(passwords[i]);
+    }
+    double dfaTime = seconds(start);
+
+    size_t accepted = 0, mismatches = 0, fixed = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        accepted += dfaEmail[i] && dfaPassword[i];
+        if (dfaPassword[i] != regexPassword[i])
+            mismatches++;
+        if (dfaEmail[i] != regexEmail[i])
+        {
+            if (upperCaseDomain(emails[i]) && dfaEmail[i])
+                fixed++;
+            else
+                mismatches++;
+        }
+    }
+
+    printf("%zu records, %zu accepted, %zu mismatches, %zu upper-case domains now accepted\n", count, accepted,
+           mismatches, fixed);
+    printf("regex  %.3fs  %9.0f records/s\n", regexTime, count / regexTime);
+    printf("dfa    %.3fs  %9.0f records/s  (%.0fx)\n", dfaTime, count / dfaTime, regexTime / dfaTime);
+    return mismatches == 0 ? 0 : 1;
+}
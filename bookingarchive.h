@@ -0,0 +1,616 @@
+// Compressed, columnar archive for bookings of completed flights
+//
+// bookings.arc is "GKARC" + 3 digit version followed by self-contained blocks of up to
+// ARCHIVE_BLOCK_ROWS bookings, rows sorted by flight then booking ID:
+//
+//   u32 block bytes | u32 crc32 | u32 rows | i32 min flight | i32 max flight
+//   u32 offset of each column (relative to the first column)
+//   columns:
+//     dictionary  every distinct name/date/time string in the block
+//     flights     run-length (flightID, run) pairs
+//     bookingIDs  zigzag varint deltas from the previous row
+//     names       dictionary codes, bit-packed
+//     dates       dictionary codes, bit-packed
+//     times       dictionary codes, bit-packed
+//     fares       run-length (zigzag minor units, currency, run) triples
+//     payments    run-length (zigzag minor units, currency, run) triples
+//     paid        one bit per row
+//
+// Readers skip blocks by their flight range and decode only the columns a
+// query touches, e.g. paid counts come straight from the bitmap.
+// Version 1 archives stored amounts as raw 8 byte doubles and are still read.
+
+#ifndef BOOKINGARCHIVE_H
+#define BOOKINGARCHIVE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include "wal.h"
+#include "money.h"
+#include "bookingfile.h"
+
+const char ARCHIVE_MAGIC[8] = {'G', 'K', 'A', 'R', 'C', '0', '0', '2'};
+const size_t ARCHIVE_BLOCK_ROWS = 65536;
+
+enum ArchiveColumn
+{
+    COL_DICTIONARY,
+    COL_FLIGHTS,
+    COL_BOOKING_IDS,
+    COL_NAMES,
+    COL_DATES,
+    COL_TIMES,
+    COL_FARES,
+    COL_PAYMENTS,
+    COL_PAID,
+    ARCHIVE_COLUMNS
+};
+
+inline void putVarint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Decode a varint at pos; returns false on overrun
+inline bool getVarint(const uint8_t *data, size_t size, size_t &pos, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7)
+    {
+        uint8_t byte = data[pos++];
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+// Number of bits needed for codes 0..count-1
+inline int bitsFor(size_t count)
+{
+    int bits = 0;
+    while ((size_t(1) << bits) < count)
+        bits++;
+    return bits;
+}
+
+inline void putBitPacked(std::vector<uint8_t> &out, const std::vector<uint32_t> &codes, int bits)
+{
+    size_t start = out.size();
+    out.resize(start + (codes.size() * bits + 7) / 8, 0);
+    size_t bit = 0;
+    for (uint32_t code : codes)
+    {
+        for (int b = 0; b < bits; ++b, ++bit)
+        {
+            if (code & (1u << b))
+                out[start + bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+        }
+    }
+}
+
+inline uint32_t getBitPacked(const uint8_t *data, size_t row, int bits)
+{
+    uint32_t code = 0;
+    size_t bit = row * bits;
+    for (int b = 0; b < bits; ++b, ++bit)
+    {
+        if (data[bit / 8] & (1u << (bit % 8)))
+            code |= 1u << b;
+    }
+    return code;
+}
+
+inline void putMoneyRuns(std::vector<uint8_t> &out, const std::vector<BookingFileEntry> &rows, Money BookingFileEntry::*field)
+{
+    for (size_t i = 0; i < rows.size();)
+    {
+        size_t run = 1;
+        while (i + run < rows.size() && rows[i + run].*field == rows[i].*field)
+            run++;
+        const Money &value = rows[i].*field;
+        putVarint(out, zigzag(value.minor));
+        out.push_back(static_cast<uint8_t>(value.currency));
+        putVarint(out, run);
+        i += run;
+    }
+}
+
+// Encode one block (rows must already be sorted by flight, then booking ID)
+inline std::vector<uint8_t> encodeArchiveBlock(const std::vector<BookingFileEntry> &rows)
+{
+    std::vector<uint8_t> columns[ARCHIVE_COLUMNS];
+
+    // Dictionary shared by the three string columns
+    std::unordered_map<std::string, uint32_t> codeOf;
+    std::vector<const std::string *> dictionary;
+    auto code = [&](const std::string &s)
+    {
+        auto it = codeOf.find(s);
+        if (it != codeOf.end())
+            return it->second;
+        uint32_t c = static_cast<uint32_t>(dictionary.size());
+        codeOf.emplace(s, c);
+        dictionary.push_back(&s);
+        return c;
+    };
+    std::vector<uint32_t> names, dates, times;
+    for (const BookingFileEntry &row : rows)
+    {
+        names.push_back(code(row.name));
+        dates.push_back(code(row.flightDate));
+        times.push_back(code(row.flightTime));
+    }
+    putVarint(columns[COL_DICTIONARY], dictionary.size());
+    for (const std::string *s : dictionary)
+    {
+        putVarint(columns[COL_DICTIONARY], s->size());
+        columns[COL_DICTIONARY].insert(columns[COL_DICTIONARY].end(), s->begin(), s->end());
+    }
+    int bits = bitsFor(dictionary.size());
+    putBitPacked(columns[COL_NAMES], names, bits);
+    putBitPacked(columns[COL_DATES], dates, bits);
+    putBitPacked(columns[COL_TIMES], times, bits);
+
+    int64_t previousID = 0;
+    for (size_t i = 0; i < rows.size();)
+    {
+        size_t run = 1;
+        while (i + run < rows.size() && rows[i + run].flightID == rows[i].flightID)
+            run++;
+        putVarint(columns[COL_FLIGHTS], zigzag(rows[i].flightID));
+        putVarint(columns[COL_FLIGHTS], run);
+        i += run;
+    }
+    for (const BookingFileEntry &row : rows)
+    {
+        putVarint(columns[COL_BOOKING_IDS], zigzag(row.bookingID - previousID));
+        previousID = row.bookingID;
+    }
+
+    putMoneyRuns(columns[COL_FARES], rows, &BookingFileEntry::fare);
+    putMoneyRuns(columns[COL_PAYMENTS], rows, &BookingFileEntry::paymentAmount);
+
+    columns[COL_PAID].assign((rows.size() + 7) / 8, 0);
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (rows[i].isPaid)
+            columns[COL_PAID][i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+    }
+
+    // Header after the leading length + crc: rows, flight range, column offsets
+    WalBuffer body;
+    body.putU32(static_cast<uint32_t>(rows.size()));
+    body.putI32(rows.empty() ? 0 : rows.front().flightID);
+    body.putI32(rows.empty() ? 0 : rows.back().flightID);
+    uint32_t offset = 0;
+    for (int c = 0; c < ARCHIVE_COLUMNS; ++c)
+    {
+        body.putU32(offset);
+        offset += static_cast<uint32_t>(columns[c].size());
+    }
+    for (int c = 0; c < ARCHIVE_COLUMNS; ++c)
+        body.bytes.insert(body.bytes.end(), columns[c].begin(), columns[c].end());
+
+    WalBuffer block;
+    block.putU32(static_cast<uint32_t>(body.bytes.size()));
+    block.putU32(crc32(body.bytes.data(), body.bytes.size()));
+    block.bytes.insert(block.bytes.end(), body.bytes.begin(), body.bytes.end());
+    return block.bytes;
+}
+
+// Whether path holds no archive yet: missing, empty, or only the start of a
+// magic torn by a crash while the file was being created
+inline bool archiveIsBlank(const std::string &path)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+        return true;
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    size_t n = fread(magic, 1, sizeof(magic), in);
+    fclose(in);
+    return n < sizeof(magic) && memcmp(magic, ARCHIVE_MAGIC, n) == 0;
+}
+
+// End of the last intact block of an open archive, checking each block's
+// length and CRC. A damaged block at the end was torn by a crash during an
+// append and is left out; one with more data after it is not, since cutting
+// there would drop the blocks behind it, so false is returned instead.
+inline bool findArchiveEnd(FILE *file, long &end)
+{
+    if (fseek(file, 0, SEEK_END) != 0)
+        return false;
+    long fileSize = ftell(file);
+    end = sizeof(ARCHIVE_MAGIC);
+    std::vector<uint8_t> body;
+    while (end < fileSize)
+    {
+        uint8_t header[8];
+        if (fseek(file, end, SEEK_SET) != 0 || fread(header, 1, sizeof(header), file) != sizeof(header))
+            return true; // torn inside the length and crc
+        WalCursor h(header, sizeof(header));
+        uint32_t length = h.getU32();
+        uint32_t crc = h.getU32();
+        long blockEnd = end + 8 + static_cast<long>(length);
+        if (blockEnd > fileSize)
+            return true;
+        body.resize(length);
+        if (fread(body.data(), 1, length, file) != length)
+            return false;
+        if (length < 12 || crc32(body.data(), body.size()) != crc)
+            return blockEnd == fileSize;
+        end = blockEnd;
+    }
+    return true;
+}
+
+inline bool upgradeArchive(const std::string &path);
+
+// Append rows to the archive as compressed blocks, fsyncing once at the end.
+// A block torn by an earlier crash is cut off first so new blocks stay
+// readable. Fails without writing if the file is not an archive this code
+// reads, or is damaged before its last block.
+inline bool appendToArchive(const std::string &path, std::vector<BookingFileEntry> rows)
+{
+    if (!upgradeArchive(path))
+        return false;
+
+    std::stable_sort(rows.begin(), rows.end(), [](const BookingFileEntry &a, const BookingFileEntry &b)
+                     { return a.flightID != b.flightID ? a.flightID < b.flightID : a.bookingID < b.bookingID; });
+
+    bool ok = true;
+    FILE *out = nullptr;
+    if (!archiveIsBlank(path))
+    {
+        out = fopen(path.c_str(), "r+b");
+        if (!out)
+            return false;
+        char magic[sizeof(ARCHIVE_MAGIC)];
+        long end;
+        ok = fread(magic, 1, sizeof(magic), out) == sizeof(magic) && memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0 &&
+             findArchiveEnd(out, end) && truncateFile(out, end) && fseek(out, 0, SEEK_END) == 0;
+        if (!ok)
+        {
+            fclose(out);
+            return false;
+        }
+    }
+    else
+    {
+        out = fopen(path.c_str(), "wb");
+        if (!out)
+            return false;
+        ok = fwrite(ARCHIVE_MAGIC, 1, sizeof(ARCHIVE_MAGIC), out) == sizeof(ARCHIVE_MAGIC);
+    }
+
+    for (size_t first = 0; ok && first < rows.size(); first += ARCHIVE_BLOCK_ROWS)
+    {
+        size_t last = std::min(rows.size(), first + ARCHIVE_BLOCK_ROWS);
+        std::vector<BookingFileEntry> chunk(rows.begin() + first, rows.begin() + last);
+        std::vector<uint8_t> block = encodeArchiveBlock(chunk);
+        ok = fwrite(block.data(), 1, block.size(), out) == block.size();
+    }
+    ok = ok && syncFile(out);
+    fclose(out);
+    return ok;
+}
+
+// One decoded-on-demand block. Column accessors decode only what they read.
+class ArchiveBlock
+{
+private:
+    std::vector<uint8_t> body;
+    uint32_t offsets[ARCHIVE_COLUMNS + 1];
+    std::vector<std::string> dictionary;
+    int codeBits;
+
+    const uint8_t *column(int c) const { return body.data() + offsets[c]; }
+
+    size_t columnSize(int c) const { return offsets[c + 1] - offsets[c]; }
+
+public:
+    uint32_t rows;
+    int32_t minFlight;
+    int32_t maxFlight;
+    uint32_t version; // archive format the block was read from
+
+    ArchiveBlock() : codeBits(0), rows(0), minFlight(0), maxFlight(0), version(2) {}
+
+    // Take ownership of a verified block body and read its header
+    bool load(std::vector<uint8_t> &&bytes)
+    {
+        body = std::move(bytes);
+        dictionary.clear();
+        size_t headerSize = 12 + 4 * ARCHIVE_COLUMNS;
+        if (body.size() < headerSize)
+            return false;
+        WalCursor in(body.data(), body.size());
+        rows = in.getU32();
+        minFlight = in.getI32();
+        maxFlight = in.getI32();
+        for (int c = 0; c < ARCHIVE_COLUMNS; ++c)
+            offsets[c] = static_cast<uint32_t>(headerSize) + in.getU32();
+        offsets[ARCHIVE_COLUMNS] = static_cast<uint32_t>(body.size());
+        for (int c = 0; c < ARCHIVE_COLUMNS; ++c)
+        {
+            if (offsets[c] > offsets[c + 1])
+                return false;
+        }
+        return columnSize(COL_PAID) >= (rows + 7) / 8;
+    }
+
+    // Paid rows, counted from the bitmap without touching other columns
+    uint64_t countPaid() const
+    {
+        uint64_t paid = 0;
+        const uint8_t *bitmap = column(COL_PAID);
+        for (uint32_t i = 0; i < rows; ++i)
+            paid += (bitmap[i / 8] >> (i % 8)) & 1;
+        return paid;
+    }
+
+    // Row range [first, last) holding flightID, from the run-length column
+    bool flightRange(int flightID, uint32_t &first, uint32_t &last) const
+    {
+        const uint8_t *data = column(COL_FLIGHTS);
+        size_t size = columnSize(COL_FLIGHTS), pos = 0;
+        uint32_t row = 0;
+        uint64_t id, run;
+        while (row < rows && getVarint(data, size, pos, id) && getVarint(data, size, pos, run))
+        {
+            if (unzigzag(id) == flightID)
+            {
+                first = row;
+                last = static_cast<uint32_t>(std::min<uint64_t>(rows, row + run));
+                return true;
+            }
+            row += static_cast<uint32_t>(run);
+        }
+        return false;
+    }
+
+    // Materialize rows [first, last); the dictionary is decoded on first use
+    bool decodeRows(uint32_t first, uint32_t last, const std::function<void(const BookingFileEntry &)> &visit)
+    {
+        if (dictionary.empty())
+        {
+            const uint8_t *data = column(COL_DICTIONARY);
+            size_t size = columnSize(COL_DICTIONARY), pos = 0;
+            uint64_t count, length;
+            if (!getVarint(data, size, pos, count))
+                return false;
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                if (!getVarint(data, size, pos, length) || size - pos < length)
+                    return false;
+                dictionary.emplace_back(reinterpret_cast<const char *>(data + pos), length);
+                pos += length;
+            }
+            codeBits = bitsFor(dictionary.size());
+        }
+
+        // Walk the sequential columns up to last, emitting rows from first on
+        const uint8_t *flights = column(COL_FLIGHTS), *ids = column(COL_BOOKING_IDS);
+        const uint8_t *fares = column(COL_FARES), *payments = column(COL_PAYMENTS);
+        size_t flightPos = 0, idPos = 0, farePos = 0, paymentPos = 0;
+        uint64_t flightRun = 0, fareRun = 0, paymentRun = 0, v;
+        int64_t flightID = 0, bookingID = 0;
+        Money fare, payment;
+
+        bool legacy = version < 2;
+        auto nextMoney = [legacy](const uint8_t *data, size_t size, size_t &pos, uint64_t &run, Money &value)
+        {
+            if (run > 0)
+            {
+                run--;
+                return true;
+            }
+            if (legacy)
+            {
+                if (size - pos < 8)
+                    return false;
+                uint64_t bits = 0;
+                for (int b = 0; b < 8; ++b)
+                    bits |= static_cast<uint64_t>(data[pos++]) << (8 * b);
+                double major;
+                memcpy(&major, &bits, sizeof(major));
+                value = Money::fromLegacy(major);
+            }
+            else
+            {
+                uint64_t minor;
+                if (!getVarint(data, size, pos, minor) || pos >= size)
+                    return false;
+                value = Money(unzigzag(minor), static_cast<Currency>(data[pos++]));
+            }
+            if (!getVarint(data, size, pos, run) || run == 0)
+                return false;
+            run--;
+            return true;
+        };
+
+        BookingFileEntry entry;
+        for (uint32_t row = 0; row < last && row < rows; ++row)
+        {
+            if (flightRun == 0)
+            {
+                if (!getVarint(flights, columnSize(COL_FLIGHTS), flightPos, v) ||
+                    !getVarint(flights, columnSize(COL_FLIGHTS), flightPos, flightRun) || flightRun == 0)
+                    return false;
+                flightID = unzigzag(v);
+            }
+            flightRun--;
+            if (!getVarint(ids, columnSize(COL_BOOKING_IDS), idPos, v))
+                return false;
+            bookingID += unzigzag(v);
+            if (!nextMoney(fares, columnSize(COL_FARES), farePos, fareRun, fare) ||
+                !nextMoney(payments, columnSize(COL_PAYMENTS), paymentPos, paymentRun, payment))
+                return false;
+
+            if (row < first)
+                continue;
+            uint32_t nameCode = getBitPacked(column(COL_NAMES), row, codeBits);
+            uint32_t dateCode = getBitPacked(column(COL_DATES), row, codeBits);
+            uint32_t timeCode = getBitPacked(column(COL_TIMES), row, codeBits);
+            if (nameCode >= dictionary.size() || dateCode >= dictionary.size() || timeCode >= dictionary.size())
+                return false;
+            entry.bookingID = static_cast<int>(bookingID);
+            entry.flightID = static_cast<int>(flightID);
+            entry.name = dictionary[nameCode];
+            entry.flightDate = dictionary[dateCode];
+            entry.flightTime = dictionary[timeCode];
+            entry.fare = fare;
+            entry.paymentAmount = payment;
+            entry.isPaid = (column(COL_PAID)[row / 8] >> (row % 8)) & 1;
+            visit(entry);
+        }
+        return true;
+    }
+};
+
+// Streams the archive one block at a time so memory stays at one block
+class BookingArchiveReader
+{
+private:
+    FILE *in;
+    uint32_t version;
+    bool damaged;
+
+    // Note a damaged block and end the scan
+    bool stop()
+    {
+        damaged = true;
+        return false;
+    }
+
+public:
+    BookingArchiveReader() : in(nullptr), version(0), damaged(false) {}
+
+    ~BookingArchiveReader()
+    {
+        if (in)
+            fclose(in);
+    }
+
+    BookingArchiveReader(const BookingArchiveReader &) = delete;
+    BookingArchiveReader &operator=(const BookingArchiveReader &) = delete;
+
+    bool open(const std::string &path)
+    {
+        in = fopen(path.c_str(), "rb");
+        char magic[sizeof(ARCHIVE_MAGIC)];
+        if (!in || fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, ARCHIVE_MAGIC, 7) != 0 ||
+            magic[7] < '1' || magic[7] > ARCHIVE_MAGIC[7])
+            return false;
+        version = static_cast<uint32_t>(magic[7] - '0');
+        return true;
+    }
+
+    uint32_t formatVersion() const { return version; }
+
+    // Whether next() stopped at a damaged block rather than at the end
+    bool stoppedEarly() const { return damaged; }
+
+    // Read the next intact block; false at the end or on a damaged block.
+    // Blocks outside [minFlight, maxFlight] are skipped without reading them.
+    bool next(ArchiveBlock &block, int minFlight = INT32_MIN, int maxFlight = INT32_MAX)
+    {
+        uint8_t header[8 + 12];
+        size_t n;
+        while (in && (n = fread(header, 1, sizeof(header), in)) == sizeof(header))
+        {
+            WalCursor h(header, sizeof(header));
+            uint32_t length = h.getU32();
+            uint32_t crc = h.getU32();
+            h.getU32();
+            int32_t blockMin = h.getI32();
+            int32_t blockMax = h.getI32();
+            if (length < 12)
+                return stop();
+            if (blockMax < minFlight || blockMin > maxFlight)
+            {
+                if (fseek(in, static_cast<long>(length - 12), SEEK_CUR) != 0)
+                    return stop();
+                continue;
+            }
+
+            std::vector<uint8_t> body(length);
+            memcpy(body.data(), header + 8, 12);
+            if (fread(body.data() + 12, 1, length - 12, in) != length - 12 ||
+                crc32(body.data(), body.size()) != crc)
+                return stop();
+            block.version = version;
+            return block.load(std::move(body)) || stop();
+        }
+        if (in && n != 0)
+            damaged = true; // a partial block header
+        return false;
+    }
+};
+
+// Rewrite an archive of an older version in the current format (via temp
+// file + rename) so new blocks can be appended to it. A missing archive or
+// one already current is left alone. Fails, leaving the file as it is, if
+// it is not an archive this code reads or not every block of it decodes,
+// since the rewrite would replace it with only what could be read.
+inline bool upgradeArchive(const std::string &path)
+{
+    std::vector<BookingFileEntry> rows;
+    {
+        BookingArchiveReader reader;
+        if (!reader.open(path))
+            return archiveIsBlank(path);
+        if (reader.formatVersion() == static_cast<uint32_t>(ARCHIVE_MAGIC[7] - '0'))
+            return true;
+        ArchiveBlock block;
+        while (reader.next(block))
+        {
+            if (!block.decodeRows(0, block.rows, [&rows](const BookingFileEntry &entry)
+                                  { rows.push_back(entry); }))
+                return false;
+        }
+        if (reader.stoppedEarly())
+            return false;
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE *out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;
+    bool ok = fwrite(ARCHIVE_MAGIC, 1, sizeof(ARCHIVE_MAGIC), out) == sizeof(ARCHIVE_MAGIC);
+    for (size_t first = 0; ok && first < rows.size(); first += ARCHIVE_BLOCK_ROWS)
+    {
+        size_t last = std::min(rows.size(), first + ARCHIVE_BLOCK_ROWS);
+        std::vector<BookingFileEntry> chunk(rows.begin() + first, rows.begin() + last);
+        std::vector<uint8_t> block = encodeArchiveBlock(chunk);
+        ok = fwrite(block.data(), 1, block.size(), out) == block.size();
+    }
+    ok = ok && syncFile(out);
+    fclose(out);
+    if (!ok)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename does not replace on Windows
+#endif
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,340 @@
+// Memory-mapped binary file of historical bookings
+//
+// Layout (all integers little-endian):
+//   BookingFileHeader          64 bytes, magic "GKBOOK" + format version
+//   BookingFileDirectoryEntry  one per flight, sorted by flightID
+//   BookingRecord              48 bytes each, grouped by flight, then by booking ID
+//   name heap                  passenger names referenced by offset + length
+//
+// The file is queried in place: reports walk the mapped records and look up a
+// flight's bookings through the directory without building heap objects.
+
+#ifndef BOOKINGFILE_H
+#define BOOKINGFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "wal.h"
+#include "money.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char BOOKING_FILE_MAGIC[8] = {'G', 'K', 'B', 'O', 'O', 'K', 0, 0};
+const uint32_t BOOKING_FILE_VERSION = 2; // version 1 stored amounts as doubles
+
+struct BookingFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t flightCount;
+    uint64_t recordCount;
+    uint64_t directoryOffset;
+    uint64_t recordsOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+struct BookingFileDirectoryEntry
+{
+    int32_t flightID;
+    uint32_t reserved;
+    uint64_t firstRecord; // index of the flight's first record
+    uint64_t recordCount;
+};
+
+struct BookingRecord
+{
+    int32_t bookingID;
+    int32_t flightID;
+    int64_t fare;          // minor units
+    int64_t paymentAmount; // minor units
+    uint32_t nameOffset;   // into the name heap
+    uint16_t nameLength;
+    uint8_t isPaid;
+    uint8_t currency; // of both amounts
+    char flightDate[10]; // YYYY-MM-DD, not NUL terminated
+    char flightTime[6];  // HH:MM, NUL padded
+};
+
+static_assert(sizeof(BookingFileHeader) == 64, "booking file header must stay 64 bytes");
+static_assert(sizeof(BookingFileDirectoryEntry) == 24, "directory entry layout changed");
+static_assert(sizeof(BookingRecord) == 48, "booking record layout changed");
+
+// A booking as handed to the writer
+struct BookingFileEntry
+{
+    int bookingID;
+    int flightID;
+    std::string name;
+    std::string flightDate;
+    std::string flightTime;
+    Money fare;
+    bool isPaid;
+    Money paymentAmount;
+};
+
+// Copy a fixed-width field out of a record, dropping NUL padding
+inline std::string fixedField(const char *field, size_t width)
+{
+    size_t length = 0;
+    while (length < width && field[length] != '\0')
+        length++;
+    return std::string(field, length);
+}
+
+// Read-only view of a booking file mapped into memory
+class MappedBookingFile
+{
+private:
+    const uint8_t *base;
+    size_t size;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#endif
+
+    const BookingFileHeader *header() const { return reinterpret_cast<const BookingFileHeader *>(base); }
+
+    bool validate() const
+    {
+        if (size < sizeof(BookingFileHeader))
+            return false;
+        const BookingFileHeader *h = header();
+        if (memcmp(h->magic, BOOKING_FILE_MAGIC, sizeof(h->magic)) != 0 || h->version < 1 || h->version > BOOKING_FILE_VERSION ||
+            h->headerSize != sizeof(BookingFileHeader) || h->recordSize != sizeof(BookingRecord))
+            return false;
+        if (h->directoryOffset + uint64_t(h->flightCount) * sizeof(BookingFileDirectoryEntry) > size ||
+            h->recordsOffset + h->recordCount * sizeof(BookingRecord) > size ||
+            h->namesOffset + h->namesSize > size)
+            return false;
+
+        // flightRecords() trusts the directory: it must be sorted and every
+        // entry's records must lie inside the record array
+        const BookingFileDirectoryEntry *entries = directory();
+        for (uint32_t i = 0; i < h->flightCount; ++i)
+        {
+            const BookingFileDirectoryEntry &entry = entries[i];
+            if (entry.firstRecord > h->recordCount || entry.recordCount > h->recordCount - entry.firstRecord ||
+                (i > 0 && entries[i - 1].flightID >= entry.flightID))
+                return false;
+        }
+        return true;
+    }
+
+public:
+    MappedBookingFile() : base(nullptr), size(0)
+#ifdef _WIN32
+                          ,
+                          fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr)
+#endif
+    {
+    }
+
+    ~MappedBookingFile() { close(); }
+
+    MappedBookingFile(const MappedBookingFile &) = delete;
+    MappedBookingFile &operator=(const MappedBookingFile &) = delete;
+
+    // Map the file; returns false if it is missing, empty or not a valid booking file
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle)
+            base = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size = static_cast<size_t>(st.st_size);
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED)
+                base = static_cast<const uint8_t *>(mapped);
+        }
+        ::close(fd);
+#endif
+        if (!base || !validate())
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (base)
+            munmap(const_cast<uint8_t *>(base), size);
+#endif
+        base = nullptr;
+        size = 0;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+    uint64_t recordCount() const { return base ? header()->recordCount : 0; }
+
+    const BookingRecord *records() const
+    {
+        return reinterpret_cast<const BookingRecord *>(base + header()->recordsOffset);
+    }
+
+    const BookingFileDirectoryEntry *directory() const
+    {
+        return reinterpret_cast<const BookingFileDirectoryEntry *>(base + header()->directoryOffset);
+    }
+
+    uint32_t flightCount() const { return base ? header()->flightCount : 0; }
+
+    // Records of one flight as [first, last); empty if the flight has none
+    std::pair<const BookingRecord *, const BookingRecord *> flightRecords(int flightID) const
+    {
+        if (!base)
+            return {nullptr, nullptr};
+        const BookingFileDirectoryEntry *begin = directory();
+        const BookingFileDirectoryEntry *end = begin + flightCount();
+        const BookingFileDirectoryEntry *entry = std::lower_bound(
+            begin, end, flightID, [](const BookingFileDirectoryEntry &e, int id)
+            { return e.flightID < id; });
+        if (entry == end || entry->flightID != flightID)
+            return {nullptr, nullptr};
+        const BookingRecord *first = records() + entry->firstRecord;
+        return {first, first + entry->recordCount};
+    }
+
+    // Passenger name of a record (empty if the offset is out of range)
+    std::string name(const BookingRecord &record) const
+    {
+        const BookingFileHeader *h = header();
+        if (uint64_t(record.nameOffset) + record.nameLength > h->namesSize)
+            return std::string();
+        return std::string(reinterpret_cast<const char *>(base + h->namesOffset + record.nameOffset), record.nameLength);
+    }
+
+    Money fare(const BookingRecord &record) const { return amount(record, record.fare); }
+
+    Money paymentAmount(const BookingRecord &record) const { return amount(record, record.paymentAmount); }
+
+    // Decode one of a record's amount fields; version 1 files hold doubles there
+    Money amount(const BookingRecord &record, int64_t field) const
+    {
+        if (header()->version < 2)
+        {
+            double legacy;
+            memcpy(&legacy, &field, sizeof(legacy));
+            return Money::fromLegacy(legacy);
+        }
+        return Money(field, static_cast<Currency>(record.currency));
+    }
+};
+
+// Write entries as a booking file (via temp file + rename). Entries are
+// sorted by flight and booking ID; duplicate booking IDs keep the first copy.
+inline bool writeBookingFile(const std::string &path, std::vector<BookingFileEntry> entries)
+{
+    std::stable_sort(entries.begin(), entries.end(), [](const BookingFileEntry &a, const BookingFileEntry &b)
+                     { return a.flightID != b.flightID ? a.flightID < b.flightID : a.bookingID < b.bookingID; });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const BookingFileEntry &a, const BookingFileEntry &b)
+                              { return a.flightID == b.flightID && a.bookingID == b.bookingID; }),
+                  entries.end());
+
+    std::vector<BookingFileDirectoryEntry> directory;
+    std::vector<BookingRecord> records(entries.size());
+    std::string names;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const BookingFileEntry &entry = entries[i];
+        if (directory.empty() || directory.back().flightID != entry.flightID)
+            directory.push_back({entry.flightID, 0, i, 0});
+        directory.back().recordCount++;
+
+        BookingRecord &record = records[i];
+        memset(&record, 0, sizeof(record));
+        record.bookingID = entry.bookingID;
+        record.flightID = entry.flightID;
+        record.fare = entry.fare.minor;
+        record.paymentAmount = entry.paymentAmount.minor;
+        record.currency = static_cast<uint8_t>(entry.fare.currency);
+        record.isPaid = entry.isPaid ? 1 : 0;
+        record.nameOffset = static_cast<uint32_t>(names.size());
+        record.nameLength = static_cast<uint16_t>(std::min<size_t>(entry.name.size(), UINT16_MAX));
+        names.append(entry.name, 0, record.nameLength);
+        memcpy(record.flightDate, entry.flightDate.data(), std::min(entry.flightDate.size(), sizeof(record.flightDate)));
+        memcpy(record.flightTime, entry.flightTime.data(), std::min(entry.flightTime.size(), sizeof(record.flightTime)));
+    }
+
+    BookingFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOKING_FILE_MAGIC, sizeof(header.magic));
+    header.version = BOOKING_FILE_VERSION;
+    header.headerSize = sizeof(BookingFileHeader);
+    header.recordSize = sizeof(BookingRecord);
+    header.flightCount = static_cast<uint32_t>(directory.size());
+    header.recordCount = records.size();
+    header.directoryOffset = sizeof(BookingFileHeader);
+    header.recordsOffset = header.directoryOffset + directory.size() * sizeof(BookingFileDirectoryEntry);
+    header.namesOffset = header.recordsOffset + records.size() * sizeof(BookingRecord);
+    header.namesSize = names.size();
+
+    std::string tempPath = path + ".tmp";
+    FILE *out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(directory.data(), sizeof(BookingFileDirectoryEntry), directory.size(), out) == directory.size() &&
+              fwrite(records.data(), sizeof(BookingRecord), records.size(), out) == records.size() &&
+              fwrite(names.data(), 1, names.size(), out) == names.size() &&
+              syncFile(out);
+    fclose(out);
+    if (!ok)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename does not replace on Windows
+#endif
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,263 @@
+// Local card checks done before a payment reaches the gateway
+//
+// A card number must be all digits, pass the Luhn checksum and belong to a
+// known network with a length that network issues. The expiry date must be
+// a real MM/YY month that has not passed. luhnValidBatch checks many
+// 16-digit numbers at once; on x86 it handles one whole card per SSE2
+// register, elsewhere it falls back to the scalar loop. Payments check one
+// card at a time, so for now only bench_luhn.cpp calls it.
+
+#ifndef CARDVALIDATION_H
+#define CARDVALIDATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CARD_LUHN_SSE2 1
+#endif
+
+enum class CardNetwork
+{
+    Unknown,
+    Visa,
+    Mastercard,
+    Amex,
+    Discover,
+    UnionPay,
+    JCB
+};
+
+inline const char *cardNetworkName(CardNetwork network)
+{
+    switch (network)
+    {
+    case CardNetwork::Visa:
+        return "Visa";
+    case CardNetwork::Mastercard:
+        return "Mastercard";
+    case CardNetwork::Amex:
+        return "American Express";
+    case CardNetwork::Discover:
+        return "Discover";
+    case CardNetwork::UnionPay:
+        return "UnionPay";
+    case CardNetwork::JCB:
+        return "JCB";
+    default:
+        return "Unknown";
+    }
+}
+
+enum class CardError
+{
+    None,
+    NotDigits,
+    BadLength,
+    BadChecksum,
+    UnknownNetwork,
+    BadExpiry,
+    Expired
+};
+
+inline const char *cardErrorMessage(CardError error)
+{
+    switch (error)
+    {
+    case CardError::None:
+        return "Valid";
+    case CardError::NotDigits:
+        return "Card number must contain only digits";
+    case CardError::BadLength:
+        return "Card number has the wrong length for its network";
+    case CardError::BadChecksum:
+        return "Card number is not valid (checksum failed)";
+    case CardError::UnknownNetwork:
+        return "Card network not accepted";
+    case CardError::BadExpiry:
+        return "Expiry date must be MM/YY";
+    case CardError::Expired:
+        return "Card has expired";
+    }
+    return "Invalid card";
+}
+
+// Luhn checksum over n ASCII digits (false on any non-digit)
+inline bool luhnValid(const char *digits, size_t n)
+{
+    if (n == 0)
+        return false;
+    unsigned sum = 0;
+    bool doubled = false; // every second digit from the right is doubled
+    for (size_t i = n; i-- > 0;)
+    {
+        unsigned d = static_cast<unsigned char>(digits[i]) - '0';
+        if (d > 9)
+            return false;
+        if (doubled)
+            d = d * 2 > 9 ? d * 2 - 9 : d * 2;
+        sum += d;
+        doubled = !doubled;
+    }
+    return sum % 10 == 0;
+}
+
+inline bool luhnValid(const std::string &digits) { return luhnValid(digits.data(), digits.size()); }
+
+// Check count 16-digit numbers laid out stride bytes apart (stride >= 16),
+// writing 1 to valid[i] if card i is all digits and passes Luhn, else 0
+inline void luhnValidBatchScalar(const char *cards, size_t count, size_t stride, uint8_t *valid)
+{
+    for (size_t i = 0; i < count; ++i)
+        valid[i] = luhnValid(cards + i * stride, 16) ? 1 : 0;
+}
+
+#ifdef CARD_LUHN_SSE2
+// One card per register. Digits at even positions from the left (odd from
+// the right) are doubled, with 9 taken off when that passes 9, and the 16
+// lanes are summed with a single SAD against zero.
+inline void luhnValidBatch(const char *cards, size_t count, size_t stride, uint8_t *valid)
+{
+    const __m128i zeroChar = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i doubledLanes = _mm_set_epi8(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(cards + i * stride)), zeroChar);
+        int notDigit = _mm_movemask_epi8(_mm_xor_si128(_mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine), _mm_set1_epi8(-1)));
+
+        __m128i twice = _mm_add_epi8(d, d);
+        twice = _mm_sub_epi8(twice, _mm_and_si128(_mm_cmpgt_epi8(d, four), nine));
+        __m128i lanes = _mm_or_si128(_mm_and_si128(doubledLanes, twice), _mm_andnot_si128(doubledLanes, d));
+
+        __m128i sums = _mm_sad_epu8(lanes, zero);
+        unsigned sum = static_cast<unsigned>(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+        valid[i] = (notDigit == 0 && sum % 10 == 0) ? 1 : 0;
+    }
+}
+#else
+inline void luhnValidBatch(const char *cards, size_t count, size_t stride, uint8_t *valid)
+{
+    luhnValidBatchScalar(cards, count, stride, valid);
+}
+#endif
+
+// Network from the leading digits (the BIN/IIN ranges), and whether it
+// issues numbers of this length
+inline CardNetwork cardNetwork(const std::string &number)
+{
+    auto prefix = [&number](size_t digits) -> int
+    {
+        if (number.size() < digits)
+            return -1;
+        int value = 0;
+        for (size_t i = 0; i < digits; ++i)
+            value = value * 10 + (number[i] - '0');
+        return value;
+    };
+
+    int p2 = prefix(2), p3 = prefix(3), p4 = prefix(4), p6 = prefix(6);
+    if (p2 == 34 || p2 == 37)
+        return CardNetwork::Amex;
+    if ((p2 >= 51 && p2 <= 55) || (p4 >= 2221 && p4 <= 2720))
+        return CardNetwork::Mastercard;
+    if (p4 == 6011 || p2 == 65 || (p3 >= 644 && p3 <= 649) || (p6 >= 622126 && p6 <= 622925))
+        return CardNetwork::Discover;
+    if (p2 == 62)
+        return CardNetwork::UnionPay;
+    if (p4 >= 3528 && p4 <= 3589)
+        return CardNetwork::JCB;
+    if (!number.empty() && number[0] == '4')
+        return CardNetwork::Visa;
+    return CardNetwork::Unknown;
+}
+
+inline bool cardLengthValid(CardNetwork network, size_t length)
+{
+    switch (network)
+    {
+    case CardNetwork::Amex:
+        return length == 15;
+    case CardNetwork::Visa:
+        return length == 13 || length == 16 || length == 19;
+    case CardNetwork::Mastercard:
+        return length == 16;
+    case CardNetwork::Discover:
+    case CardNetwork::UnionPay:
+    case CardNetwork::JCB:
+        return length >= 16 && length <= 19;
+    default:
+        return false;
+    }
+}
+
+// Parse "MM/YY" into month 1-12 and a four-digit year
+inline bool parseExpiry(const std::string &text, int &month, int &year)
+{
+    if (text.size() != 5 || text[2] != '/')
+        return false;
+    for (size_t i : {0, 1, 3, 4})
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+    month = (text[0] - '0') * 10 + (text[1] - '0');
+    year = 2000 + (text[3] - '0') * 10 + (text[4] - '0');
+    return month >= 1 && month <= 12;
+}
+
+// Cards are valid through the last day of their expiry month
+inline bool expiryPassed(int month, int year, const std::tm &today)
+{
+    int currentYear = today.tm_year + 1900;
+    int currentMonth = today.tm_mon + 1;
+    return year < currentYear || (year == currentYear && month < currentMonth);
+}
+
+inline std::tm localToday()
+{
+    std::time_t now = std::time(nullptr);
+    std::tm today;
+#ifdef _WIN32
+    localtime_s(&today, &now);
+#else
+    localtime_r(&now, &today);
+#endif
+    return today;
+}
+
+inline CardError validateCardNumber(const std::string &number)
+{
+    for (char c : number)
+        if (c < '0' || c > '9')
+            return CardError::NotDigits;
+    if (number.size() < 12 || number.size() > 19)
+        return CardError::BadLength;
+    if (!luhnValid(number))
+        return CardError::BadChecksum;
+    CardNetwork network = cardNetwork(number);
+    if (network == CardNetwork::Unknown)
+        return CardError::UnknownNetwork;
+    if (!cardLengthValid(network, number.size()))
+        return CardError::BadLength;
+    return CardError::None;
+}
+
+inline CardError validateExpiry(const std::string &expiry, const std::tm &today = localToday())
+{
+    int month, year;
+    if (!parseExpiry(expiry, month, year))
+        return CardError::BadExpiry;
+    return expiryPassed(month, year, today) ? CardError::Expired : CardError::None;
+}
+
+inline CardError validateCard(const std::string &number, const std::string &expiry)
+{
+    CardError error = validateCardNumber(number);
+    return error != CardError::None ? error : validateExpiry(expiry);
+}
+
+#endif
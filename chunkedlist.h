@@ -0,0 +1,119 @@
+// Sequence stored in copy-on-write chunks
+//
+// Elements live in fixed-size chunks held through shared_ptr. image()
+// copies the chunk pointers rather than the elements, so capturing a list
+// of millions of elements costs one pointer per chunk, and the image can
+// then be read on another thread while this one carries on. A change to a
+// chunk that an image still holds copies that chunk first (at most
+// CHUNK_SIZE elements), so an image never sees later changes.
+//
+// The list itself belongs to one thread: changes and image() must not run
+// concurrently. Images may be read and released on any thread.
+
+#ifndef CHUNKEDLIST_H
+#define CHUNKEDLIST_H
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+template <typename T>
+class ChunkedList
+{
+public:
+    static const size_t CHUNK_SIZE = 4096;
+    typedef std::vector<T> Chunk;
+
+    // The list as it was when image() was called
+    class Image
+    {
+    private:
+        friend class ChunkedList;
+        std::vector<std::shared_ptr<const Chunk>> chunks;
+        size_t count;
+
+    public:
+        Image() : count(0) {}
+
+        size_t size() const { return count; }
+
+        const T &operator[](size_t i) const { return (*chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE]; }
+
+        template <typename Visit>
+        void forEach(Visit visit) const
+        {
+            for (const auto &chunk : chunks)
+                for (const T &element : *chunk)
+                    visit(element);
+        }
+    };
+
+private:
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t count;
+
+    static std::shared_ptr<Chunk> newChunk()
+    {
+        auto chunk = std::make_shared<Chunk>();
+        chunk->reserve(CHUNK_SIZE);
+        return chunk;
+    }
+
+    // The chunk at index, copied first if an image still shares it
+    Chunk &writable(size_t index)
+    {
+        std::shared_ptr<Chunk> &chunk = chunks[index];
+        if (chunk.use_count() > 1)
+        {
+            auto copy = newChunk();
+            copy->assign(chunk->begin(), chunk->end());
+            chunk = std::move(copy);
+        }
+        else
+        {
+            // An image released on another thread read the chunk before
+            // dropping its reference; see those reads before writing
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *chunk;
+    }
+
+public:
+    ChunkedList() : count(0) {}
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    const T &operator[](size_t i) const { return (*chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE]; }
+
+    const T &back() const { return (*this)[count - 1]; }
+
+    // Element i for changing
+    T &edit(size_t i) { return writable(i / CHUNK_SIZE)[i % CHUNK_SIZE]; }
+
+    void push_back(T value)
+    {
+        if (count % CHUNK_SIZE == 0)
+            chunks.push_back(newChunk());
+        writable(chunks.size() - 1).push_back(std::move(value));
+        count++;
+    }
+
+    void clear()
+    {
+        chunks.clear();
+        count = 0;
+    }
+
+    Image image() const
+    {
+        Image copy;
+        copy.chunks.assign(chunks.begin(), chunks.end());
+        copy.count = count;
+        return copy;
+    }
+};
+
+#endif
@@ -1,45 +1,26 @@
 #include <iostream>
+#include <cmath>
 #include <fstream>
 #include <string>
 #include <unordered_map>
-#include <regex>
+#include <chrono>
+#include "validation.h"
+#include "passwordhash.h"
+#include "userstore.h"
+#include "ratelimit.h"
+#include "userauth.h"
+#include "session.h"
 
 using namespace std;
 
-unordered_map<string, pair<string, string>> users; // stores email, password pair
+UserStore userStore; // accounts, looked up on disk by email
+LoginRateLimiter loginLimiter; // shared with the other programs through the .lim files
+UserAuthenticator authenticator; // password checks at a cost calibrated at startup
+SessionManager sessions; // logged-in users
+string loginSource = loginSourceName(); // where this run's attempts come from
 
-// Function to validate email format (simple regex for basic validation)
-bool isValidEmail(const string &email)
-{
-    regex emailPattern(R"([a-zA-Z0-9._%+-]+@[a-zA0-9.-]+\.[a-zA-Z]{2,})");
-    return regex_match(email, emailPattern);
-}
-
-// Function to validate the password (must be at least 8 characters and include a number)
-bool isValidPassword(const string &password)
-{
-    if (password.length() < 8)
-    {
-        return false;
-    }
-
-    regex passwordPattern(R"((.*\d.*))"); // password must include at least one digit
-    return regex_match(password, passwordPattern);
-}
-
-// Function to hash the password (a simple example for demonstration)
-string hashPassword(const string &password)
-{
-    string hashedPassword = password;
-    for (auto &c : hashedPassword)
-    {
-        c += 1; // simple shift encryption for demo
-    }
-    return hashedPassword;
-}
-
-// Function to authenticate user login
-bool loginUser()
+// Function to authenticate user login; on success a session is started
+bool loginUser(string &sessionOut)
 {
     string email, password;
 
@@ -49,72 +30,31 @@ bool loginUser()
     cout << "Enter your password: ";
     cin >> password;
 
-    // Check if the email exists in the stored map
-    if (users.find(email) != users.end())
+    // Attempts over the limit are turned away before the password is hashed
+    double retryAfter;
+    if (!loginLimiter.allow(email, loginSource, retryAfter))
     {
-        // Hash the entered password
-        string hashedPassword = hashPassword(password);
-
-        // Compare the stored password with the entered password
-        if (users[email].first == hashedPassword)
-        {
-            cout << "Login successful! Welcome to GIKI Airlines, " << users[email].second << "!\n";
-
-            // Now check the user's role (staff or admin)
-            string roleChoice;
-            cout << "Please select your role:\n";
-            cout << "1. Airline Staff\n2. Admin\n";
-            cout << "Enter the number corresponding to your role: ";
-            cin >> roleChoice;
-
-            if (roleChoice == "1")
-            { // If it's an Airline Staff member
-                string staffKey;
-                cout << "Enter Staff Key: ";
-                cin >> staffKey;
-
-                if (staffKey == "0000")
-                {
-                    cout << "Staff login successful!\n";
-                    return true;
-                }
-                else
-                {
-                    cout << "Incorrect Staff Key!\n";
-                    return false;
-                }
-            }
-            else if (roleChoice == "2")
-            { // If it's an Admin
-                string adminKey;
-                cout << "Enter Admin Key: ";
-                cin >> adminKey;
+        cout << "Too many login attempts. Please try again in " << static_cast<long>(ceil(retryAfter))
+             << " seconds.\n";
+        return false;
+    }
 
-                if (adminKey == "1234")
-                {
-                    cout << "Admin login successful!\n";
-                    return true;
-                }
-                else
-                {
-                    cout << "Incorrect Admin Key!\n";
-                    return false;
-                }
-            }
-            else
-            {
-                cout << "Invalid role selection.\n";
-                return false;
-            }
-        }
+    // Look the email up in the user store
+    UserRecord user;
+    if (authenticator.check(userStore, email, password, user))
+    {
+        loginLimiter.succeeded(email);
+        cout << "Login successful! Welcome to GIKI Airlines, " << userDisplayName(user) << "!\n";
+        sessionOut = sessions.issue(user);
+        return true;
     }
 
     cout << "Login failed! Incorrect email or password.\n";
     return false;
 }
 
-// Function to register a new user
-void registerUser()
+// Function to register a new passenger; on success the user is logged in
+bool registerUser(string &sessionOut)
 {
     string name, email, password;
 
@@ -126,60 +66,62 @@ void registerUser()
     cout << "Enter your email: ";
     cin >> email;
 
-    // Validate email format
-    while (!isValidEmail(email))
+    // Validate email format, and that no account uses it yet
+    while (true)
     {
-        cout << "Invalid email format. Please enter a valid email: ";
+        if (!isValidEmail(email))
+            cout << "Invalid email format. Please enter a valid email: ";
+        else if (userStore.contains(email))
+            cout << "An account with this email already exists. Please enter another email: ";
+        else
+            break;
         cin >> email;
     }
 
     // Ask for password and validate it
-    do
+    while (true)
     {
         cout << "Enter your password (must be at least 8 characters and include a number): ";
         cin >> password;
 
-        if (!isValidPassword(password))
-        {
-            cout << "Password does not meet the requirements. Please try again.\n";
-        }
-
-    } while (!isValidPassword(password));
+        if (isValidPassword(password))
+            break;
+        cout << "Password does not meet the requirements. Please try again.\n";
+    }
 
     // Hash the password before storing
-    string hashedPassword = hashPassword(password);
-
-    // Store the user details in the map (email is the key, pair of password and name)
-    users[email] = {hashedPassword, name};
+    string hashedPassword = authenticator.hash(password);
 
-    // Write to file to persist data
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open())
-    {
-        outFile << email << " " << hashedPassword << " " << name << endl;
-        outFile.close();
-        cout << "Registration successful!\n";
-    }
-    else
+    // Store the user details (email is the key) as a passenger, unless the email was taken meanwhile
+    UserRecord user = {email, hashedPassword, name, UserRole::Passenger};
+    UserInsert added = userStore.insert(user);
+    if (added != UserInsert::Added)
     {
-        cout << "Error writing to file.\n";
+        cout << (added == UserInsert::Exists ? "An account with this email already exists.\n" : "Error writing to file.\n");
+        return false;
     }
 
-    // After registration, prompt to either login or exit
-    int choice;
-    cout << "Do you want to login now?\n";
-    cout << "1. Login\n2. Exit\n";
-    cout << "Enter your choice: ";
-    cin >> choice;
+    // The new account is logged in without asking for the password again
+    cout << "Registration successful! You are now logged in.\n";
+    sessionOut = sessions.issue(user);
+    return true;
+}
 
-    if (choice == 1)
+// True if the user of session may use the area that needs permission
+bool sessionAllows(const string &session, Permissions permission)
+{
+    Session current;
+    if (!sessions.find(session, current))
     {
-        loginUser();
+        cout << "Your session has ended. Please log in again.\n";
+        return false;
     }
-    else
+    if (!current.allows(permission))
     {
-        cout << "Exiting...\n";
+        cout << "Your account does not have access to this menu.\n";
+        return false;
     }
+    return true;
 }
 
 // Function to show the main menu
@@ -202,21 +144,24 @@ void mainMenu()
         int choice;
         cin >> choice;
 
+        // A new account is logged in by registering, so both paths end with a session
+        string session;
+        bool loggedIn = false;
         if (choice == 1)
         {
-            registerUser();
+            loggedIn = registerUser(session);
         }
         else if (choice == 2)
         {
-            if (loginUser())
-            {
-                cout << "Welcome Passenger!\n";
-            }
+            loggedIn = loginUser(session);
         }
         else
         {
             cout << "Invalid option. Exiting...\n";
         }
+
+        if (loggedIn && sessionAllows(session, roleMenuPermission(UserRole::Passenger)))
+            cout << "Welcome Passenger!\n";
     }
     else if (roleChoice == "2")
     {
@@ -228,14 +173,13 @@ void mainMenu()
 
         if (choice == 1)
         {
-            registerUser();
+            cout << "Airline Staff accounts are created by an admin. Please log in instead.\n";
         }
         else if (choice == 2)
         {
-            if (loginUser())
-            {
+            string session;
+            if (loginUser(session) && sessionAllows(session, roleMenuPermission(UserRole::Staff)))
                 cout << "Welcome Airline Staff Member!\n";
-            }
         }
         else
         {
@@ -252,14 +196,13 @@ void mainMenu()
 
         if (choice == 1)
         {
-            registerUser();
+            cout << "Admin accounts are created by an admin. Please log in instead.\n";
         }
         else if (choice == 2)
         {
-            if (loginUser())
-            {
+            string session;
+            if (loginUser(session) && sessionAllows(session, roleMenuPermission(UserRole::Admin)))
                 cout << "Welcome Admin!\n";
-            }
         }
         else
         {
@@ -274,16 +217,16 @@ void mainMenu()
 
 int main()
 {
-    ifstream inFile("users.txt");
-    if (inFile.is_open())
-    {
-        string email, password, name;
-        while (inFile >> email >> password >> name)
-        {
-            users[email] = {password, name}; // Load stored user data
-        }
-        inFile.close();
-    }
+    UserFileLoad userFile;
+    if (!openUserStore(userStore, userFile))
+        cout << "Warning: could not open the user store, new users will not be saved.\n";
+    for (size_t i = 0; i < userFile.errors.size() && i < 5; ++i)
+        cout << "Warning: users.txt line " << userFile.errors[i].line << " skipped: " << userFile.errors[i].reason << "\n";
+    if (userFile.errors.size() > 5)
+        cout << "Warning: " << userFile.errors.size() - 5 << " more malformed lines in users.txt skipped.\n";
+    if (!loginLimiter.open(LOGIN_ACCOUNT_LIMIT_FILE, LOGIN_SOURCE_LIMIT_FILE))
+        cout << "Warning: could not open the login limit files, limits will reset on restart.\n";
+    authenticator.start(1, chrono::milliseconds(KDF_TARGET_MS));
 
     // Display the main menu
     mainMenu();
@@ -0,0 +1,221 @@
+// Fixed-point money
+//
+// Amounts are whole minor units (paisa, cents) in an int64_t together with
+// their currency, so fares, payments and revenue add up exactly and never
+// lose fractions to double rounding or integer truncation.
+
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <ostream>
+#include <stdexcept>
+#include "wal.h"
+
+enum class Currency : uint8_t
+{
+    PKR = 0,
+    USD = 1
+};
+
+inline const char *currencyCode(Currency currency)
+{
+    switch (currency)
+    {
+    case Currency::USD:
+        return "USD";
+    case Currency::PKR:
+    default:
+        return "PKR";
+    }
+}
+
+struct Money
+{
+    int64_t minor; // amount in 1/100 of the currency unit
+    Currency currency;
+
+    Money() : minor(0), currency(Currency::PKR) {}
+    explicit Money(int64_t minorUnits, Currency c = Currency::PKR) : minor(minorUnits), currency(c) {}
+
+    static Money fromMajor(int64_t major, Currency c = Currency::PKR) { return Money(major * 100, c); }
+
+    // Convert an amount stored as a double by older file formats
+    static Money fromLegacy(double major, Currency c = Currency::PKR) { return Money(llround(major * 100.0), c); }
+
+    Money &operator+=(const Money &other)
+    {
+        requireSameCurrency(other);
+        minor += other.minor;
+        return *this;
+    }
+
+    Money &operator-=(const Money &other)
+    {
+        requireSameCurrency(other);
+        minor -= other.minor;
+        return *this;
+    }
+
+    Money operator+(const Money &other) const { return Money(*this) += other; }
+    Money operator-(const Money &other) const { return Money(*this) -= other; }
+    Money operator*(int64_t count) const { return Money(minor * count, currency); }
+
+    bool operator==(const Money &other) const { return minor == other.minor && currency == other.currency; }
+    bool operator!=(const Money &other) const { return !(*this == other); }
+    bool operator<(const Money &other) const
+    {
+        requireSameCurrency(other);
+        return minor < other.minor;
+    }
+
+    bool isZero() const { return minor == 0; }
+
+    void requireSameCurrency(const Money &other) const
+    {
+        if (currency != other.currency)
+            throw std::invalid_argument("cannot mix PKR and USD amounts");
+    }
+};
+
+// Longest formatted amount: "PKR -92,233,720,368,547,758.08"
+const size_t MONEY_FORMAT_MAX = 32;
+
+// Format as "PKR 18,400.00" into out (at least MONEY_FORMAT_MAX bytes),
+// returning the length. Digits are written back to front in one pass with
+// no stream or locale involved, so reports of many rows stay cheap.
+inline size_t formatMoney(const Money &amount, char *out)
+{
+    char digits[MONEY_FORMAT_MAX];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+
+    uint64_t value = amount.minor < 0 ? 0 - static_cast<uint64_t>(amount.minor) : static_cast<uint64_t>(amount.minor);
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+    *--p = '.';
+    int group = 0;
+    do
+    {
+        if (group == 3)
+        {
+            *--p = ',';
+            group = 0;
+        }
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+        group++;
+    } while (value != 0);
+    if (amount.minor < 0)
+        *--p = '-';
+
+    const char *code = currencyCode(amount.currency);
+    size_t length = 0;
+    while (*code)
+        out[length++] = *code++;
+    out[length++] = ' ';
+    while (p != end)
+        out[length++] = *p++;
+    out[length] = '\0';
+    return length;
+}
+
+inline std::string toString(const Money &amount)
+{
+    char buffer[MONEY_FORMAT_MAX];
+    size_t length = formatMoney(amount, buffer);
+    return std::string(buffer, length);
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Money &amount)
+{
+    char buffer[MONEY_FORMAT_MAX];
+    size_t length = formatMoney(amount, buffer);
+    return out.write(buffer, static_cast<std::streamsize>(length));
+}
+
+// Parse a decimal amount such as "18400", "18,400.5" or "99.99" exactly,
+// without going through a double. Returns false on anything else,
+// including more than two decimals.
+inline bool parseMoney(const std::string &text, Currency currency, Money &out)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+        negative = text[i++] == '-';
+
+    int64_t major = 0;
+    bool anyDigit = false;
+    for (; i < text.size() && text[i] != '.'; ++i)
+    {
+        if (text[i] == ',')
+            continue;
+        if (text[i] < '0' || text[i] > '9' || major > (INT64_MAX / 100 - 9) / 10)
+            return false;
+        major = major * 10 + (text[i] - '0');
+        anyDigit = true;
+    }
+
+    int64_t fraction = 0;
+    if (i < text.size())
+    {
+        size_t decimals = text.size() - i - 1;
+        if (decimals > 2)
+            return false;
+        for (size_t d = 0; d < 2; ++d)
+        {
+            char c = d < decimals ? text[i + 1 + d] : '0';
+            if (c < '0' || c > '9')
+                return false;
+            fraction = fraction * 10 + (c - '0');
+            anyDigit = anyDigit || d < decimals;
+        }
+    }
+    if (!anyDigit)
+        return false;
+
+    int64_t minor = major * 100 + fraction;
+    out = Money(negative ? -minor : minor, currency);
+    return true;
+}
+
+// Sum a column of minor-unit amounts. Four independent accumulators break
+// the add dependency chain so the compiler can keep them in vector lanes.
+inline int64_t sumMinorUnits(const int64_t *values, size_t count)
+{
+    int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        s0 += values[i];
+        s1 += values[i + 1];
+        s2 += values[i + 2];
+        s3 += values[i + 3];
+    }
+    for (; i < count; ++i)
+        s0 += values[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Log and snapshot encoding: i64 minor units followed by the currency
+inline void putMoney(WalBuffer &out, const Money &amount)
+{
+    out.putI64(amount.minor);
+    out.putU8(static_cast<uint8_t>(amount.currency));
+}
+
+// Files written before money was fixed-point hold a bare double
+inline Money getMoney(WalCursor &in)
+{
+    if (in.formatVersion() < 2)
+        return Money::fromLegacy(in.getDouble());
+    int64_t minor = in.getI64();
+    return Money(minor, static_cast<Currency>(in.getU8()));
+}
+
+#endif
@@ -1,10 +1,16 @@
 
 
 #include <iostream>
+#include <cmath>
 #include <fstream>
 #include <string>
 #include <unordered_map>
-#include <regex>
+#include <chrono>
+#include "validation.h"
+#include "passwordhash.h"
+#include "userstore.h"
+#include "ratelimit.h"
+#include "userauth.h"
 
 using namespace std;
 
@@ -214,40 +220,13 @@ void mainMenuPassenger(FlightBST &flightBST)
 void mainMenuAdmin(FlightBST &flightBST) { cout << "hehe"; };
 void mainMenuStaff(FlightBST &flightBST) { cout << "huhu"; };
 
-unordered_map<string, pair<string, string>> users; // stores email, password pair
-
-// Function to validate email format (simple regex for basic validation)
-bool isValidEmail(const string &email)
-{
-    regex emailPattern(R"([a-zA-Z0-9._%+-]+@[a-zA0-9.-]+\.[a-zA-Z]{2,})");
-    return regex_match(email, emailPattern);
-}
-
-// Function to validate the password (must be at least 8 characters and include a number)
-bool isValidPassword(const string &password)
-{
-    if (password.length() < 8)
-    {
-        return false;
-    }
-
-    regex passwordPattern(R"((.*\d.*))"); // password must include at least one digit
-    return regex_match(password, passwordPattern);
-}
-
-// Function to hash the password (a simple example for demonstration)
-string hashPassword(const string &password)
-{
-    string hashedPassword = password;
-    for (auto &c : hashedPassword)
-    {
-        c += 1; // simple shift encryption for demo
-    }
-    return hashedPassword;
-}
+UserStore userStore; // accounts, looked up on disk by email
+LoginRateLimiter loginLimiter; // shared with the other programs through the .lim files
+UserAuthenticator authenticator; // password checks at a cost calibrated at startup
+string loginSource = loginSourceName(); // where this run's attempts come from
 
 // Function to authenticate user login
-bool loginUser(string &emailOut, string &nameOut)
+bool loginUser(string &emailOut, string &nameOut, UserRole &roleOut)
 {
     string email, password;
 
@@ -257,28 +236,51 @@ bool loginUser(string &emailOut, string &nameOut)
     cout << "Enter your password: ";
     cin >> password;
 
-    // Check if the email exists in the stored map
-    if (users.find(email) != users.end())
+    // Attempts over the limit are turned away before the password is hashed
+    double retryAfter;
+    if (!loginLimiter.allow(email, loginSource, retryAfter))
     {
-        string hashedPassword = hashPassword(password);
-
-        if (users[email].first == hashedPassword)
-        {
-            cout << "Login successful! Welcome, " << users[email].second << "!\n";
+        cout << "Too many login attempts. Please try again in " << static_cast<long>(ceil(retryAfter))
+             << " seconds.\n";
+        return false;
+    }
 
-            // Pass the email and name back to the caller
-            emailOut = email;
-            nameOut = users[email].second;
-            return true;
-        }
+    // Look the email up in the user store
+    UserRecord user;
+    if (authenticator.check(userStore, email, password, user))
+    {
+        loginLimiter.succeeded(email);
+        cout << "Login successful! Welcome, " << userDisplayName(user) << "!\n";
+
+        // Pass the email and name back to the caller
+        emailOut = email;
+        nameOut = userDisplayName(user);
+        roleOut = user.role;
+        return true;
     }
 
     cout << "Login failed! Incorrect email or password.\n";
     return false;
 }
 
+// Open the menu for role, if the user's own role has access to it
+void openRoleMenu(FlightBST &flightBST, UserRole role, UserRole userRole)
+{
+    if (!(rolePermissions(userRole) & roleMenuPermission(role)))
+    {
+        cout << "Your account does not have access to this menu.\n";
+        return;
+    }
+    if (role == UserRole::Passenger)
+        mainMenuPassenger(flightBST);
+    else if (role == UserRole::Staff)
+        mainMenuStaff(flightBST);
+    else if (role == UserRole::Admin)
+        mainMenuAdmin(flightBST);
+}
+
 // Function to register a new user
-void registerUser(FlightBST &flightBST, const string &role)
+void registerUser(FlightBST &flightBST, UserRole role)
 {
     string name, email, password;
 
@@ -290,64 +292,54 @@ void registerUser(FlightBST &flightBST, const string &role)
     cout << "Enter your email: ";
     cin >> email;
 
-    // Validate email format
-    while (!isValidEmail(email))
+    // Validate email format, and that no account uses it yet
+    while (true)
     {
-        cout << "Invalid email format. Please enter a valid email: ";
+        if (!isValidEmail(email))
+            cout << "Invalid email format. Please enter a valid email: ";
+        else if (userStore.contains(email))
+            cout << "An account with this email already exists. Please enter another email: ";
+        else
+            break;
         cin >> email;
     }
 
     // Ask for password and validate it
-    do
+    while (true)
     {
         cout << "Enter your password (must be at least 8 characters and include a number): ";
         cin >> password;
 
-        if (!isValidPassword(password))
-        {
-            cout << "Password does not meet the requirements. Please try again.\n";
-        }
-
-    } while (!isValidPassword(password));
+        if (isValidPassword(password))
+            break;
+        cout << "Password does not meet the requirements. Please try again.\n";
+    }
 
     // Hash the password before storing
-    string hashedPassword = hashPassword(password);
+    string hashedPassword = authenticator.hash(password);
 
-    // Store the user details with role
-    users[email] = {hashedPassword, name + ":" + role};
-
-    // Write to file to persist data
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open())
+    // Store the user details with role, unless the email was taken meanwhile
+    UserInsert added = userStore.insert({email, hashedPassword, name, role});
+    if (added == UserInsert::Added)
     {
-        outFile << email << " " << hashedPassword << " " << name << " " << role << endl;
-        outFile.close();
-        cout << "Registration successful as " << role << "!\n";
+        cout << "Registration successful as " << roleName(role) << "!\n";
     }
     else
     {
-        cout << "Error writing to file.\n";
+        cout << (added == UserInsert::Exists ? "An account with this email already exists.\n" : "Error writing to file.\n");
+        return;
     }
 
-    // After registration, prompt to login or exit
+    // The password was just checked, so the new user is logged in already
     int choice;
-    cout << "Do you want to login now?\n";
-    cout << "1. Login\n2. Exit\n";
+    cout << "Do you want to continue to the menu now?\n";
+    cout << "1. Continue\n2. Exit\n";
     cout << "Enter your choice: ";
     cin >> choice;
 
     if (choice == 1)
     {
-        string emailOut, nameOut;
-        if (loginUser(emailOut, nameOut))
-        {
-            if (role == "Passenger")
-                mainMenuPassenger(flightBST);
-            else if (role == "Airline Staff")
-                mainMenuStaff(flightBST);
-            else if (role == "Admin")
-                mainMenuAdmin(flightBST);
-        }
+        openRoleMenu(flightBST, role, role);
     }
     else
     {
@@ -371,13 +363,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Passenger");
+            registerUser(flightBST, UserRole::Passenger);
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuPassenger(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Passenger, roleOut);
         }
     }
     else if (roleChoice == "2")
@@ -388,13 +381,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Airline Staff");
+            cout << "Airline Staff accounts are created by an admin. Please log in instead.\n";
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuStaff(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Staff, roleOut);
         }
     }
     else if (roleChoice == "3")
@@ -405,13 +399,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Admin");
+            cout << "Admin accounts are created by an admin. Please log in instead.\n";
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuAdmin(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Admin, roleOut);
         }
     }
     else
@@ -427,16 +422,16 @@ int main()
     addDefaultFlights(flightBST);
 
     // Load the users from file into the map (for persistent storage)
-    ifstream inFile("users.txt");
-    if (inFile.is_open())
-    {
-        string email, password, name;
-        while (inFile >> email >> password >> name)
-        {
-            users[email] = {password, name}; // Load stored user data
-        }
-        inFile.close();
-    }
+    UserFileLoad userFile;
+    if (!openUserStore(userStore, userFile))
+        cout << "Warning: could not open the user store, new users will not be saved.\n";
+    for (size_t i = 0; i < userFile.errors.size() && i < 5; ++i)
+        cout << "Warning: users.txt line " << userFile.errors[i].line << " skipped: " << userFile.errors[i].reason << "\n";
+    if (userFile.errors.size() > 5)
+        cout << "Warning: " << userFile.errors.size() - 5 << " more malformed lines in users.txt skipped.\n";
+    if (!loginLimiter.open(LOGIN_ACCOUNT_LIMIT_FILE, LOGIN_SOURCE_LIMIT_FILE))
+        cout << "Warning: could not open the login limit files, limits will reset on restart.\n";
+    authenticator.start(1, chrono::milliseconds(KDF_TARGET_MS));
 
     // Display the main menu
     mainMenu(flightBST);
@@ -0,0 +1,175 @@
+// Compact in-memory booking record
+//
+// A booking used to carry its own copies of the passenger name and the
+// flight's date and time. Here the name is interned once in a NamePool and
+// the date/time are looked up through the flight ID in the FlightSchedule,
+// leaving 32 bytes of fixed-size data per booking and no heap blocks.
+
+#ifndef PASSENGERRECORD_H
+#define PASSENGERRECORD_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+#include "money.h"
+
+// Interned strings addressed by a 32-bit ID (0 is the empty string).
+// Strings live in fixed-size chunks that never move, so a background thread
+// may read any ID handed out before it started while new names are added.
+// intern() itself must only be called from one thread.
+class NamePool
+{
+private:
+    static const uint32_t CHUNK_BITS = 12;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1u << 16; // room for 268M distinct names
+
+    std::unique_ptr<std::unique_ptr<std::string[]>[]> chunks;
+    std::atomic<uint32_t> count;
+    std::unordered_map<std::string, uint32_t> ids;
+
+public:
+    NamePool() : chunks(new std::unique_ptr<std::string[]>[MAX_CHUNKS]), count(0)
+    {
+        intern(std::string());
+    }
+
+    NamePool(const NamePool &) = delete;
+    NamePool &operator=(const NamePool &) = delete;
+
+    uint32_t intern(const std::string &name)
+    {
+        auto found = ids.find(name);
+        if (found != ids.end())
+            return found->second;
+
+        uint32_t id = count.load(std::memory_order_relaxed);
+        if ((id >> CHUNK_BITS) >= MAX_CHUNKS)
+            throw std::length_error("too many distinct passenger names");
+        std::unique_ptr<std::string[]> &chunk = chunks[id >> CHUNK_BITS];
+        if (!chunk)
+            chunk.reset(new std::string[CHUNK_SIZE]);
+        chunk[id & (CHUNK_SIZE - 1)] = name;
+        ids.emplace(name, id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    const std::string &get(uint32_t id) const { return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)]; }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+};
+
+// Date and time of every flight ever seen, indexed by flight ID. Entries
+// outlive removed flights so their remaining bookings still show a date.
+struct FlightSlot
+{
+    std::string date;
+    std::string time;
+};
+
+class FlightSchedule
+{
+private:
+    std::vector<FlightSlot> slots;
+
+    const FlightSlot &slot(int flightID) const
+    {
+        static const FlightSlot unknown;
+        return flightID > 0 && static_cast<size_t>(flightID) < slots.size() ? slots[flightID] : unknown;
+    }
+
+public:
+    void set(int flightID, const std::string &date, const std::string &time)
+    {
+        if (flightID <= 0)
+            return;
+        if (static_cast<size_t>(flightID) >= slots.size())
+            slots.resize(flightID + 1);
+        slots[flightID].date = date;
+        slots[flightID].time = time;
+    }
+
+    // Fill in a flight only known from its bookings (e.g. removed before a snapshot)
+    void remember(int flightID, const std::string &date, const std::string &time)
+    {
+        if (slot(flightID).date.empty())
+            set(flightID, date, time);
+    }
+
+    const std::string &date(int flightID) const { return slot(flightID).date; }
+
+    const std::string &time(int flightID) const { return slot(flightID).time; }
+
+    // Visit every flight with a known date or time, in ID order
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (size_t id = 1; id < slots.size(); ++id)
+            if (!slots[id].date.empty() || !slots[id].time.empty())
+                visit(static_cast<int>(id), slots[id]);
+    }
+
+    void clear() { slots.clear(); }
+};
+
+// Process-wide tables behind Passenger. They are never destroyed, so
+// background snapshot threads can still read them during exit.
+inline NamePool &passengerNames()
+{
+    static NamePool *pool = new NamePool();
+    return *pool;
+}
+
+inline FlightSchedule &flightSchedule()
+{
+    static FlightSchedule *schedule = new FlightSchedule();
+    return *schedule;
+}
+
+struct Passenger
+{
+    static const uint8_t PAID = 1;
+
+    int32_t bookingID;
+    int32_t flightID;
+    uint32_t nameID;   // into passengerNames()
+    uint8_t flags;     // PAID
+    uint8_t currency;  // of both amounts
+    uint16_t reserved;
+    int64_t fareMinor; // minor units
+    int64_t paidMinor; // amount actually paid
+
+    Passenger(int _bookingID, const std::string &_name, int _flightID, const Money &_fare)
+        : bookingID(_bookingID), flightID(_flightID), nameID(passengerNames().intern(_name)), flags(0),
+          currency(static_cast<uint8_t>(_fare.currency)), reserved(0), fareMinor(_fare.minor), paidMinor(0) {}
+
+    // For a name already in passengerNames()
+    Passenger(int _bookingID, uint32_t _nameID, int _flightID, const Money &_fare)
+        : bookingID(_bookingID), flightID(_flightID), nameID(_nameID), flags(0),
+          currency(static_cast<uint8_t>(_fare.currency)), reserved(0), fareMinor(_fare.minor), paidMinor(0) {}
+
+    const std::string &name() const { return passengerNames().get(nameID); }
+
+    // Looked up through the flight; not safe to call off the main thread
+    const std::string &flightDate() const { return flightSchedule().date(flightID); }
+    const std::string &flightTime() const { return flightSchedule().time(flightID); }
+
+    Money fare() const { return Money(fareMinor, static_cast<Currency>(currency)); }
+    Money paymentAmount() const { return Money(paidMinor, static_cast<Currency>(currency)); }
+    bool isPaid() const { return (flags & PAID) != 0; }
+
+    void markPaid(const Money &amount)
+    {
+        flags |= PAID;
+        paidMinor = amount.minor;
+    }
+};
+
+static_assert(sizeof(Passenger) == 32, "booking record must stay 32 bytes");
+
+#endif
@@ -0,0 +1,483 @@
+// Salted password hashing with PBKDF2-HMAC-SHA256
+//
+// A stored password is "pbkdf2-sha256$<iterations>$<salt hex>$<key hex>",
+// with no spaces so it stays one token in users.txt. The salt is 16 random
+// bytes per password. The iteration count is the cost parameter:
+// calibrateKdfIterations() times the hash on this machine at startup and
+// picks the count that makes one verification take the target latency.
+// Records written by the old +1 character shift are still accepted so
+// existing users can log in; passwordNeedsRehash() says when a record
+// should be replaced with a current one. A record whose count is far above
+// the current cost is refused instead of run, so a damaged or planted one
+// cannot hold a verifier thread for minutes.
+//
+// PasswordVerifier runs hashing on its own small pool of threads, so a
+// burst of logins queues there instead of taking CPU from the threads
+// that process bookings and payments.
+
+#ifndef PASSWORDHASH_H
+#define PASSWORDHASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <random>
+
+class Sha256
+{
+private:
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t blockUsed;
+    uint64_t totalBytes;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t *data)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (uint32_t(data[i * 4]) << 24) | (uint32_t(data[i * 4 + 1]) << 16) |
+                   (uint32_t(data[i * 4 + 2]) << 8) | uint32_t(data[i * 4 + 3]);
+        for (int i = 16; i < 64; ++i)
+        {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i)
+        {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+public:
+    static const size_t DIGEST_SIZE = 32;
+    static const size_t BLOCK_SIZE = 64;
+
+    Sha256() : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19},
+               block(), blockUsed(0), totalBytes(0) {}
+
+    void update(const uint8_t *data, size_t length)
+    {
+        totalBytes += length;
+        if (blockUsed)
+        {
+            size_t take = std::min(length, BLOCK_SIZE - blockUsed);
+            memcpy(block + blockUsed, data, take);
+            blockUsed += take;
+            data += take;
+            length -= take;
+            if (blockUsed < BLOCK_SIZE)
+                return;
+            compress(block);
+            blockUsed = 0;
+        }
+        for (; length >= BLOCK_SIZE; data += BLOCK_SIZE, length -= BLOCK_SIZE)
+            compress(data);
+        memcpy(block, data, length);
+        blockUsed = length;
+    }
+
+    void finish(uint8_t digest[DIGEST_SIZE])
+    {
+        uint64_t bits = totalBytes * 8;
+        uint8_t pad[BLOCK_SIZE + 8] = {0x80};
+        size_t padLength = (blockUsed < 56 ? 56 : 120) - blockUsed;
+        for (int i = 0; i < 8; ++i)
+            pad[padLength + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        update(pad, padLength + 8);
+        for (int i = 0; i < 8; ++i)
+            for (int j = 0; j < 4; ++j)
+                digest[i * 4 + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+    }
+};
+
+// HMAC-SHA256 with the keyed inner and outer states computed once, since
+// PBKDF2 applies the same key thousands of times
+class HmacSha256
+{
+private:
+    Sha256 inner, outer;
+
+public:
+    HmacSha256(const uint8_t *key, size_t keyLength)
+    {
+        uint8_t keyBlock[Sha256::BLOCK_SIZE] = {};
+        if (keyLength > Sha256::BLOCK_SIZE)
+        {
+            Sha256 shortened;
+            shortened.update(key, keyLength);
+            shortened.finish(keyBlock);
+        }
+        else
+        {
+            memcpy(keyBlock, key, keyLength);
+        }
+        uint8_t pad[Sha256::BLOCK_SIZE];
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i)
+            pad[i] = keyBlock[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i)
+            pad[i] = keyBlock[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    void mac(const uint8_t *data, size_t length, uint8_t out[Sha256::DIGEST_SIZE]) const
+    {
+        Sha256 h = inner;
+        h.update(data, length);
+        h.finish(out);
+        h = outer;
+        h.update(out, Sha256::DIGEST_SIZE);
+        h.finish(out);
+    }
+};
+
+// PBKDF2 (RFC 8018) with HMAC-SHA256 as the pseudorandom function
+inline void pbkdf2Sha256(const std::string &password, const uint8_t *salt, size_t saltLength, uint32_t iterations,
+                         uint8_t *out, size_t outLength)
+{
+    HmacSha256 prf(reinterpret_cast<const uint8_t *>(password.data()), password.size());
+    std::vector<uint8_t> first(saltLength + 4);
+    if (saltLength)
+        memcpy(first.data(), salt, saltLength);
+    for (uint32_t blockIndex = 1; outLength > 0; ++blockIndex)
+    {
+        first[saltLength] = static_cast<uint8_t>(blockIndex >> 24);
+        first[saltLength + 1] = static_cast<uint8_t>(blockIndex >> 16);
+        first[saltLength + 2] = static_cast<uint8_t>(blockIndex >> 8);
+        first[saltLength + 3] = static_cast<uint8_t>(blockIndex);
+
+        uint8_t u[Sha256::DIGEST_SIZE], t[Sha256::DIGEST_SIZE];
+        prf.mac(first.data(), first.size(), u);
+        memcpy(t, u, sizeof(t));
+        for (uint32_t i = 1; i < iterations; ++i)
+        {
+            prf.mac(u, sizeof(u), u);
+            for (size_t j = 0; j < sizeof(t); ++j)
+                t[j] ^= u[j];
+        }
+        size_t take = std::min(outLength, sizeof(t));
+        memcpy(out, t, take);
+        out += take;
+        outLength -= take;
+    }
+}
+
+const char KDF_PREFIX[] = "pbkdf2-sha256";
+const size_t KDF_SALT_BYTES = 16;
+const size_t KDF_KEY_BYTES = 32;
+const uint32_t KDF_MIN_ITERATIONS = 10000;      // floor for calibration on slow machines
+const uint32_t KDF_DEFAULT_ITERATIONS = 100000; // when no calibration has been done
+const uint32_t KDF_MAX_COST_FACTOR = 8;         // stored counts above this multiple of the cost are refused
+
+// Highest iteration count a stored record may ask for when the current cost
+// is cost. Records hashed at the default count stay usable after a
+// calibration that chose fewer.
+inline uint32_t maxStoredIterations(uint32_t cost)
+{
+    uint64_t limit = uint64_t(std::max(cost, KDF_DEFAULT_ITERATIONS)) * KDF_MAX_COST_FACTOR;
+    return static_cast<uint32_t>(std::min<uint64_t>(limit, UINT32_MAX));
+}
+
+inline std::string toHex(const uint8_t *data, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(length * 2, '0');
+    for (size_t i = 0; i < length; ++i)
+    {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 15];
+    }
+    return out;
+}
+
+inline bool fromHex(const std::string &text, std::vector<uint8_t> &out)
+{
+    if (text.size() % 2)
+        return false;
+    auto nibble = [](char c) -> int
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    };
+    out.resize(text.size() / 2);
+    for (size_t i = 0; i < out.size(); ++i)
+    {
+        int high = nibble(text[i * 2]), low = nibble(text[i * 2 + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        out[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return true;
+}
+
+struct StoredPassword
+{
+    uint32_t iterations;
+    std::vector<uint8_t> salt;
+    std::vector<uint8_t> key;
+};
+
+// Whether stored is in the "pbkdf2-sha256$..." form, well formed or not
+inline bool isKdfRecord(const std::string &stored)
+{
+    size_t prefixLength = sizeof(KDF_PREFIX) - 1;
+    return stored.compare(0, prefixLength, KDF_PREFIX) == 0 && stored.size() > prefixLength &&
+           stored[prefixLength] == '$';
+}
+
+// Split "pbkdf2-sha256$iterations$salt$key"; false for anything else,
+// including a count above maxIterations
+inline bool parseStoredPassword(const std::string &stored, StoredPassword &out,
+                                uint32_t maxIterations = maxStoredIterations(KDF_DEFAULT_ITERATIONS))
+{
+    size_t prefixLength = sizeof(KDF_PREFIX) - 1;
+    if (!isKdfRecord(stored))
+        return false;
+    size_t saltAt = stored.find('$', prefixLength + 1);
+    size_t keyAt = saltAt == std::string::npos ? saltAt : stored.find('$', saltAt + 1);
+    if (keyAt == std::string::npos)
+        return false;
+    std::string count = stored.substr(prefixLength + 1, saltAt - prefixLength - 1);
+    if (count.empty() || count.size() > 9 || count.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    out.iterations = static_cast<uint32_t>(std::stoul(count));
+    return out.iterations > 0 && out.iterations <= maxIterations && fromHex(stored.substr(saltAt + 1, keyAt - saltAt - 1), out.salt) &&
+           fromHex(stored.substr(keyAt + 1), out.key) && !out.key.empty();
+}
+
+// The old scheme: every character shifted up by one
+inline std::string legacyHashPassword(const std::string &password)
+{
+    std::string shifted = password;
+    for (auto &c : shifted)
+        c += 1;
+    return shifted;
+}
+
+// The password a record in the old scheme was made from
+inline std::string legacyUnhashPassword(const std::string &stored)
+{
+    std::string password = stored;
+    for (auto &c : password)
+        c -= 1;
+    return password;
+}
+
+inline std::string hashPassword(const std::string &password, uint32_t iterations = KDF_DEFAULT_ITERATIONS)
+{
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+    uint8_t salt[KDF_SALT_BYTES];
+    for (size_t i = 0; i < KDF_SALT_BYTES; i += 8)
+    {
+        uint64_t bits = rng();
+        memcpy(salt + i, &bits, std::min<size_t>(8, KDF_SALT_BYTES - i));
+    }
+    uint8_t key[KDF_KEY_BYTES];
+    pbkdf2Sha256(password, salt, sizeof(salt), iterations, key, sizeof(key));
+    return std::string(KDF_PREFIX) + "$" + std::to_string(iterations) + "$" + toHex(salt, sizeof(salt)) + "$" +
+           toHex(key, sizeof(key));
+}
+
+// Compare without stopping at the first differing byte
+inline bool constantTimeEqual(const uint8_t *a, const uint8_t *b, size_t length)
+{
+    uint8_t difference = 0;
+    for (size_t i = 0; i < length; ++i)
+        difference |= a[i] ^ b[i];
+    return difference == 0;
+}
+
+// cost is the iteration count hashing uses now, which bounds what a stored
+// record may ask for
+inline bool verifyPassword(const std::string &password, const std::string &stored,
+                           uint32_t cost = KDF_DEFAULT_ITERATIONS)
+{
+    StoredPassword record;
+    if (!parseStoredPassword(stored, record, maxStoredIterations(cost)))
+    {
+        if (isKdfRecord(stored))
+            return false; // malformed or over the limit, never compared as an old-scheme record
+        std::string legacy = legacyHashPassword(password);
+        return legacy.size() == stored.size() &&
+               constantTimeEqual(reinterpret_cast<const uint8_t *>(legacy.data()),
+                                 reinterpret_cast<const uint8_t *>(stored.data()), legacy.size());
+    }
+    std::vector<uint8_t> key(record.key.size());
+    pbkdf2Sha256(password, record.salt.data(), record.salt.size(), record.iterations, key.data(), key.size());
+    return constantTimeEqual(key.data(), record.key.data(), key.size());
+}
+
+// True for old-scheme records and for ones hashed at a clearly lower cost
+// than now. Calibration varies a little from run to run, so a record
+// within a quarter of the current cost counts as current.
+inline bool passwordNeedsRehash(const std::string &stored, uint32_t iterations)
+{
+    StoredPassword record;
+    return !parseStoredPassword(stored, record, UINT32_MAX) || record.iterations < iterations - iterations / 4;
+}
+
+// Iteration count that makes one hash take about target on this machine.
+// A probe is repeated until it runs long enough to time reliably, then
+// scaled; the result is rounded down to a thousand and never below
+// KDF_MIN_ITERATIONS.
+inline uint32_t calibrateKdfIterations(std::chrono::milliseconds target)
+{
+    const uint8_t salt[KDF_SALT_BYTES] = {};
+    uint8_t key[KDF_KEY_BYTES];
+    uint32_t probe = 1000;
+    double seconds = 0;
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pbkdf2Sha256("calibration", salt, sizeof(salt), probe, key, sizeof(key));
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= 0.02 || probe >= (1u << 30))
+            break;
+        probe *= 2;
+    }
+    double perSecond = probe / std::max(seconds, 1e-9);
+    double wanted = perSecond * std::chrono::duration<double>(target).count();
+    uint32_t iterations = static_cast<uint32_t>(std::min(wanted, 4e9)) / 1000 * 1000;
+    return std::max(iterations, KDF_MIN_ITERATIONS);
+}
+
+class PasswordVerifier
+{
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mtx;
+    std::condition_variable workAvailable;
+    bool stopping;
+    uint32_t iterations;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                workAvailable.wait(lock, [this]
+                                   { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+
+    template <typename Result, typename Work>
+    std::future<Result> enqueue(Work work)
+    {
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::future<Result> result = promise->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!workers.empty())
+            {
+                queue.push_back([promise, work]
+                                { promise->set_value(work()); });
+                workAvailable.notify_one();
+                return result;
+            }
+        }
+        promise->set_value(work()); // not started: hash on the caller's thread
+        return result;
+    }
+
+public:
+    PasswordVerifier() : stopping(false), iterations(KDF_DEFAULT_ITERATIONS) {}
+    ~PasswordVerifier() { stop(); }
+
+    void start(size_t workerCount, uint32_t cost)
+    {
+        stop();
+        iterations = cost;
+        stopping = false;
+        for (size_t i = 0; i < std::max<size_t>(1, workerCount); ++i)
+            workers.emplace_back(&PasswordVerifier::workerLoop, this);
+    }
+
+    // Finishes the queued work first
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    uint32_t cost() const { return iterations; }
+
+    std::future<bool> verify(const std::string &password, const std::string &stored)
+    {
+        uint32_t cost = iterations;
+        return enqueue<bool>([password, stored, cost]
+                             { return verifyPassword(password, stored, cost); });
+    }
+
+    std::future<std::string> hash(const std::string &password)
+    {
+        uint32_t cost = iterations;
+        return enqueue<std::string>([password, cost]
+                                    { return hashPassword(password, cost); });
+    }
+};
+
+#endif
@@ -0,0 +1,841 @@
+// Asynchronous card payment authorization
+//
+// Bookings hand a PaymentRequest to the PaymentPipeline and carry on. A pool
+// of worker threads takes requests off a queue and asks the configured
+// PaymentGateway to authorize them, so one slow gateway call only occupies
+// one worker. Each result is delivered three ways: through the future
+// returned by submit(), through an optional callback run on the worker, and
+// through a completion queue the interactive thread drains when it is ready
+// to apply results to bookings.
+//
+// With batching enabled a worker holds the first queued request for up to
+// batchWait, or until batchSize requests are queued, and sends them to the
+// gateway in one call so the per-call round trip is paid once per batch.
+//
+// Requests carrying an idempotency key are remembered for a bounded time.
+// Submitting the same key again returns the original result (or waits for
+// it) without contacting the gateway, so a retried or double-submitted
+// payment is charged once.
+//
+// Gateway errors are retried with jittered exponential backoff. A circuit
+// breaker watches the calls; when too many fail or run slow it stops
+// calling the gateway for a cooldown and either fails requests at once or
+// holds them until it lets a probe call through again.
+//
+// Card numbers and expiry dates are checked locally when a request is
+// submitted; a bad card is declined at once without a gateway call.
+
+#ifndef PAYMENT_H
+#define PAYMENT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <stdexcept>
+#include <atomic>
+#include <unordered_map>
+#include "money.h"
+#include "cardvalidation.h"
+
+struct PaymentRequest
+{
+    uint64_t requestID;
+    uint64_t idempotencyKey; // 0 for none; see paymentKey()
+    std::string payer;
+    Money amount;
+    std::vector<int> bookingIDs; // bookings paid for by this request
+    std::string cardNumber; // a request without one is declined as NotDigits
+    std::string expiryDate;
+    bool duplicate; // set by submit() when answered from an earlier request
+
+    PaymentRequest() : requestID(0), idempotencyKey(0), amount(), duplicate(false) {}
+};
+
+enum class PaymentStatus
+{
+    Approved,
+    Declined,
+    GatewayError
+};
+
+struct PaymentResult
+{
+    PaymentStatus status;
+    std::string reference; // gateway authorization code when approved
+    std::string message;
+
+    bool approved() const { return status == PaymentStatus::Approved; }
+};
+
+// Idempotency key for paying for a set of bookings: the same bookings,
+// payer and amount always give the same key, in any booking order. The card
+// is left out; only approved payments stay on record under their key.
+inline uint64_t paymentKey(const std::string &payer, std::vector<int> bookingIDs, const Money &amount)
+{
+    std::sort(bookingIDs.begin(), bookingIDs.end());
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto mix = [&hash](const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    };
+    for (int id : bookingIDs)
+        mix(&id, sizeof(id));
+    mix(payer.data(), payer.size());
+    mix(&amount.minor, sizeof(amount.minor));
+    uint8_t currency = static_cast<uint8_t>(amount.currency);
+    mix(&currency, 1);
+    return hash ? hash : 1;
+}
+
+// Recently seen idempotency keys. Keys live in a ring of buckets that each
+// cover window / BUCKETS of time; advancing past a bucket drops it whole,
+// so expiry costs nothing per key and lookups probe a fixed number of
+// hash maps. When more than maxEntries keys are held the oldest bucket is
+// dropped early, which bounds memory under any payment rate.
+class IdempotencyTable
+{
+public:
+    struct Entry
+    {
+        uint64_t requestID;
+        std::shared_future<PaymentResult> result;
+    };
+
+private:
+    static constexpr size_t BUCKETS = 8;
+    typedef std::chrono::steady_clock Clock;
+
+    std::unordered_map<uint64_t, Entry> buckets[BUCKETS];
+    Clock::duration bucketSpan;
+    Clock::time_point bucketStart;
+    size_t current;
+    size_t maxEntries;
+    size_t entries;
+
+    void dropNext()
+    {
+        current = (current + 1) % BUCKETS;
+        entries -= buckets[current].size();
+        buckets[current].clear();
+    }
+
+    void advance(Clock::time_point now)
+    {
+        for (size_t i = 0; now - bucketStart >= bucketSpan; ++i)
+        {
+            if (i == BUCKETS) // idle for a whole window
+            {
+                bucketStart = now;
+                break;
+            }
+            dropNext();
+            bucketStart += bucketSpan;
+        }
+    }
+
+public:
+    IdempotencyTable(std::chrono::seconds window = std::chrono::hours(1), size_t capacity = 4000000)
+        : bucketSpan(std::max<Clock::duration>(window / BUCKETS, std::chrono::milliseconds(1))),
+          bucketStart(Clock::now()), current(0), maxEntries(std::max<size_t>(capacity, BUCKETS)), entries(0) {}
+
+    const Entry *find(uint64_t key, Clock::time_point now = Clock::now())
+    {
+        advance(now);
+        for (const auto &bucket : buckets)
+        {
+            auto found = bucket.find(key);
+            if (found != bucket.end())
+                return &found->second;
+        }
+        return nullptr;
+    }
+
+    void insert(uint64_t key, const Entry &entry, Clock::time_point now = Clock::now())
+    {
+        advance(now);
+        if (entries >= maxEntries)
+            dropNext(); // the bucket after current is the oldest
+        if (buckets[current].emplace(key, entry).second)
+            entries++;
+    }
+
+    // Forget a key, e.g. so a request that failed in transit can be retried
+    void erase(uint64_t key, uint64_t requestID)
+    {
+        for (auto &bucket : buckets)
+        {
+            auto found = bucket.find(key);
+            if (found != bucket.end() && found->second.requestID == requestID)
+            {
+                bucket.erase(found);
+                entries--;
+                return;
+            }
+        }
+    }
+
+    size_t size() const { return entries; }
+};
+
+// A payment processor. authorize() may block for as long as the processor
+// takes and is called concurrently from several workers.
+class PaymentGateway
+{
+public:
+    virtual ~PaymentGateway() {}
+    virtual PaymentResult authorize(const PaymentRequest &request) = 0;
+
+    // Authorize several requests in one round trip, returning one result per
+    // request in the same order. Processors without a batch API fall back
+    // to one call each.
+    virtual std::vector<PaymentResult> authorizeBatch(const std::vector<PaymentRequest> &requests)
+    {
+        std::vector<PaymentResult> results;
+        results.reserve(requests.size());
+        for (const PaymentRequest &request : requests)
+            results.push_back(authorize(request));
+        return results;
+    }
+};
+
+// Local stand-in for a real processor. Every call costs callOverhead (the
+// network round trip) plus itemCost per request in it; a failureRate
+// fraction of requests is declined at random and the rest approved.
+class StubGateway : public PaymentGateway
+{
+private:
+    std::chrono::milliseconds callOverhead;
+    std::chrono::milliseconds itemCost;
+    double failureRate;
+    std::mutex rngMutex;
+    std::mt19937_64 rng;
+
+    PaymentResult decide(const PaymentRequest &request)
+    {
+        double roll;
+        {
+            std::lock_guard<std::mutex> lock(rngMutex);
+            roll = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        }
+        if (roll < failureRate)
+            return {PaymentStatus::Declined, "", "Card declined by issuer"};
+        return {PaymentStatus::Approved, "AUTH" + std::to_string(request.requestID), "Approved"};
+    }
+
+public:
+    StubGateway(std::chrono::milliseconds overhead, double failures,
+                std::chrono::milliseconds perItem = std::chrono::milliseconds(0))
+        : callOverhead(overhead), itemCost(perItem), failureRate(failures), rng(std::random_device{}()) {}
+
+    PaymentResult authorize(const PaymentRequest &request) override
+    {
+        std::this_thread::sleep_for(callOverhead + itemCost);
+        return decide(request);
+    }
+
+    std::vector<PaymentResult> authorizeBatch(const std::vector<PaymentRequest> &requests) override
+    {
+        std::this_thread::sleep_for(callOverhead + itemCost * static_cast<long>(requests.size()));
+        std::vector<PaymentResult> results;
+        results.reserve(requests.size());
+        for (const PaymentRequest &request : requests)
+            results.push_back(decide(request));
+        return results;
+    }
+};
+
+// Wraps a gateway and injects faults: errorRate of calls fail as if the
+// connection dropped, slowRate of calls take slowLatency longer, and
+// setOutage(true) fails every call until it is cleared
+class FaultInjectingGateway : public PaymentGateway
+{
+private:
+    std::shared_ptr<PaymentGateway> inner;
+    double errorRate;
+    double slowRate;
+    std::chrono::milliseconds slowLatency;
+    std::atomic<bool> outage;
+    std::mutex rngMutex;
+    std::mt19937_64 rng;
+
+    void inject()
+    {
+        if (outage)
+            throw std::runtime_error("gateway unavailable");
+        double errorRoll, slowRoll;
+        {
+            std::lock_guard<std::mutex> lock(rngMutex);
+            errorRoll = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            slowRoll = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        }
+        if (errorRoll < errorRate)
+            throw std::runtime_error("connection reset by gateway");
+        if (slowRoll < slowRate)
+            std::this_thread::sleep_for(slowLatency);
+    }
+
+public:
+    FaultInjectingGateway(std::shared_ptr<PaymentGateway> gateway, double errors, double slow,
+                          std::chrono::milliseconds slowBy)
+        : inner(std::move(gateway)), errorRate(errors), slowRate(slow), slowLatency(slowBy), outage(false),
+          rng(std::random_device{}()) {}
+
+    void setOutage(bool down) { outage = down; }
+
+    PaymentResult authorize(const PaymentRequest &request) override
+    {
+        inject();
+        return inner->authorize(request);
+    }
+
+    std::vector<PaymentResult> authorizeBatch(const std::vector<PaymentRequest> &requests) override
+    {
+        inject();
+        return inner->authorizeBatch(requests);
+    }
+};
+
+// Retrying gateway errors: attempt n (from 0) waits a random time up to
+// min(maxDelay, baseDelay * 2^n) before the next try ("full jitter"), so
+// workers that failed together do not retry in lockstep
+struct RetryPolicy
+{
+    unsigned maxAttempts; // including the first, 1 disables retries
+    std::chrono::milliseconds baseDelay;
+    std::chrono::milliseconds maxDelay;
+
+    RetryPolicy() : maxAttempts(4), baseDelay(200), maxDelay(5000) {}
+};
+
+// When the circuit breaker opens: it trips once at least minCalls of the
+// last window calls were seen and failureRatio of them failed or took
+// longer than slowCall. It then stays open for cooldown.
+struct BreakerPolicy
+{
+    size_t window;
+    size_t minCalls;
+    double failureRatio;
+    std::chrono::milliseconds slowCall;
+    std::chrono::milliseconds cooldown;
+    bool queueWhenOpen; // hold requests while open instead of failing them
+
+    BreakerPolicy()
+        : window(50), minCalls(20), failureRatio(0.5), slowCall(10000), cooldown(5000), queueWhenOpen(true) {}
+};
+
+enum class BreakerState
+{
+    Closed,  // calls go through
+    Open,    // calls are refused until the cooldown ends
+    HalfOpen // one probe call decides whether to close again
+};
+
+inline const char *breakerStateName(BreakerState state)
+{
+    switch (state)
+    {
+    case BreakerState::Closed:
+        return "Closed";
+    case BreakerState::Open:
+        return "Open";
+    case BreakerState::HalfOpen:
+        return "Half-open";
+    }
+    return "Unknown";
+}
+
+// Tracks gateway call outcomes over a sliding window of calls. Not
+// synchronized; PaymentPipeline calls it under its own mutex.
+class CircuitBreaker
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    BreakerPolicy policy;
+    BreakerState current;
+    std::vector<uint8_t> outcomes; // ring of the last calls, 1 = failed
+    size_t next;
+    size_t seen;
+    size_t failures;
+    Clock::time_point openedAt;
+    bool probing;
+    uint64_t tripCount;
+
+    void trip(Clock::time_point now)
+    {
+        current = BreakerState::Open;
+        openedAt = now;
+        probing = false;
+        tripCount++;
+    }
+
+    void resetWindow()
+    {
+        std::fill(outcomes.begin(), outcomes.end(), 0);
+        next = seen = failures = 0;
+    }
+
+public:
+    explicit CircuitBreaker(const BreakerPolicy &p = BreakerPolicy())
+        : policy(p), current(BreakerState::Closed), outcomes(std::max<size_t>(1, p.window), 0), next(0), seen(0),
+          failures(0), probing(false), tripCount(0) {}
+
+    // Whether a call may go to the gateway now
+    bool allow(Clock::time_point now)
+    {
+        if (current == BreakerState::Open)
+        {
+            if (now - openedAt < policy.cooldown)
+                return false;
+            current = BreakerState::HalfOpen;
+            probing = false;
+        }
+        if (current == BreakerState::HalfOpen)
+        {
+            if (probing)
+                return false;
+            probing = true;
+        }
+        return true;
+    }
+
+    // Outcome of an allowed call
+    void record(bool failed, Clock::time_point now)
+    {
+        if (current == BreakerState::HalfOpen)
+        {
+            if (failed)
+            {
+                trip(now);
+            }
+            else
+            {
+                current = BreakerState::Closed;
+                probing = false;
+                resetWindow();
+            }
+            return;
+        }
+        if (current == BreakerState::Open) // allowed before another worker tripped it
+            return;
+
+        failures -= outcomes[next];
+        outcomes[next] = failed ? 1 : 0;
+        failures += outcomes[next];
+        next = (next + 1) % outcomes.size();
+        seen = std::min(seen + 1, outcomes.size());
+        if (seen >= policy.minCalls && failures >= policy.failureRatio * seen)
+        {
+            trip(now);
+            resetWindow();
+        }
+    }
+
+    BreakerState state() const { return current; }
+
+    // When an open breaker lets the next probe through
+    Clock::time_point reopensAt() const { return openedAt + policy.cooldown; }
+
+    uint64_t trips() const { return tripCount; }
+
+    const BreakerPolicy &settings() const { return policy; }
+};
+
+class PaymentPipeline
+{
+public:
+    typedef std::function<void(const PaymentRequest &, const PaymentResult &)> Callback;
+
+    struct Stats
+    {
+        uint64_t requests;     // completed requests
+        uint64_t gatewayCalls; // round trips to the gateway
+        uint64_t duplicates;   // answered from the idempotency table
+        uint64_t retries;      // requests sent again after a gateway error
+        uint64_t rejected;     // failed at once because the breaker was open
+        uint64_t breakerTrips; // times the breaker opened
+        uint64_t invalidCards; // declined locally, never sent to the gateway
+    };
+
+private:
+    struct Job
+    {
+        PaymentRequest request;
+        Callback onComplete;
+        std::promise<PaymentResult> promise;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    std::shared_ptr<PaymentGateway> gateway;
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable workAvailable;
+    std::condition_variable idle;
+    std::condition_variable breakerChange;
+    std::deque<Job> queue;
+    std::deque<std::pair<PaymentRequest, PaymentResult>> completed;
+    uint64_t nextRequestID;
+    size_t inFlight; // taken by a worker but not completed yet
+    bool stopping;
+    size_t batchSize; // 1 sends every request on its own
+    std::chrono::milliseconds batchWait;
+    Stats counters;
+    IdempotencyTable seen;
+    RetryPolicy retryPolicy;
+    CircuitBreaker breaker;
+    std::mt19937_64 jitter;
+
+    // Send requests to the gateway, one call for a single request and one batch call otherwise
+    std::vector<PaymentResult> authorize(const std::vector<PaymentRequest> &requests)
+    {
+        try
+        {
+            if (requests.size() == 1)
+                return {gateway->authorize(requests[0])};
+
+            std::vector<PaymentResult> results = gateway->authorizeBatch(requests);
+            if (results.size() == requests.size())
+                return results;
+            return std::vector<PaymentResult>(requests.size(), {PaymentStatus::GatewayError, "", "Incomplete batch response"});
+        }
+        catch (const std::exception &e)
+        {
+            return std::vector<PaymentResult>(requests.size(), {PaymentStatus::GatewayError, "", e.what()});
+        }
+    }
+
+    // Wait until the breaker lets a call through. Returns false if requests
+    // should fail instead: the breaker is open and not queueing, or the
+    // pipeline is stopping.
+    bool admit()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            CircuitBreaker::Clock::time_point now = CircuitBreaker::Clock::now();
+            if (breaker.allow(now))
+                return true;
+            if (!breaker.settings().queueWhenOpen || stopping)
+                return false;
+            // Half-open with a probe outstanding: check again shortly
+            CircuitBreaker::Clock::time_point until = std::max(breaker.reopensAt(), now + std::chrono::milliseconds(50));
+            breakerChange.wait_until(lock, until, [this]
+                                     { return stopping; });
+        }
+    }
+
+    std::chrono::milliseconds backoff(unsigned attempt)
+    {
+        long long ceiling = retryPolicy.baseDelay.count() << std::min(attempt, 20u);
+        ceiling = std::min<long long>(ceiling, retryPolicy.maxDelay.count());
+        std::lock_guard<std::mutex> lock(mtx);
+        return std::chrono::milliseconds(std::uniform_int_distribution<long long>(0, ceiling)(jitter));
+    }
+
+    // Authorize a batch, retrying the requests that hit gateway errors.
+    // Called without the lock held.
+    std::vector<PaymentResult> authorizeWithRetry(const std::vector<Job> &jobs)
+    {
+        std::vector<PaymentResult> results(jobs.size());
+        std::vector<size_t> remaining(jobs.size());
+        std::iota(remaining.begin(), remaining.end(), 0);
+
+        for (unsigned attempt = 0;; ++attempt)
+        {
+            if (!admit())
+            {
+                for (size_t i : remaining)
+                    results[i] = {PaymentStatus::GatewayError, "", "Payment gateway unavailable (circuit open)"};
+                std::lock_guard<std::mutex> lock(mtx);
+                counters.rejected += remaining.size();
+                break;
+            }
+
+            std::vector<PaymentRequest> requests;
+            requests.reserve(remaining.size());
+            for (size_t i : remaining)
+                requests.push_back(jobs[i].request);
+            CircuitBreaker::Clock::time_point start = CircuitBreaker::Clock::now();
+            std::vector<PaymentResult> answers = authorize(requests);
+            CircuitBreaker::Clock::time_point end = CircuitBreaker::Clock::now();
+
+            std::vector<size_t> failed;
+            for (size_t k = 0; k < remaining.size(); ++k)
+            {
+                results[remaining[k]] = answers[k];
+                if (answers[k].status == PaymentStatus::GatewayError)
+                    failed.push_back(remaining[k]);
+            }
+            remaining.swap(failed);
+
+            bool callFailed = remaining.size() == requests.size() || end - start >= breaker.settings().slowCall;
+            bool retry = !remaining.empty() && attempt + 1 < retryPolicy.maxAttempts;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                BreakerState before = breaker.state();
+                breaker.record(callFailed, end);
+                if (breaker.state() != before)
+                    breakerChange.notify_all();
+                counters.gatewayCalls++;
+                if (retry)
+                    counters.retries += remaining.size();
+            }
+            if (!retry)
+                break;
+            std::this_thread::sleep_for(backoff(attempt));
+        }
+        return results;
+    }
+
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            workAvailable.wait(lock, [this]
+                               { return stopping || !queue.empty(); });
+            if (queue.empty())
+                break;
+            if (batchSize > 1)
+            {
+                // Let the batch fill until the oldest request has waited long enough
+                workAvailable.wait_until(lock, queue.front().queued + batchWait, [this]
+                                         { return stopping || queue.size() >= batchSize; });
+                if (queue.empty()) // taken by another worker meanwhile
+                    continue;
+            }
+
+            size_t take = std::min(queue.size(), batchSize);
+            std::vector<Job> jobs;
+            jobs.reserve(take);
+            for (size_t i = 0; i < take; ++i)
+            {
+                jobs.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            inFlight += take;
+            lock.unlock();
+
+            std::vector<PaymentResult> results = authorizeWithRetry(jobs);
+
+            // Only approvals are replayed. A decline or gateway error may be
+            // retried, perhaps with another card, so its key is dropped
+            // before the result is published and a caller who submits again
+            // is not told the retry is a duplicate of the failed payment.
+            lock.lock();
+            for (size_t i = 0; i < jobs.size(); ++i)
+            {
+                if (jobs[i].request.idempotencyKey && !results[i].approved())
+                    seen.erase(jobs[i].request.idempotencyKey, jobs[i].request.requestID);
+            }
+            lock.unlock();
+
+            for (size_t i = 0; i < jobs.size(); ++i)
+            {
+                if (jobs[i].onComplete)
+                    jobs[i].onComplete(jobs[i].request, results[i]);
+                jobs[i].promise.set_value(results[i]);
+            }
+
+            lock.lock();
+            for (size_t i = 0; i < jobs.size(); ++i)
+                completed.emplace_back(std::move(jobs[i].request), results[i]);
+            inFlight -= take;
+            counters.requests += take;
+            idle.notify_all();
+        }
+    }
+
+public:
+    PaymentPipeline()
+        : nextRequestID(1), inFlight(0), stopping(false), batchSize(1), batchWait(0), counters(),
+          jitter(std::random_device{}()) {}
+
+    // Takes effect for calls made after it; set before start() to be sure
+    void setRetryPolicy(const RetryPolicy &policy)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        retryPolicy = policy;
+        retryPolicy.maxAttempts = std::max(1u, policy.maxAttempts);
+    }
+
+    // Replaces the breaker, closing it
+    void setBreakerPolicy(const BreakerPolicy &policy)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            breaker = CircuitBreaker(policy);
+        }
+        breakerChange.notify_all();
+    }
+
+    BreakerState breakerState()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return breaker.state();
+    }
+
+    // How long and how many idempotency keys are remembered
+    void setDedupeWindow(std::chrono::seconds window, size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        seen = IdempotencyTable(window, capacity);
+    }
+
+    ~PaymentPipeline() { stop(); }
+
+    PaymentPipeline(const PaymentPipeline &) = delete;
+    PaymentPipeline &operator=(const PaymentPipeline &) = delete;
+
+    // Start workerCount threads talking to gw
+    void start(std::shared_ptr<PaymentGateway> gw, size_t workerCount)
+    {
+        stop();
+        gateway = std::move(gw);
+        stopping = false;
+        for (size_t i = 0; i < std::max<size_t>(1, workerCount); ++i)
+            workers.emplace_back(&PaymentPipeline::workerLoop, this);
+    }
+
+    bool isRunning() const { return !workers.empty(); }
+
+    // Continue request IDs after those already issued by an earlier run
+    void resumeRequestIDs(uint64_t lastIssued)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        nextRequestID = std::max(nextRequestID, lastIssued + 1);
+    }
+
+    // Collect up to maxItems requests, waiting at most maxWait for the batch
+    // to fill, before calling the gateway. maxItems of 1 turns batching off.
+    void setBatching(size_t maxItems, std::chrono::milliseconds maxWait)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            batchSize = std::max<size_t>(1, maxItems);
+            batchWait = maxWait;
+        }
+        workAvailable.notify_all();
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Stats current = counters;
+        current.breakerTrips = breaker.trips();
+        return current;
+    }
+
+    // Queue a request; its requestID is assigned here and returned through it.
+    // A request whose idempotency key is still being authorized, or was
+    // approved recently, is not queued: it gets the original requestID and
+    // result, and neither onComplete nor the completion queue sees it a
+    // second time. A request whose card fails validation, or that has no
+    // card number, completes as Declined right here: onComplete runs on the
+    // calling thread and the result goes to the completion queue.
+    std::shared_future<PaymentResult> submit(PaymentRequest &request, Callback onComplete = Callback())
+    {
+        Job job;
+        std::shared_future<PaymentResult> future = job.promise.get_future().share();
+        CardError cardError = request.cardNumber.empty() ? CardError::NotDigits
+                                                         : validateCard(request.cardNumber, request.expiryDate);
+        if (cardError != CardError::None)
+        {
+            PaymentResult result = {PaymentStatus::Declined, "", cardErrorMessage(cardError)};
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                request.requestID = nextRequestID++;
+                request.duplicate = false;
+                counters.invalidCards++;
+                counters.requests++;
+            }
+            if (onComplete)
+                onComplete(request, result);
+            job.promise.set_value(result);
+            std::lock_guard<std::mutex> lock(mtx);
+            completed.emplace_back(request, result);
+            return future;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (request.idempotencyKey)
+            {
+                if (const IdempotencyTable::Entry *original = seen.find(request.idempotencyKey))
+                {
+                    request.requestID = original->requestID;
+                    request.duplicate = true;
+                    counters.duplicates++;
+                    return original->result;
+                }
+            }
+            request.requestID = nextRequestID++;
+            request.duplicate = false;
+            if (request.idempotencyKey)
+                seen.insert(request.idempotencyKey, {request.requestID, future});
+            job.request = request;
+            job.onComplete = std::move(onComplete);
+            job.queued = std::chrono::steady_clock::now();
+            queue.push_back(std::move(job));
+        }
+        workAvailable.notify_one();
+        return future;
+    }
+
+    // Hand every finished request to apply, on the calling thread
+    size_t drainCompleted(const Callback &apply)
+    {
+        std::deque<std::pair<PaymentRequest, PaymentResult>> done;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done.swap(completed);
+        }
+        for (const auto &entry : done)
+            apply(entry.first, entry.second);
+        return done.size();
+    }
+
+    // Requests queued or being authorized
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return queue.size() + inFlight;
+    }
+
+    // Block until every submitted request has completed
+    void waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        idle.wait(lock, [this]
+                  { return queue.empty() && inFlight == 0; });
+    }
+
+    // Finish queued requests, then join the workers
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        breakerChange.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+    }
+};
+
+#endif
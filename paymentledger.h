@@ -0,0 +1,309 @@
+// Append-only payment ledger
+//
+// Every authorization outcome and refund becomes one typed entry per booking
+// (who paid, which booking, how much, when, with what result). Entries are
+// never changed or removed. Audits are queries over the ledger: by payer,
+// by booking, or over a time range. Entries are kept in time order, so a
+// range is found by binary search. Entries and payer names are kept in
+// copy-on-write chunks, so a snapshot captures the ledger without copying it.
+
+#ifndef PAYMENTLEDGER_H
+#define PAYMENTLEDGER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include "money.h"
+#include "chunkedlist.h"
+
+enum class LedgerStatus : uint8_t
+{
+    Approved = 0,
+    Declined = 1,
+    Refunded = 2, // a paid booking was cancelled
+    Failed = 3    // the gateway could not be reached or errored
+};
+
+inline const char *ledgerStatusName(LedgerStatus status)
+{
+    switch (status)
+    {
+    case LedgerStatus::Approved:
+        return "Approved";
+    case LedgerStatus::Declined:
+        return "Declined";
+    case LedgerStatus::Refunded:
+        return "Refunded";
+    case LedgerStatus::Failed:
+        return "Failed";
+    }
+    return "Unknown";
+}
+
+struct LedgerEntry
+{
+    int64_t timestamp;  // milliseconds since the Unix epoch, 0 if unknown
+    uint64_t requestID; // payment request, 0 for refunds and imported entries
+    Money amount;
+    int32_t bookingID;
+    uint32_t payerID; // into PaymentLedger::payerName()
+    LedgerStatus status;
+};
+
+// Milliseconds since the Unix epoch
+inline int64_t ledgerNow()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date (UTC, no time zone lookup)
+inline int64_t daysFromCivil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+// Parse "YYYY-MM-DD" as the start of that day in UTC milliseconds
+inline bool parseLedgerDate(const std::string &text, int64_t &timestamp)
+{
+    int year, month, day;
+    char extra;
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%c", &year, &month, &day, &extra) != 3 ||
+        month < 1 || month > 12 || day < 1 || day > 31)
+        return false;
+    timestamp = daysFromCivil(year, month, day) * 86400000;
+    return true;
+}
+
+// Format as "2024-12-15 08:00:00 UTC", or "unknown" for imported entries
+inline std::string formatLedgerTime(int64_t timestamp)
+{
+    if (timestamp <= 0)
+        return "unknown";
+    int64_t seconds = timestamp / 1000;
+    int64_t days = seconds / 86400;
+    int64_t secondOfDay = seconds % 86400;
+
+    // Inverse of daysFromCivil
+    days += 719468;
+    int64_t era = days / 146097;
+    unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned mp = (5 * dayOfYear + 2) / 153;
+    unsigned day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02u %02d:%02d:%02d UTC", static_cast<long long>(year), month, day,
+             static_cast<int>(secondOfDay / 3600), static_cast<int>(secondOfDay / 60 % 60),
+             static_cast<int>(secondOfDay % 60));
+    return buffer;
+}
+
+class PaymentLedger
+{
+private:
+    static constexpr uint32_t NO_ENTRY = UINT32_MAX;
+
+    // A booking's entries are chained through nextForBooking, so indexing
+    // one costs a slot in a flat array instead of a vector per booking
+    struct BookingEntries
+    {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    ChunkedList<LedgerEntry> entries;
+    ChunkedList<std::string> payers;
+    std::unordered_map<std::string, uint32_t> payerIDs;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> byPayer; // entry positions
+    std::unordered_map<int32_t, BookingEntries> byBooking;
+    std::vector<uint32_t> nextForBooking; // by entry position, NO_ENTRY after a booking's last
+    uint64_t highestRequestID;
+
+    uint32_t internPayer(const std::string &payer)
+    {
+        auto found = payerIDs.find(payer);
+        if (found != payerIDs.end())
+            return found->second;
+        uint32_t id = static_cast<uint32_t>(payers.size());
+        payers.push_back(payer);
+        payerIDs.emplace(payer, id);
+        return id;
+    }
+
+    void index(uint32_t position)
+    {
+        const LedgerEntry &entry = entries[position];
+        highestRequestID = std::max(highestRequestID, entry.requestID);
+        byPayer[entry.payerID].push_back(position);
+        nextForBooking.push_back(NO_ENTRY);
+        auto inserted = byBooking.emplace(entry.bookingID, BookingEntries{position, position});
+        if (!inserted.second)
+        {
+            nextForBooking[inserted.first->second.last] = position;
+            inserted.first->second.last = position;
+        }
+    }
+
+public:
+    PaymentLedger() : highestRequestID(0) {}
+
+    // Record an outcome. Timestamps never go backwards, so a clock step
+    // back is recorded as the previous entry's time.
+    const LedgerEntry &append(const std::string &payer, int bookingID, const Money &amount, LedgerStatus status,
+                              int64_t timestamp, uint64_t requestID)
+    {
+        if (!entries.empty())
+            timestamp = std::max(timestamp, entries.back().timestamp);
+        entries.push_back({timestamp, requestID, amount, bookingID, internPayer(payer), status});
+        index(static_cast<uint32_t>(entries.size() - 1));
+        return entries.back();
+    }
+
+    const std::string &payerName(uint32_t payerID) const { return payers[payerID]; }
+
+    size_t size() const { return entries.size(); }
+
+    // Highest payment request ID recorded, so new requests can continue after it
+    uint64_t lastRequestID() const { return highestRequestID; }
+
+    // Visit a payer's entries in time order
+    template <typename Visit>
+    void forPayer(const std::string &payer, Visit visit) const
+    {
+        auto id = payerIDs.find(payer);
+        if (id == payerIDs.end())
+            return;
+        auto found = byPayer.find(id->second);
+        if (found != byPayer.end())
+            for (uint32_t position : found->second)
+                visit(entries[position]);
+    }
+
+    // Visit a booking's entries in time order
+    template <typename Visit>
+    void forBooking(int bookingID, Visit visit) const
+    {
+        auto found = byBooking.find(bookingID);
+        if (found == byBooking.end())
+            return;
+        for (uint32_t position = found->second.first; position != NO_ENTRY; position = nextForBooking[position])
+            visit(entries[position]);
+    }
+
+    // Visit every booking ID that has entries, in no particular order
+    template <typename Visit>
+    void forEachBookingID(Visit visit) const
+    {
+        for (const auto &entry : byBooking)
+            visit(entry.first);
+    }
+
+    // Visit entries with from <= timestamp < to
+    template <typename Visit>
+    void forRange(int64_t from, int64_t to, Visit visit) const
+    {
+        size_t first = 0, last = entries.size();
+        while (first < last)
+        {
+            size_t middle = first + (last - first) / 2;
+            if (entries[middle].timestamp < from)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        for (size_t i = first; i < entries.size() && entries[i].timestamp < to; ++i)
+            visit(entries[i]);
+    }
+
+    // Who paid for a booking, from its latest approved entry
+    const std::string *payerOf(int bookingID) const
+    {
+        const std::string *payer = nullptr;
+        forBooking(bookingID, [this, &payer](const LedgerEntry &entry)
+                   {
+                       if (entry.status == LedgerStatus::Approved)
+                           payer = &payers[entry.payerID]; });
+        return payer;
+    }
+
+    void clear()
+    {
+        entries.clear();
+        payers.clear();
+        payerIDs.clear();
+        byPayer.clear();
+        byBooking.clear();
+        nextForBooking.clear();
+        highestRequestID = 0;
+    }
+
+    // The entries and payer names as they are now, for the snapshot thread.
+    // They share the ledger's chunks rather than copying them; the indexes
+    // are left out since decode() rebuilds them.
+    struct Image
+    {
+        ChunkedList<std::string>::Image payers;
+        ChunkedList<LedgerEntry>::Image entries;
+
+        void encode(WalBuffer &out) const
+        {
+            out.putU64(payers.size());
+            payers.forEach([&out](const std::string &payer)
+                           { out.putString(payer); });
+            out.putU64(entries.size());
+            entries.forEach([&out](const LedgerEntry &entry)
+                            {
+                                out.putI64(entry.timestamp);
+                                out.putU64(entry.requestID);
+                                putMoney(out, entry.amount);
+                                out.putI32(entry.bookingID);
+                                out.putU32(entry.payerID);
+                                out.putU8(static_cast<uint8_t>(entry.status)); });
+        }
+    };
+
+    Image image() const { return {payers.image(), entries.image()}; }
+
+    void decode(WalCursor &in)
+    {
+        clear();
+        uint64_t payerCount = in.getU64();
+        for (uint64_t i = 0; i < payerCount && in.ok(); ++i)
+            internPayer(in.getString());
+        uint64_t entryCount = in.getU64();
+        // A damaged count must not reserve more than the body could hold
+        size_t expected = static_cast<size_t>(std::min<uint64_t>(entryCount, in.remaining() / 34));
+        nextForBooking.reserve(expected);
+        byBooking.reserve(expected);
+        for (uint64_t i = 0; i < entryCount && in.ok(); ++i)
+        {
+            LedgerEntry entry;
+            entry.timestamp = in.getI64();
+            entry.requestID = in.getU64();
+            entry.amount = getMoney(in);
+            entry.bookingID = in.getI32();
+            entry.payerID = in.getU32();
+            entry.status = static_cast<LedgerStatus>(in.getU8());
+            if (!in.ok() || entry.payerID >= payers.size())
+                break;
+            entries.push_back(entry);
+            index(static_cast<uint32_t>(entries.size() - 1));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,300 @@
+// Login rate limiting
+//
+// Every login attempt takes a token from two token buckets, one for the
+// email being tried and one for the source the attempt comes from. A
+// bucket holds up to burst tokens and earns perSecond back, so a user can
+// mistype a few times in a row but a guesser is slowed to the refill rate.
+// When either bucket is empty the attempt is refused before the password
+// is hashed, so refused attempts cost a table lookup and no KDF time.
+//
+// Buckets live in a fixed-size table of 8-way sets indexed by a seeded
+// hash of the key, so memory does not grow however many emails or sources
+// an attacker cycles through. A new key takes an empty entry in its set
+// or else the entry whose bucket would now be fullest: a full bucket
+// carries nothing worth keeping, while a drained one is exactly what must
+// not be forgotten, so flooding a set with fresh keys evicts idle users
+// and not the account under attack. Checks cost one scan of a set.
+//
+// The programs take one login per run, so a table kept in memory would be
+// reset by starting again. The tables are therefore memory-mapped files
+// (login_accounts.lim, login_sources.lim) of fixed size, shared by every
+// run; times are wall-clock milliseconds so they carry across runs. Two
+// runs updating one bucket at once can lose a token, which only matters
+// as much as the limit is approximate anyway.
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "userstore.h"
+
+const char RATE_LIMIT_MAGIC[8] = {'G', 'K', 'L', 'I', 'M', 'I', 'T', 0};
+const uint32_t RATE_LIMIT_VERSION = 1;
+
+struct RateLimitHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ways;
+    uint64_t sets;
+    uint64_t seed; // the key hash is seeded, so it must be kept with the entries
+    uint8_t padding[32];
+};
+
+static_assert(sizeof(RateLimitHeader) == 64, "rate limit file header layout");
+
+struct RateLimit
+{
+    double burst;     // attempts allowed in a row
+    double perSecond; // attempts earned back per second
+};
+
+class TokenBucketTable
+{
+public:
+    typedef std::chrono::system_clock Clock;
+
+private:
+    static constexpr size_t WAYS = 8;
+
+    struct Entry
+    {
+        uint64_t key; // 0 if unused
+        double tokens;
+        int64_t updated; // milliseconds since the epoch
+    };
+
+    std::vector<Entry> owned; // until open() maps a file
+    WritableMapping file;
+    Entry *entries;
+    size_t entryCount;
+    size_t setMask;
+    uint64_t seed;
+    RateLimit limit;
+
+    static int64_t milliseconds(Clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    uint64_t keyHash(const std::string &key) const
+    {
+        uint64_t hash = 14695981039346656037ULL ^ seed;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        hash ^= hash >> 29; // FNV's low bits are weak, and they pick the set
+        return hash ? hash : 1;
+    }
+
+    // A clock set back counts as no time passing
+    double tokensAt(const Entry &entry, Clock::time_point now) const
+    {
+        double elapsed = (milliseconds(now) - entry.updated) / 1000.0;
+        return std::min(limit.burst, entry.tokens + std::max(0.0, elapsed) * limit.perSecond);
+    }
+
+    // The entry for key, or nullptr; victim is set to where key would go
+    Entry *lookup(uint64_t hash, Clock::time_point now, Entry **victim)
+    {
+        Entry *set = &entries[(hash & setMask) * WAYS];
+        Entry *fullest = nullptr;
+        double fullestTokens = -1;
+        for (size_t i = 0; i < WAYS; ++i)
+        {
+            if (set[i].key == hash)
+                return &set[i];
+            double tokens = set[i].key ? tokensAt(set[i], now) : limit.burst + 1;
+            if (tokens > fullestTokens)
+            {
+                fullest = &set[i];
+                fullestTokens = tokens;
+            }
+        }
+        if (victim)
+            *victim = fullest;
+        return nullptr;
+    }
+
+public:
+    // Room for about capacity keys, rounded up to a power of two
+    TokenBucketTable(RateLimit bucket, size_t capacity = 65536) : seed(0), limit(bucket)
+    {
+        size_t sets = 1;
+        while (sets * WAYS < capacity)
+            sets *= 2;
+        owned.assign(sets * WAYS, Entry{0, 0, 0});
+        entries = owned.data();
+        entryCount = owned.size();
+        setMask = sets - 1;
+        seed = std::random_device{}() | static_cast<uint64_t>(std::random_device{}()) << 32;
+    }
+
+    TokenBucketTable(const TokenBucketTable &) = delete;
+    TokenBucketTable &operator=(const TokenBucketTable &) = delete;
+
+    // Keep the table in path from now on, picking up the buckets already
+    // there. A missing file, or one made for another size, starts empty.
+    // On failure the table stays in memory.
+    bool open(const std::string &path)
+    {
+        size_t size = sizeof(RateLimitHeader) + entryCount * sizeof(Entry);
+        bool fresh;
+        if (!file.open(path, size, fresh))
+            return false;
+        RateLimitHeader *header = reinterpret_cast<RateLimitHeader *>(file.data());
+        if (fresh || file.length() != size || memcmp(header->magic, RATE_LIMIT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != RATE_LIMIT_VERSION || header->ways != WAYS || header->sets != setMask + 1)
+        {
+            if (file.length() != size && !file.resize(size))
+            {
+                file.close();
+                return false;
+            }
+            header = reinterpret_cast<RateLimitHeader *>(file.data());
+            memset(file.data(), 0, size);
+            memcpy(header->magic, RATE_LIMIT_MAGIC, sizeof(header->magic));
+            header->version = RATE_LIMIT_VERSION;
+            header->ways = WAYS;
+            header->sets = setMask + 1;
+            header->seed = seed;
+        }
+        seed = header->seed;
+        entries = reinterpret_cast<Entry *>(file.data() + sizeof(RateLimitHeader));
+        owned.clear();
+        owned.shrink_to_fit();
+        return true;
+    }
+
+    void setLimit(RateLimit bucket) { limit = bucket; }
+
+    // Tokens key has now; a key not in the table has a full bucket
+    double available(const std::string &key, Clock::time_point now = Clock::now())
+    {
+        Entry *entry = lookup(keyHash(key), now, nullptr);
+        return entry ? tokensAt(*entry, now) : limit.burst;
+    }
+
+    // Seconds until key has a token again, 0 if it has one now
+    double waitFor(const std::string &key, Clock::time_point now = Clock::now())
+    {
+        double tokens = available(key, now);
+        return tokens >= 1 ? 0 : (1 - tokens) / limit.perSecond;
+    }
+
+    // Take a token for key if it has one
+    bool take(const std::string &key, Clock::time_point now = Clock::now())
+    {
+        uint64_t hash = keyHash(key);
+        Entry *victim = nullptr;
+        Entry *entry = lookup(hash, now, &victim);
+        if (!entry)
+        {
+            entry = victim;
+            entry->key = hash;
+            entry->tokens = limit.burst;
+            entry->updated = milliseconds(now);
+        }
+        entry->tokens = tokensAt(*entry, now);
+        entry->updated = milliseconds(now);
+        if (entry->tokens < 1)
+            return false;
+        entry->tokens -= 1;
+        return true;
+    }
+
+    // Forget key, leaving it a full bucket
+    void reset(const std::string &key)
+    {
+        Entry *entry = lookup(keyHash(key), Clock::now(), nullptr);
+        if (entry)
+            entry->key = 0;
+    }
+
+    size_t capacity() const { return entryCount; }
+    size_t memoryBytes() const { return entryCount * sizeof(Entry); }
+};
+
+// Default limits: five tries at an account, then one every 30 seconds; a
+// source gets four times that, since several people may share it
+const RateLimit LOGIN_ACCOUNT_LIMIT = {5, 1.0 / 30};
+const RateLimit LOGIN_SOURCE_LIMIT = {20, 4.0 / 30};
+
+class LoginRateLimiter
+{
+private:
+    std::mutex mtx;
+    TokenBucketTable accounts;
+    TokenBucketTable sources;
+
+public:
+    LoginRateLimiter(RateLimit account = LOGIN_ACCOUNT_LIMIT, RateLimit source = LOGIN_SOURCE_LIMIT,
+                     size_t capacity = 65536)
+        : accounts(account, capacity), sources(source, capacity) {}
+
+    // Share the buckets with other runs through two files
+    bool open(const std::string &accountFile, const std::string &sourceFile)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        bool accountsOpen = accounts.open(accountFile);
+        bool sourcesOpen = sources.open(sourceFile);
+        return accountsOpen && sourcesOpen;
+    }
+
+    void setLimits(RateLimit account, RateLimit source)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        accounts.setLimit(account);
+        sources.setLimit(source);
+    }
+
+    // Whether an attempt at email from source may go ahead. Tokens are
+    // taken only when both buckets have one; otherwise retryAfter is set to
+    // the seconds until the attempt would be let through.
+    bool allow(const std::string &email, const std::string &source, double &retryAfter,
+               TokenBucketTable::Clock::time_point now = TokenBucketTable::Clock::now())
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        retryAfter = std::max(accounts.waitFor(email, now), sources.waitFor(source, now));
+        if (retryAfter > 0)
+            return false;
+        accounts.take(email, now);
+        sources.take(source, now);
+        return true;
+    }
+
+    // The right password was given: the account's earlier misses no longer count
+    void succeeded(const std::string &email)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        accounts.reset(email);
+    }
+
+    size_t memoryBytes() const { return accounts.memoryBytes() + sources.memoryBytes(); }
+};
+
+const char LOGIN_ACCOUNT_LIMIT_FILE[] = "login_accounts.lim";
+const char LOGIN_SOURCE_LIMIT_FILE[] = "login_sources.lim";
+
+// Where this run's login attempts come from: over ssh the client's address
+// tells sources apart; locally there is one
+inline std::string loginSourceName()
+{
+    const char *sshClient = getenv("SSH_CLIENT");
+    if (!sshClient || !*sshClient)
+        return "console";
+    std::string client(sshClient);
+    return client.substr(0, client.find(' '));
+}
+
+#endif
@@ -0,0 +1,263 @@
+// Reconciliation of bookings, the payment ledger and seat counts
+//
+// Each booking's paid flag and amount is checked against what the ledger
+// says was collected and refunded for it. Each flight's booked and free
+// seats are checked against the bookings that exist for it. Flights are
+// independent, so the work is split by flight across a pool of threads.
+// A final task looks for ledger payments whose booking no longer exists.
+// The inputs are only read, so they must not change while this runs.
+
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include "money.h"
+#include "paymentledger.h"
+
+// What the flight table and the maintained seat counts say about a flight
+struct ReconcileFlight
+{
+    int flightID;
+    bool scheduled;     // still in the flight table
+    int availableSeats; // from the flight table
+    bool tracked;       // has seat counts in the dashboard views
+    int trackedBooked;
+    int trackedAvailable;
+};
+
+// A live or archived booking
+struct ReconcileBooking
+{
+    int bookingID;
+    int flightID;
+    bool archived;
+    bool paid;
+    Money fare;
+    Money paidAmount;
+};
+
+enum class IssueKind
+{
+    PaidWithoutLedger,  // marked paid, but the ledger shows no money collected
+    LedgerWithoutPaid,  // the ledger shows money collected, but the booking is unpaid
+    AmountMismatch,     // paid amount differs from the ledger's net amount
+    PaidWithoutBooking, // money collected and not refunded for a booking that no longer exists
+    BookedWithoutPayment,
+    SeatDrift, // booked or free seats disagree between bookings, flight table and views
+    IssueKindCount
+};
+
+inline const char *issueKindName(IssueKind kind)
+{
+    switch (kind)
+    {
+    case IssueKind::PaidWithoutLedger:
+        return "Paid without ledger entry";
+    case IssueKind::LedgerWithoutPaid:
+        return "Ledger payment for unpaid booking";
+    case IssueKind::AmountMismatch:
+        return "Amount mismatch";
+    case IssueKind::PaidWithoutBooking:
+        return "Paid without booking";
+    case IssueKind::BookedWithoutPayment:
+        return "Booked without payment";
+    case IssueKind::SeatDrift:
+        return "Seat-count drift";
+    default:
+        return "Unknown";
+    }
+}
+
+struct ReconcileIssue
+{
+    IssueKind kind;
+    int flightID; // 0 if unknown
+    int bookingID; // 0 for flight-level issues
+    std::string detail;
+};
+
+struct ReconcileReport
+{
+    std::vector<ReconcileIssue> issues; // ordered by flight, then booking
+    size_t counts[static_cast<size_t>(IssueKind::IssueKindCount)];
+    size_t flightsChecked;
+    size_t bookingsChecked;
+    size_t threads;
+    double seconds;
+
+    ReconcileReport() : counts(), flightsChecked(0), bookingsChecked(0), threads(0), seconds(0) {}
+};
+
+// Net amount the ledger collected for a booking: approvals minus refunds,
+// in the currency of its entries. collected is false when there is no
+// approval at all.
+inline Money ledgerNet(const PaymentLedger &ledger, int bookingID, bool &collected)
+{
+    Money net;
+    bool first = true;
+    collected = false;
+    ledger.forBooking(bookingID, [&](const LedgerEntry &entry)
+                      {
+                          if (first)
+                              net.currency = entry.amount.currency;
+                          first = false;
+                          if (entry.status == LedgerStatus::Approved)
+                          {
+                              net.minor += entry.amount.minor;
+                              collected = true;
+                          }
+                          else if (entry.status == LedgerStatus::Refunded)
+                              net.minor -= entry.amount.minor; });
+    return net;
+}
+
+class Reconciler
+{
+private:
+    struct Partition
+    {
+        const ReconcileFlight *flight;
+        int flightID;
+        std::vector<const ReconcileBooking *> bookings;
+    };
+
+    static void checkBooking(const ReconcileBooking &booking, const PaymentLedger &ledger,
+                             std::vector<ReconcileIssue> &out)
+    {
+        bool collected;
+        Money net = ledgerNet(ledger, booking.bookingID, collected);
+        if (booking.paid)
+        {
+            if (!collected || net.minor <= 0)
+                out.push_back({IssueKind::PaidWithoutLedger, booking.flightID, booking.bookingID,
+                               "marked paid " + toString(booking.paidAmount) + ", ledger net " + toString(net)});
+            else if (net != booking.paidAmount)
+                out.push_back({IssueKind::AmountMismatch, booking.flightID, booking.bookingID,
+                               "paid " + toString(booking.paidAmount) + ", ledger net " + toString(net)});
+        }
+        else if (net.minor > 0)
+        {
+            out.push_back({IssueKind::LedgerWithoutPaid, booking.flightID, booking.bookingID,
+                           "ledger net " + toString(net) + " but unpaid"});
+        }
+        else if (!booking.archived)
+        {
+            out.push_back({IssueKind::BookedWithoutPayment, booking.flightID, booking.bookingID,
+                           "fare " + toString(booking.fare) + " not paid"});
+        }
+    }
+
+    static void checkFlight(const Partition &partition, std::vector<ReconcileIssue> &out)
+    {
+        int booked = static_cast<int>(partition.bookings.size());
+        const ReconcileFlight *flight = partition.flight;
+        if (!flight)
+        {
+            out.push_back({IssueKind::SeatDrift, partition.flightID, 0,
+                           std::to_string(booked) + " bookings for a flight with no seat counts"});
+            return;
+        }
+        if (flight->tracked && flight->trackedBooked != booked)
+            out.push_back({IssueKind::SeatDrift, partition.flightID, 0,
+                           "views count " + std::to_string(flight->trackedBooked) + " booked seats, " +
+                               std::to_string(booked) + " bookings exist"});
+        if (flight->scheduled && flight->tracked && flight->availableSeats != flight->trackedAvailable)
+            out.push_back({IssueKind::SeatDrift, partition.flightID, 0,
+                           "flight table has " + std::to_string(flight->availableSeats) + " free seats, views " +
+                               std::to_string(flight->trackedAvailable)});
+        if (flight->scheduled && flight->availableSeats < 0)
+            out.push_back({IssueKind::SeatDrift, partition.flightID, 0,
+                           "overbooked: " + std::to_string(flight->availableSeats) + " free seats"});
+    }
+
+public:
+    static ReconcileReport run(const std::vector<ReconcileFlight> &flights, const std::vector<ReconcileBooking> &bookings,
+                               const PaymentLedger &ledger, size_t threadCount = 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ReconcileReport report;
+
+        // Partition the bookings by flight
+        std::unordered_map<int, size_t> partitionOf;
+        std::vector<Partition> partitions;
+        auto partitionFor = [&](int flightID) -> Partition &
+        {
+            auto found = partitionOf.emplace(flightID, partitions.size());
+            if (found.second)
+                partitions.push_back({nullptr, flightID, {}});
+            return partitions[found.first->second];
+        };
+        for (const ReconcileFlight &flight : flights)
+            partitionFor(flight.flightID).flight = &flight;
+        std::unordered_set<int> bookingIDs;
+        bookingIDs.reserve(bookings.size());
+        for (const ReconcileBooking &booking : bookings)
+        {
+            partitionFor(booking.flightID).bookings.push_back(&booking);
+            bookingIDs.insert(booking.bookingID);
+        }
+
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        threadCount = std::min(threadCount, partitions.size() + 1);
+
+        // Task i < partitions.size() checks one flight; the last task scans
+        // the ledger for bookings that are gone
+        std::atomic<size_t> nextTask(0);
+        std::mutex merge;
+        auto worker = [&]
+        {
+            std::vector<ReconcileIssue> found;
+            for (size_t task = nextTask++; task <= partitions.size(); task = nextTask++)
+            {
+                if (task == partitions.size())
+                {
+                    ledger.forEachBookingID([&](int bookingID)
+                                            {
+                        if (bookingIDs.count(bookingID))
+                            return;
+                        bool collected;
+                        Money net = ledgerNet(ledger, bookingID, collected);
+                        if (net.minor > 0)
+                            found.push_back({IssueKind::PaidWithoutBooking, 0, bookingID,
+                                             "ledger net " + toString(net) + " with no booking or refund"}); });
+                    continue;
+                }
+                const Partition &partition = partitions[task];
+                for (const ReconcileBooking *booking : partition.bookings)
+                    checkBooking(*booking, ledger, found);
+                checkFlight(partition, found);
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            report.issues.insert(report.issues.end(), found.begin(), found.end());
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < threadCount; ++i)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread &thread : pool)
+            thread.join();
+
+        std::sort(report.issues.begin(), report.issues.end(), [](const ReconcileIssue &a, const ReconcileIssue &b)
+                  { return a.flightID != b.flightID ? a.flightID < b.flightID : a.bookingID < b.bookingID; });
+        for (const ReconcileIssue &issue : report.issues)
+            report.counts[static_cast<size_t>(issue.kind)]++;
+        report.flightsChecked = partitions.size();
+        report.bookingsChecked = bookings.size();
+        report.threads = threadCount;
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return report;
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+// Roles and permissions
+//
+// An account has one role, kept as a byte rather than as its name. What a
+// role may do is a set of permission bits, looked up once when a session
+// is issued and kept with it, so a menu checks whether it may be used with
+// one bit test instead of comparing names. Each menu has its own bit;
+// staff may also use the passenger menu, and admins every menu.
+//
+// Role names are still what users.txt, users.db and exports hold, so those
+// files read as they did before. parseRole accepts them in any case, and
+// "staff" for "Airline Staff". Accounts with no role, which older lines and
+// the login prototype leave behind, get what a passenger gets.
+
+#ifndef ROLES_H
+#define ROLES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <cstring>
+
+enum class UserRole : uint8_t
+{
+    None = 0,
+    Passenger = 1,
+    Staff = 2,
+    Admin = 3
+};
+
+typedef uint32_t Permissions;
+
+const Permissions PERMIT_PASSENGER_MENU = 1u << 0;
+const Permissions PERMIT_STAFF_MENU = 1u << 1;
+const Permissions PERMIT_ADMIN_MENU = 1u << 2;
+
+inline Permissions rolePermissions(UserRole role)
+{
+    switch (role)
+    {
+    case UserRole::Admin:
+        return PERMIT_PASSENGER_MENU | PERMIT_STAFF_MENU | PERMIT_ADMIN_MENU;
+    case UserRole::Staff:
+        return PERMIT_PASSENGER_MENU | PERMIT_STAFF_MENU;
+    default:
+        return PERMIT_PASSENGER_MENU;
+    }
+}
+
+// The permission needed to open role's menu
+inline Permissions roleMenuPermission(UserRole role)
+{
+    switch (role)
+    {
+    case UserRole::Admin:
+        return PERMIT_ADMIN_MENU;
+    case UserRole::Staff:
+        return PERMIT_STAFF_MENU;
+    default:
+        return PERMIT_PASSENGER_MENU;
+    }
+}
+
+// Name as files and menus show it; empty for None
+inline const char *roleName(UserRole role)
+{
+    switch (role)
+    {
+    case UserRole::Passenger:
+        return "Passenger";
+    case UserRole::Staff:
+        return "Airline Staff";
+    case UserRole::Admin:
+        return "Admin";
+    default:
+        return "";
+    }
+}
+
+// Role named by text in any case; false if text is not one
+inline bool parseRole(const char *text, size_t length, UserRole &out)
+{
+    auto equals = [text, length](const char *word)
+    {
+        size_t n = strlen(word);
+        if (n != length)
+            return false;
+        for (size_t i = 0; i < n; ++i)
+            if (tolower(static_cast<unsigned char>(text[i])) != word[i])
+                return false;
+        return true;
+    };
+    if (equals("passenger"))
+        out = UserRole::Passenger;
+    else if (equals("admin"))
+        out = UserRole::Admin;
+    else if (equals("airline staff") || equals("staff"))
+        out = UserRole::Staff;
+    else
+        return false;
+    return true;
+}
+
+#endif
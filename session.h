@@ -0,0 +1,174 @@
+// Login sessions
+//
+// A login or registration issues a session: an opaque token of 128 random
+// bits that stands for the user until it expires. The role menus hold the
+// token and look it up on each pass, so the password KDF runs once per
+// login instead of once per action, and going back to the main menu keeps
+// the user logged in. A session expires after it has gone unused for its
+// lifetime; each use starts that period again.
+//
+// Sessions are kept in a hash table split into shards, each with its own
+// mutex, so lookups from different threads rarely wait on one another.
+// Expired sessions are dropped when they are looked up, and a shard is
+// swept for the rest every SWEEP_EVERY sessions issued into it, which keeps
+// expiry off the lookup path and bounds what abandoned sessions can hold.
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <functional>
+#include "userfile.h"
+#include "passwordhash.h"
+
+struct Session
+{
+    std::string email;
+    std::string name;
+    UserRole role = UserRole::None;
+    Permissions permissions = 0; // rolePermissions(role), resolved when the session is issued
+    std::chrono::steady_clock::time_point expires;
+
+    // The user as userDisplayName() and the menus see them, without a password
+    UserRecord user() const { return {email, "", name, role}; }
+
+    bool allows(Permissions permission) const { return (permissions & permission) != 0; }
+};
+
+class SessionManager
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t SWEEP_EVERY = 64;
+    static constexpr size_t TOKEN_BYTES = 16;
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<std::string, Session> sessions; // by token
+        size_t issuedSinceSweep = 0;
+    };
+
+    Shard shards[SHARDS];
+    Clock::duration lifetime;
+
+    Shard &shardFor(const std::string &token) { return shards[std::hash<std::string>()(token) % SHARDS]; }
+
+    // Drop every expired session in shard; its mutex is held
+    static void sweep(Shard &shard, Clock::time_point now)
+    {
+        for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+        {
+            if (it->second.expires <= now)
+                it = shard.sessions.erase(it);
+            else
+                ++it;
+        }
+        shard.issuedSinceSweep = 0;
+    }
+
+    // random_device reads the operating system's entropy source, so tokens
+    // cannot be predicted from ones seen before
+    static std::string newToken()
+    {
+        std::random_device entropy;
+        uint8_t bytes[TOKEN_BYTES];
+        for (size_t i = 0; i < TOKEN_BYTES; i += 4)
+        {
+            uint32_t bits = entropy();
+            memcpy(bytes + i, &bits, 4);
+        }
+        return toHex(bytes, sizeof(bytes));
+    }
+
+public:
+    explicit SessionManager(Clock::duration idleLifetime = std::chrono::minutes(30)) : lifetime(idleLifetime) {}
+
+    void setLifetime(Clock::duration idleLifetime) { lifetime = idleLifetime; }
+
+    // Start a session for user and return its token
+    std::string issue(const UserRecord &user, Clock::time_point now = Clock::now())
+    {
+        std::string token = newToken();
+        Shard &shard = shardFor(token);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (++shard.issuedSinceSweep >= SWEEP_EVERY)
+            sweep(shard, now);
+        shard.sessions[token] = {user.email, user.name, user.role, rolePermissions(user.role), now + lifetime};
+        return token;
+    }
+
+    // Look a token up and extend its session. False if it is unknown or
+    // has expired, in which case it is dropped.
+    bool find(const std::string &token, Session &out, Clock::time_point now = Clock::now())
+    {
+        if (token.empty())
+            return false;
+        Shard &shard = shardFor(token);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto found = shard.sessions.find(token);
+        if (found == shard.sessions.end())
+            return false;
+        if (found->second.expires <= now)
+        {
+            shard.sessions.erase(found);
+            return false;
+        }
+        found->second.expires = now + lifetime;
+        out = found->second;
+        return true;
+    }
+
+    bool isValid(const std::string &token, Clock::time_point now = Clock::now())
+    {
+        Session session;
+        return find(token, session, now);
+    }
+
+    void revoke(const std::string &token)
+    {
+        Shard &shard = shardFor(token);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        shard.sessions.erase(token);
+    }
+
+    // End every session of a user, e.g. once the account is removed
+    void revokeUser(const std::string &email)
+    {
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+            {
+                if (it->second.email == email)
+                    it = shard.sessions.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    // Sessions held, expired ones not yet dropped included
+    size_t size()
+    {
+        size_t total = 0;
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            total += shard.sessions.size();
+        }
+        return total;
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+// Binary snapshots of the in-memory flight and booking state
+//
+// File layout: "GKSNAP" + 2 digit version | u64 lsn | u64 body length | u32 crc32(body) | body
+// The lsn is the last log record already reflected in the body, so recovery
+// loads the snapshot and replays only log records after it. Since version 4
+// the body holds passenger names and flight dates once, and each booking is
+// a fixed-size record referring to them.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "wal.h"
+
+const char SNAPSHOT_MAGIC[8] = {'G', 'K', 'S', 'N', 'A', 'P', '0', '4'};
+
+// Write a snapshot to a temp file, fsync it and rename it over path so a
+// crash leaves either the old or the new snapshot, never a partial one
+inline bool writeSnapshotFile(const std::string &path, uint64_t lsn, const std::vector<uint8_t> &body)
+{
+    std::string tempPath = path + ".tmp";
+    FILE *out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;
+
+    WalBuffer header;
+    header.bytes.assign(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC));
+    header.putU64(lsn);
+    header.putU64(body.size());
+    header.putU32(crc32(body.data(), body.size()));
+
+    bool ok = fwrite(header.bytes.data(), 1, header.bytes.size(), out) == header.bytes.size() &&
+              fwrite(body.data(), 1, body.size(), out) == body.size() &&
+              syncFile(out);
+    fclose(out);
+    if (!ok)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename does not replace on Windows
+#endif
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+// Load and verify a snapshot. Returns false if it is missing or damaged.
+// version is set to the body's format (older snapshots are still readable).
+inline bool readSnapshotFile(const std::string &path, uint64_t &lsn, std::vector<uint8_t> &body, uint32_t &version)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+        return false;
+
+    uint8_t header[sizeof(SNAPSHOT_MAGIC) + 8 + 8 + 4];
+    bool ok = fread(header, 1, sizeof(header), in) == sizeof(header) &&
+              memcmp(header, SNAPSHOT_MAGIC, 6) == 0 && header[6] == '0' &&
+              header[7] >= '1' && header[7] <= SNAPSHOT_MAGIC[7];
+    if (ok)
+    {
+        version = static_cast<uint32_t>(header[7] - '0');
+        WalCursor h(header + sizeof(SNAPSHOT_MAGIC), sizeof(header) - sizeof(SNAPSHOT_MAGIC));
+        lsn = h.getU64();
+        uint64_t length = h.getU64();
+        uint32_t crc = h.getU32();
+
+        body.resize(static_cast<size_t>(length));
+        ok = fread(body.data(), 1, body.size(), in) == body.size() &&
+             crc32(body.data(), body.size()) == crc;
+    }
+    fclose(in);
+    return ok;
+}
+
+// Runs one snapshot job at a time on a background thread so bookings are not
+// paused while the snapshot is encoded and written
+class BackgroundSnapshotter
+{
+private:
+    std::thread worker;
+    std::atomic<bool> busy;
+
+public:
+    BackgroundSnapshotter() : busy(false) {}
+
+    ~BackgroundSnapshotter() { wait(); }
+
+    bool isBusy() const { return busy; }
+
+    // Start job unless a previous snapshot is still being written
+    bool start(std::function<void()> job)
+    {
+        if (busy)
+            return false;
+        wait();
+        busy = true;
+        worker = std::thread([this, job]
+                             {
+                                 job();
+                                 busy = false; });
+        return true;
+    }
+
+    void wait()
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+};
+
+#endif
@@ -1,11 +1,17 @@
 
 #include <iostream>
+#include <cmath>
 #include <fstream>
 #include <string>
 #include <unordered_map>
-#include <regex>
 #include <thread> // Required for sleep_for
 #include <chrono> // Required for chrono
+#include "money.h"
+#include "validation.h"
+#include "passwordhash.h"
+#include "userstore.h"
+#include "ratelimit.h"
+#include "userauth.h"
 
 using namespace std;
 
@@ -19,11 +25,11 @@ struct Flight
     string destination;
     string date;
     string time;
-    double fare;
+    Money fare;
     int availableSeats;
 
-    Flight() : flightID(0), fare(0.0), availableSeats(0) {}
-    Flight(int id, string o, string d, string da, string t, double f, int s)
+    Flight() : flightID(0), availableSeats(0) {}
+    Flight(int id, string o, string d, string da, string t, Money f, int s)
         : flightID(id), origin(o), destination(d), date(da), time(t), fare(f), availableSeats(s) {}
 };
 
@@ -71,7 +77,7 @@ private:
     {
         cout << "Flight ID: " << flight.flightID << ", Origin: " << flight.origin
              << ", Destination: " << flight.destination << ", Date: " << flight.date
-             << ", Time: " << flight.time << ", Fare: RS" << flight.fare
+             << ", Time: " << flight.time << ", Fare: " << flight.fare
              << ", Available Seats: " << flight.availableSeats << endl;
     }
 
@@ -137,7 +143,7 @@ public:
     }
 
     // Add flight to the BST with auto-generated ID
-    void addFlight(string origin, string destination, string date, string time, double fare, int seats)
+    void addFlight(string origin, string destination, string date, string time, Money fare, int seats)
     {
         Flight newFlight(flightIDCounter++, origin, destination, date, time, fare, seats);
         insertFlight(newFlight);
@@ -155,7 +161,7 @@ public:
         return bookSeatsHelper(root, flightID, numSeats);
     }
 
-    bool updateFlight(int flightID, const string &newTime, double newFare, int newSeats)
+    bool updateFlight(int flightID, const string &newTime, Money newFare, int newSeats)
     {
         BSTNode *node = root;
         while (node)
@@ -241,8 +247,22 @@ public:
     }
 };
 
+// Read a fare typed by staff, e.g. 18400 or 18400.50, asking again until it parses
+Money readFare()
+{
+    string text;
+    Money fare;
+    cin >> text;
+    while (!parseMoney(text, Currency::PKR, fare) || fare.minor < 0)
+    {
+        cout << "Invalid fare. Please enter an amount such as 18400 or 18400.50: ";
+        cin >> text;
+    }
+    return fare;
+}
+
 // Function to process payment (using the original fare set when adding/updating flights)
-bool processPayment(const string &userName, int fare)
+bool processPayment(const string &userName, const Money &fare)
 {
     string bankName, cardHolder, cardNumber, expiryDate, cvv;
 
@@ -281,7 +301,7 @@ bool processPayment(const string &userName, int fare)
     cout << "Payment successful!\n";
 
     // Save payment history for auditing
-    paymentHistory[userName] = "Paid " + to_string(fare) + " PKR.";
+    paymentHistory[userName] = "Paid " + toString(fare) + ".";
     return true;
 }
 
@@ -318,10 +338,10 @@ void bookFlight(FlightBST &flightBST)
 
         // Use the original fare for payment
         Flight bookedFlight = flightBST.getFlightByID(flightID); // Retrieve the flight details
-        int fare = static_cast<int>(bookedFlight.fare);          // Fare in PKR
+        Money fare = bookedFlight.fare * numSeats;               // One fare per seat
 
         cout << "Proceeding to payment...\n";
-        cout << "Fare for this flight is: " << fare << " PKR.\n";
+        cout << "Fare for this booking is: " << fare << ".\n";
 
         cout << "Are you ready to proceed with payment? (1 for Yes, 0 for No): ";
         int readyForPayment;
@@ -348,9 +368,9 @@ void bookFlight(FlightBST &flightBST)
 // Add default flights
 void addDefaultFlights(FlightBST &flightBST)
 {
-    flightBST.addFlight("Lahore", "Islamabad", "2024-12-15", "08:00", 18400.0, 50);
-    flightBST.addFlight("Islamabad", "Karachi", "2024-12-15", "12:00", 45150.0, 60);
-    flightBST.addFlight("Karachi", "Lahore", "2024-12-15", "16:00", 67120.0, 40);
+    flightBST.addFlight("Lahore", "Islamabad", "2024-12-15", "08:00", Money::fromMajor(18400), 50);
+    flightBST.addFlight("Islamabad", "Karachi", "2024-12-15", "12:00", Money::fromMajor(45150), 60);
+    flightBST.addFlight("Karachi", "Lahore", "2024-12-15", "16:00", Money::fromMajor(67120), 40);
 }
 
 // Main menu for the passenger
@@ -422,7 +442,7 @@ void mainMenuStaff(FlightBST &flightBST)
         case 2:
         {
             string origin, destination, date, time;
-            double fare;
+            Money fare;
             int seats;
 
             cout << "Enter Origin: ";
@@ -439,7 +459,7 @@ void mainMenuStaff(FlightBST &flightBST)
             getline(cin, time);
 
             cout << "Enter Fare: ";
-            cin >> fare;
+            fare = readFare();
 
             cout << "Enter Available Seats: ";
             cin >> seats;
@@ -452,7 +472,7 @@ void mainMenuStaff(FlightBST &flightBST)
         {
             int flightID;
             string newTime;
-            double newFare;
+            Money newFare;
             int newSeats;
 
             cout << "Enter Flight ID to update: ";
@@ -463,7 +483,7 @@ void mainMenuStaff(FlightBST &flightBST)
             getline(cin, newTime);
 
             cout << "Enter new Fare: ";
-            cin >> newFare;
+            newFare = readFare();
 
             cout << "Enter new Available Seats: ";
             cin >> newSeats;
@@ -497,40 +517,13 @@ void mainMenuStaff(FlightBST &flightBST)
 
 void mainMenuAdmin(FlightBST &flightBST) { cout << "hehe"; };
 
-unordered_map<string, pair<string, string>> users; // stores email, password pair
-
-// Function to validate email format (simple regex for basic validation)
-bool isValidEmail(const string &email)
-{
-    regex emailPattern(R"([a-zA-Z0-9._%+-]+@[a-zA0-9.-]+\.[a-zA-Z]{2,})");
-    return regex_match(email, emailPattern);
-}
-
-// Function to validate the password (must be at least 8 characters and include a number)
-bool isValidPassword(const string &password)
-{
-    if (password.length() < 8)
-    {
-        return false;
-    }
-
-    regex passwordPattern(R"((.*\d.*))"); // password must include at least one digit
-    return regex_match(password, passwordPattern);
-}
-
-// Function to hash the password (a simple example for demonstration)
-string hashPassword(const string &password)
-{
-    string hashedPassword = password;
-    for (auto &c : hashedPassword)
-    {
-        c += 1; // simple shift encryption for demo
-    }
-    return hashedPassword;
-}
+UserStore userStore; // accounts, looked up on disk by email
+LoginRateLimiter loginLimiter; // shared with the other programs through the .lim files
+UserAuthenticator authenticator; // password checks at a cost calibrated at startup
+string loginSource = loginSourceName(); // where this run's attempts come from
 
 // Function to authenticate user login
-bool loginUser(string &emailOut, string &nameOut)
+bool loginUser(string &emailOut, string &nameOut, UserRole &roleOut)
 {
     string email, password;
 
@@ -540,28 +533,51 @@ bool loginUser(string &emailOut, string &nameOut)
     cout << "Enter your password: ";
     cin >> password;
 
-    // Check if the email exists in the stored map
-    if (users.find(email) != users.end())
+    // Attempts over the limit are turned away before the password is hashed
+    double retryAfter;
+    if (!loginLimiter.allow(email, loginSource, retryAfter))
     {
-        string hashedPassword = hashPassword(password);
+        cout << "Too many login attempts. Please try again in " << static_cast<long>(ceil(retryAfter))
+             << " seconds.\n";
+        return false;
+    }
 
-        if (users[email].first == hashedPassword)
-        {
-            cout << "Login successful! Welcome, " << users[email].second << "!\n";
+    // Look the email up in the user store
+    UserRecord user;
+    if (authenticator.check(userStore, email, password, user))
+    {
+        loginLimiter.succeeded(email);
+        cout << "Login successful! Welcome, " << userDisplayName(user) << "!\n";
 
-            // Pass the email and name back to the caller
-            emailOut = email;
-            nameOut = users[email].second;
-            return true;
-        }
+        // Pass the email and name back to the caller
+        emailOut = email;
+        nameOut = userDisplayName(user);
+        roleOut = user.role;
+        return true;
     }
 
     cout << "Login failed! Incorrect email or password.\n";
     return false;
 }
 
+// Open the menu for role, if the user's own role has access to it
+void openRoleMenu(FlightBST &flightBST, UserRole role, UserRole userRole)
+{
+    if (!(rolePermissions(userRole) & roleMenuPermission(role)))
+    {
+        cout << "Your account does not have access to this menu.\n";
+        return;
+    }
+    if (role == UserRole::Passenger)
+        mainMenuPassenger(flightBST);
+    else if (role == UserRole::Staff)
+        mainMenuStaff(flightBST);
+    else if (role == UserRole::Admin)
+        mainMenuAdmin(flightBST);
+}
+
 // Function to register a new user
-void registerUser(FlightBST &flightBST, const string &role)
+void registerUser(FlightBST &flightBST, UserRole role)
 {
     string name, email, password;
 
@@ -573,64 +589,54 @@ void registerUser(FlightBST &flightBST, const string &role)
     cout << "Enter your email: ";
     cin >> email;
 
-    // Validate email format
-    while (!isValidEmail(email))
+    // Validate email format, and that no account uses it yet
+    while (true)
     {
-        cout << "Invalid email format. Please enter a valid email: ";
+        if (!isValidEmail(email))
+            cout << "Invalid email format. Please enter a valid email: ";
+        else if (userStore.contains(email))
+            cout << "An account with this email already exists. Please enter another email: ";
+        else
+            break;
         cin >> email;
     }
 
     // Ask for password and validate it
-    do
+    while (true)
     {
         cout << "Enter your password (must be at least 8 characters and include a number): ";
         cin >> password;
 
-        if (!isValidPassword(password))
-        {
-            cout << "Password does not meet the requirements. Please try again.\n";
-        }
-
-    } while (!isValidPassword(password));
+        if (isValidPassword(password))
+            break;
+        cout << "Password does not meet the requirements. Please try again.\n";
+    }
 
     // Hash the password before storing
-    string hashedPassword = hashPassword(password);
-
-    // Store the user details with role
-    users[email] = {hashedPassword, name + ":" + role};
+    string hashedPassword = authenticator.hash(password);
 
-    // Write to file to persist data
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open())
+    // Store the user details with role, unless the email was taken meanwhile
+    UserInsert added = userStore.insert({email, hashedPassword, name, role});
+    if (added == UserInsert::Added)
     {
-        outFile << email << " " << hashedPassword << " " << name << " " << role << endl;
-        outFile.close();
-        cout << "Registration successful as " << role << "!\n";
+        cout << "Registration successful as " << roleName(role) << "!\n";
     }
     else
     {
-        cout << "Error writing to file.\n";
+        cout << (added == UserInsert::Exists ? "An account with this email already exists.\n" : "Error writing to file.\n");
+        return;
     }
 
-    // After registration, prompt to login or exit
+    // The password was just checked, so the new user is logged in already
     int choice;
-    cout << "Do you want to login now?\n";
-    cout << "1. Login\n2. Exit\n";
+    cout << "Do you want to continue to the menu now?\n";
+    cout << "1. Continue\n2. Exit\n";
     cout << "Enter your choice: ";
     cin >> choice;
 
     if (choice == 1)
     {
-        string emailOut, nameOut;
-        if (loginUser(emailOut, nameOut))
-        {
-            if (role == "Passenger")
-                mainMenuPassenger(flightBST);
-            else if (role == "Airline Staff")
-                mainMenuStaff(flightBST);
-            else if (role == "Admin")
-                mainMenuAdmin(flightBST);
-        }
+        openRoleMenu(flightBST, role, role);
     }
     else
     {
@@ -654,13 +660,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Passenger");
+            registerUser(flightBST, UserRole::Passenger);
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuPassenger(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Passenger, roleOut);
         }
     }
     else if (roleChoice == "2")
@@ -671,13 +678,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Airline Staff");
+            cout << "Airline Staff accounts are created by an admin. Please log in instead.\n";
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuStaff(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Staff, roleOut);
         }
     }
     else if (roleChoice == "3")
@@ -688,13 +696,14 @@ void mainMenu(FlightBST &flightBST)
 
         if (subChoice == "1")
         {
-            registerUser(flightBST, "Admin");
+            cout << "Admin accounts are created by an admin. Please log in instead.\n";
         }
         else if (subChoice == "2")
         {
             string emailOut, nameOut;
-            if (loginUser(emailOut, nameOut))
-                mainMenuAdmin(flightBST);
+            UserRole roleOut;
+            if (loginUser(emailOut, nameOut, roleOut))
+                openRoleMenu(flightBST, UserRole::Admin, roleOut);
         }
     }
     else
@@ -710,16 +719,16 @@ int main()
     addDefaultFlights(flightBST);
 
     // Load the users from file into the map (for persistent storage)
-    ifstream inFile("users.txt");
-    if (inFile.is_open())
-    {
-        string email, password, name;
-        while (inFile >> email >> password >> name)
-        {
-            users[email] = {password, name}; // Load stored user data
-        }
-        inFile.close();
-    }
+    UserFileLoad userFile;
+    if (!openUserStore(userStore, userFile))
+        cout << "Warning: could not open the user store, new users will not be saved.\n";
+    for (size_t i = 0; i < userFile.errors.size() && i < 5; ++i)
+        cout << "Warning: users.txt line " << userFile.errors[i].line << " skipped: " << userFile.errors[i].reason << "\n";
+    if (userFile.errors.size() > 5)
+        cout << "Warning: " << userFile.errors.size() - 5 << " more malformed lines in users.txt skipped.\n";
+    if (!loginLimiter.open(LOGIN_ACCOUNT_LIMIT_FILE, LOGIN_SOURCE_LIMIT_FILE))
+        cout << "Warning: could not open the login limit files, limits will reset on restart.\n";
+    authenticator.start(1, chrono::milliseconds(KDF_TARGET_MS));
 
     // Display the main menu
     mainMenu(flightBST);
@@ -0,0 +1,57 @@
+// Password checks for login and registration
+//
+// Every program checks logins the same way. The password is verified on
+// the hashing threads at the cost calibrated when the program started.
+// An email that is not in the store is verified against a hash of the
+// empty password, so it takes as long as a wrong password and the timing
+// does not tell which accounts exist. After a successful login, an
+// old-scheme hash or one cheaper than the current cost is replaced with a
+// fresh hash at that cost. New passwords are hashed at the same cost.
+
+#ifndef USERAUTH_H
+#define USERAUTH_H
+
+#include <cstddef>
+#include <string>
+#include <chrono>
+#include "passwordhash.h"
+#include "userstore.h"
+
+const long KDF_TARGET_MS = 100; // default time for one password hash
+
+class UserAuthenticator
+{
+private:
+    PasswordVerifier verifier;
+    std::string unknownUserRecord; // checked for unknown emails
+
+public:
+    // Calibrate the KDF to take about target per hash and start the threads
+    void start(size_t workerCount, std::chrono::milliseconds target)
+    {
+        verifier.start(workerCount, calibrateKdfIterations(target));
+        unknownUserRecord = verifier.hash("").get();
+    }
+
+    uint32_t cost() const { return verifier.cost(); }
+
+    std::string hash(const std::string &password) { return verifier.hash(password).get(); }
+
+    // True if email is in the store with this password; user is then filled in
+    bool check(UserStore &store, const std::string &email, const std::string &password, UserRecord &user)
+    {
+        bool known = store.find(email, user);
+        if (!verifier.verify(password, known ? user.password : unknownUserRecord).get() || !known)
+            return false;
+
+        // Move old-scheme and cheaper hashes up to the current cost
+        if (passwordNeedsRehash(user.password, verifier.cost()))
+        {
+            user.password = hash(password);
+            store.put(user);
+        }
+        return true;
+    }
+};
+
+#endif
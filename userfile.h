@@ -0,0 +1,339 @@
+// Loader for users.txt
+//
+// Each line is "email password name role": the email and password are
+// single tokens, the name may contain spaces, and the role is one of
+// Passenger, Airline Staff or Admin at the end of the line. Older lines
+// may have no role at all, and some use "staff" or lower case. The file
+// is memory-mapped and cut into chunks at line breaks, and the chunks are
+// parsed on separate threads. Records come back in file order, so when an
+// email appears more than once the last line wins. Lines that cannot be
+// parsed are returned with their line number and a reason rather than
+// being half-loaded.
+
+#ifndef USERFILE_H
+#define USERFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "validation.h"
+#include "roles.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct UserRecord
+{
+    std::string email;
+    std::string password; // as stored, see passwordhash.h
+    std::string name;
+    UserRole role = UserRole::None; // None if the line had none
+};
+
+struct UserFileError
+{
+    size_t line; // 1-based
+    std::string reason;
+    std::string text;
+};
+
+struct UserFileLoad
+{
+    std::vector<UserFileError> errors; // in file order
+    size_t records; // distinct emails loaded
+    size_t lines;
+    size_t threads;
+    double seconds;
+
+    UserFileLoad() : records(0), lines(0), threads(0), seconds(0) {}
+};
+
+// Read-only mapping of a whole file; empty if it is missing or empty. The
+// file may be open for writing elsewhere, as users.db is while it is compacted.
+class MappedTextFile
+{
+private:
+    const char *base;
+    size_t size;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#endif
+
+public:
+#ifdef _WIN32
+    MappedTextFile() : base(nullptr), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {}
+#else
+    MappedTextFile() : base(nullptr), size(0) {}
+#endif
+    MappedTextFile(const MappedTextFile &) = delete;
+    MappedTextFile &operator=(const MappedTextFile &) = delete;
+    ~MappedTextFile() { close(); }
+
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle)
+            base = static_cast<const char *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size = static_cast<size_t>(st.st_size);
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                base = static_cast<const char *>(mapped);
+                madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!base)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (base)
+            munmap(const_cast<char *>(base), size);
+#endif
+        base = nullptr;
+        size = 0;
+    }
+
+    const char *data() const { return base; }
+    size_t length() const { return size; }
+};
+
+inline bool isLineSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Parse one line without its '\n'. Returns false with a reason if it is
+// malformed; a blank line parses to an empty email and is skipped.
+inline bool parseUserLine(const char *begin, const char *end, UserRecord &out, const char *&reason)
+{
+    while (end > begin && isLineSpace(end[-1]))
+        --end;
+    auto token = [&begin, end]()
+    {
+        while (begin < end && isLineSpace(*begin))
+            ++begin;
+        const char *start = begin;
+        while (begin < end && !isLineSpace(*begin))
+            ++begin;
+        return std::string(start, begin);
+    };
+
+    out.email = token();
+    if (out.email.empty())
+        return true;
+    out.password = token();
+    while (begin < end && isLineSpace(*begin))
+        ++begin;
+    if (out.password.empty() || begin == end)
+    {
+        reason = "missing fields, expected email password name [role]";
+        return false;
+    }
+    if (!isValidEmail(out.email))
+    {
+        reason = "invalid email";
+        return false;
+    }
+
+    // The role is the last word, or the last two for "Airline Staff", as
+    // long as a name is left in front of it
+    out.role = UserRole::None;
+    const char *nameEnd = end;
+    const char *lastWord = end;
+    while (lastWord > begin && !isLineSpace(lastWord[-1]))
+        --lastWord;
+    if (lastWord > begin)
+    {
+        const char *previousWord = lastWord - 1;
+        while (previousWord > begin && !isLineSpace(previousWord[-1]))
+            --previousWord;
+        if (previousWord > begin && parseRole(previousWord, end - previousWord, out.role))
+            nameEnd = previousWord;
+        else if (parseRole(lastWord, end - lastWord, out.role))
+            nameEnd = lastWord;
+    }
+    while (nameEnd > begin && isLineSpace(nameEnd[-1]))
+        --nameEnd;
+    out.name.assign(begin, nameEnd);
+    return true;
+}
+
+typedef std::unordered_map<std::string, UserRecord> UserMap; // by email
+
+// "name:role", or just the name for users without a role
+inline std::string userDisplayName(const UserRecord &record)
+{
+    if (record.role == UserRole::None)
+        return record.name;
+    return record.name + ":" + roleName(record.role);
+}
+
+// Cut [data, data + size) into at most count pieces of at least
+// minimumChunk bytes each, every one ending at a line break
+inline std::vector<std::pair<const char *, const char *>> splitAtLines(const char *data, size_t size, size_t count,
+                                                                       size_t minimumChunk = 1 << 20)
+{
+    count = std::max<size_t>(1, std::min(count, size / minimumChunk));
+    std::vector<std::pair<const char *, const char *>> pieces;
+    const char *end = data + size;
+    const char *position = data;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *pieceEnd = i + 1 == count ? end : data + size / count * (i + 1);
+        if (pieceEnd < position)
+            pieceEnd = position;
+        const char *newline = pieceEnd < end ? static_cast<const char *>(memchr(pieceEnd, '\n', end - pieceEnd)) : nullptr;
+        pieceEnd = newline ? newline + 1 : end;
+        pieces.emplace_back(position, pieceEnd);
+        position = pieceEnd;
+    }
+    return pieces;
+}
+
+struct UserFileChunk
+{
+    const char *begin;
+    const char *end;
+    UserMap users;
+    std::vector<UserFileError> errors; // line numbers relative to the chunk until merged
+    size_t lines;
+};
+
+inline void parseUserChunk(UserFileChunk &chunk)
+{
+    size_t lineCount = 0;
+    for (const char *p = chunk.begin; (p = static_cast<const char *>(memchr(p, '\n', chunk.end - p))); ++p)
+        lineCount++;
+    chunk.users.reserve(lineCount + 1);
+
+    chunk.lines = 0;
+    UserRecord record;
+    for (const char *line = chunk.begin; line < chunk.end;)
+    {
+        const char *newline = static_cast<const char *>(memchr(line, '\n', chunk.end - line));
+        const char *lineEnd = newline ? newline : chunk.end;
+        chunk.lines++;
+        const char *reason = nullptr;
+        if (!parseUserLine(line, lineEnd, record, reason))
+            chunk.errors.push_back({chunk.lines, reason, std::string(line, lineEnd)});
+        else if (!record.email.empty())
+        {
+            std::string email = record.email;
+            chunk.users.insert_or_assign(std::move(email), std::move(record));
+        }
+        line = lineEnd + 1;
+    }
+}
+
+// Load path into users, replacing entries for emails it contains. Each
+// chunk is parsed into its own map on its own thread, so the strings and
+// nodes are allocated in parallel; the maps are then spliced into users
+// from the last chunk to the first, so a later line for an email beats an
+// earlier one.
+inline UserFileLoad loadUserFile(const std::string &path, UserMap &users, size_t threadCount = 0)
+{
+    auto start = std::chrono::steady_clock::now();
+    UserFileLoad load;
+    MappedTextFile file;
+    if (!file.open(path))
+        return load;
+
+    // Cut into chunks of at least 1 MB that end at line breaks
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto pieces = splitAtLines(file.data(), file.length(), threadCount);
+    std::vector<UserFileChunk> chunks(pieces.size());
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        chunks[i].begin = pieces[i].first;
+        chunks[i].end = pieces[i].second;
+    }
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < chunks.size(); ++i)
+        pool.emplace_back(parseUserChunk, std::ref(chunks[i]));
+    parseUserChunk(chunks[0]);
+    for (std::thread &thread : pool)
+        thread.join();
+
+    size_t recordCount = 0;
+    for (const UserFileChunk &chunk : chunks)
+        recordCount += chunk.users.size();
+    users.reserve(users.size() + recordCount);
+
+    // merge() keeps the destination's entry on a clash, so the file's
+    // entries are taken out of users first and the chunks go in last to first
+    if (!users.empty())
+        for (UserFileChunk &chunk : chunks)
+            for (const auto &user : chunk.users)
+                users.erase(user.first);
+    size_t before = users.size();
+    for (size_t i = chunks.size(); i-- > 0;)
+        users.merge(chunks[i].users);
+    for (UserFileChunk &chunk : chunks)
+    {
+        for (UserFileError &error : chunk.errors)
+        {
+            error.line += load.lines;
+            load.errors.push_back(std::move(error));
+        }
+        load.lines += chunk.lines;
+    }
+    load.records = users.size() - before;
+    load.threads = chunks.size();
+    load.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return load;
+}
+
+#endif
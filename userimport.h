@@ -0,0 +1,241 @@
+// Bulk import and export of accounts
+//
+// An import file has the users.txt layout, one account per line:
+// "email password name role". The password is either a stored hash as an
+// export writes it (pbkdf2-sha256$...), which is kept as it is if its
+// iteration count is at least KDF_MIN_ITERATIONS, or a plain password,
+// which must meet the password rules and is hashed here. Like
+// users.txt the file is mapped and cut into chunks at line breaks, and
+// each chunk is parsed, checked and hashed on its own thread. Emails that
+// already have an account are ruled out on those threads too, mostly by
+// the store's filter, before any hashing is spent on them.
+//
+// Plain passwords are hashed at KDF_MIN_ITERATIONS rather than the
+// calibrated cost: at the full cost 200k of them would take hours of CPU.
+// passwordNeedsRehash() lifts each one to the full cost at its first
+// login. The accepted rows are then added in one batched append, so the
+// records, the header and the index are each synced once for the lot.
+//
+// An export streams every account to a file in the same layout, stored
+// hashes included, through a temp file that is synced and renamed into
+// place, so a file that exists is always complete, and readable only by
+// its owner. Accounts still on the old shift-encoded passwords are written
+// with a "legacy$" prefix. An import undoes the shift and treats the
+// password as a plain one, so those accounts come back hashed, and a row
+// cannot use the prefix to store a password the rules would refuse.
+
+#ifndef USERIMPORT_H
+#define USERIMPORT_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "userfile.h"
+#include "userstore.h"
+#include "passwordhash.h"
+#include "validation.h"
+#include "wal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char LEGACY_PASSWORD_PREFIX[] = "legacy$";
+
+struct UserImport
+{
+    bool opened;
+    std::vector<UserFileError> errors; // rows skipped, in file order
+    size_t added;
+    size_t hashed; // plain passwords hashed during the import
+    size_t lines;
+    size_t threads;
+    double seconds;
+
+    UserImport() : opened(false), added(0), hashed(0), lines(0), threads(0), seconds(0) {}
+};
+
+struct UserImportChunk
+{
+    const char *begin;
+    const char *end;
+    std::vector<UserRecord> users;
+    std::vector<size_t> userLines; // line of each user, relative to the chunk until merged
+    std::vector<UserFileError> errors;
+    size_t lines;
+    size_t hashed;
+};
+
+inline void importUserChunk(UserImportChunk &chunk, const UserStore &store)
+{
+    chunk.lines = 0;
+    chunk.hashed = 0;
+    UserRecord record;
+    StoredPassword stored;
+    for (const char *line = chunk.begin; line < chunk.end;)
+    {
+        const char *newline = static_cast<const char *>(memchr(line, '\n', chunk.end - line));
+        const char *lineEnd = newline ? newline : chunk.end;
+        chunk.lines++;
+        const char *reason = nullptr;
+        if (parseUserLine(line, lineEnd, record, reason) && !record.email.empty())
+        {
+            bool legacy =
+                record.password.compare(0, sizeof(LEGACY_PASSWORD_PREFIX) - 1, LEGACY_PASSWORD_PREFIX) == 0;
+            if (legacy)
+                record.password = legacyUnhashPassword(record.password.substr(sizeof(LEGACY_PASSWORD_PREFIX) - 1));
+            if (store.contains(record.email))
+                reason = "an account with this email already exists";
+            else if (!legacy && isKdfRecord(record.password))
+            {
+                if (!parseStoredPassword(record.password, stored))
+                    reason = "stored password is malformed or its iteration count is too high";
+                else if (stored.iterations < KDF_MIN_ITERATIONS)
+                    reason = "stored password's iteration count is below the minimum";
+            }
+            else if (!isValidPassword(record.password))
+                reason = "password does not meet the requirements";
+            else
+            {
+                record.password = hashPassword(record.password, KDF_MIN_ITERATIONS);
+                chunk.hashed++;
+            }
+            if (!reason)
+            {
+                chunk.users.push_back(std::move(record));
+                chunk.userLines.push_back(chunk.lines);
+            }
+        }
+        if (reason)
+            chunk.errors.push_back({chunk.lines, reason, std::string(line, lineEnd)});
+        line = lineEnd + 1;
+    }
+}
+
+// Add the accounts in path to store. When an email appears more than once
+// the last line wins and the earlier ones are reported.
+inline UserImport importUsers(UserStore &store, const std::string &path, size_t threadCount = 0)
+{
+    auto start = std::chrono::steady_clock::now();
+    UserImport report;
+    MappedTextFile file;
+    if (!file.open(path))
+        return report;
+    report.opened = true;
+    store.refresh(); // the chunks check for existing accounts without it
+
+    // Hashing dominates, so chunks can be much smaller than for users.txt
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto pieces = splitAtLines(file.data(), file.length(), threadCount, 4096);
+    std::vector<UserImportChunk> chunks(pieces.size());
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        chunks[i].begin = pieces[i].first;
+        chunks[i].end = pieces[i].second;
+    }
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < chunks.size(); ++i)
+        pool.emplace_back(importUserChunk, std::ref(chunks[i]), std::cref(store));
+    importUserChunk(chunks[0], store);
+    for (std::thread &thread : pool)
+        thread.join();
+
+    // Put the chunks back in file order, keeping the last row for each email
+    std::vector<UserRecord> users;
+    std::vector<size_t> userLines;
+    std::unordered_map<std::string, size_t> latest; // email to its row in users
+    for (UserImportChunk &chunk : chunks)
+    {
+        for (UserFileError &error : chunk.errors)
+        {
+            error.line += report.lines;
+            report.errors.push_back(std::move(error));
+        }
+        for (size_t i = 0; i < chunk.users.size(); ++i)
+        {
+            size_t line = chunk.userLines[i] + report.lines;
+            auto found = latest.find(chunk.users[i].email);
+            if (found != latest.end())
+            {
+                report.errors.push_back({userLines[found->second], "email repeated later in the file",
+                                         users[found->second].email});
+                users[found->second] = std::move(chunk.users[i]);
+                userLines[found->second] = line;
+                continue;
+            }
+            latest.emplace(chunk.users[i].email, users.size());
+            users.push_back(std::move(chunk.users[i]));
+            userLines.push_back(line);
+        }
+        report.lines += chunk.lines;
+        report.hashed += chunk.hashed;
+    }
+    std::stable_sort(report.errors.begin(), report.errors.end(),
+                     [](const UserFileError &a, const UserFileError &b)
+                     { return a.line < b.line; });
+
+    if (store.putMany(users))
+        report.added = users.size();
+    else
+        report.errors.push_back({0, "could not write to the user store", ""});
+    report.threads = chunks.size();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+// Write every account in store to path; count is set to how many
+inline bool exportUsers(UserStore &store, const std::string &path, size_t &count)
+{
+    count = 0;
+    store.refresh();
+    std::string tempPath = path + ".tmp";
+#ifdef _WIN32
+    FILE *out = fopen(tempPath.c_str(), "wb");
+#else
+    // The file holds every password hash, so only the owner may read it;
+    // an old temp file is removed first so its mode is not kept
+    std::remove(tempPath.c_str());
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    FILE *out = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+    if (!out && fd >= 0)
+        ::close(fd);
+#endif
+    if (!out)
+        return false;
+    std::vector<char> buffer(1 << 20);
+    setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+    std::string line;
+    StoredPassword stored;
+    store.forEach([&](const UserRecord &user)
+                  {
+                      line.assign(user.email).append(1, ' ');
+                      if (!parseStoredPassword(user.password, stored))
+                          line.append(LEGACY_PASSWORD_PREFIX);
+                      line.append(user.password).append(1, ' ').append(user.name);
+                      if (user.role != UserRole::None)
+                          line.append(1, ' ').append(roleName(user.role));
+                      line.append(1, '\n');
+                      fwrite(line.data(), 1, line.size(), out);
+                      count++; });
+
+    bool ok = fflush(out) == 0 && !ferror(out) && syncFile(out);
+    fclose(out);
+    if (!ok)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename does not replace on Windows
+#endif
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+#endif
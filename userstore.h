@@ -0,0 +1,1241 @@
+// Persistent user store: a file of user records and an on-disk hash index
+//
+// users.db holds the records after a 64 byte header, one per registration
+// or change:
+//   u32 length | u32 crc32 | u8 kind | u8 role length | u16 email length |
+//   u16 password length | u16 name length | email | password | name | role
+// padded to 8 bytes. The role is kept by name, as users.txt has it, and
+// read back as a UserRole. The crc covers everything after itself. Records are
+// only appended; changing a user writes a new record, and removing one
+// writes a tombstone.
+//
+// users.idx is an open-addressing hash table over the live records, keyed
+// by email: 16 byte slots of (email hash, record offset), probed linearly.
+// A login hashes the email and reads a slot and a record, both through
+// memory maps, so opening the store does not read the users and only the
+// pages that are used become resident. The index notes how far into
+// users.db it reaches; records past that point are indexed at open, and
+// an index that is missing or belongs to another users.db is rebuilt from
+// the records.
+//
+// After the slots users.idx holds a Bloom filter over the emails, one byte
+// per slot (at least 11 bits per live user, 7 probes, under 0.5% false
+// positives). At about a fortieth the size of the slots it stays resident,
+// so asking for an email nobody has, as every registration does, is
+// answered without touching the slots or the records; a possible match is
+// confirmed by probing the index as before. The filter is set from the
+// email hashes the slots already keep, so growing or rebuilding the index
+// never reads the records for it. Removed users stay in the filter until
+// the index is next rebuilt, which only costs a probe.
+//
+// Every change is synced record first, then the index, so a crash leaves
+// at most records the index has not caught up with yet.
+//
+// Every program opens the same two files, so changes take an exclusive lock
+// on users.db (flock, or LockFileEx on Windows) and first catch up with what
+// other processes did: users.db is remapped if it has grown past this
+// process's mapping, users.idx is reopened if it was rebuilt, and records
+// appended since are indexed. A rebuild zeroes the covered mark of the
+// index it replaces, which is how other processes notice. Lookups take no
+// lock. They see the files as of the last change or refresh(), and records
+// past the end of the mapping are skipped rather than read.
+//
+// Replaced and removed users leave dead records behind. Once they outnumber
+// the live ones, a background thread copies the live records into
+// users.db.compact with a fresh index, and the next change copies over
+// whatever was appended meanwhile and renames the new files into place.
+// users.db therefore stays within about twice the live records, which
+// bounds the work of rebuilding a lost index at startup however many
+// changes have been made.
+//
+// Renaming new files into place would leave other processes working on the
+// old ones, so compaction only runs while no other process has the store
+// open. Each open store holds a read lock on users.db.lock, and compaction
+// starts only if that can become a write lock, which it keeps until the
+// new files are in place; a program opening the store meanwhile waits.
+// While several programs share the store, dead records simply build up
+// until one of them is left on its own.
+
+#ifndef USERSTORE_H
+#define USERSTORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include "wal.h"
+#include "snapshot.h"
+#include "userfile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char USER_DATA_MAGIC[8] = {'G', 'K', 'U', 'S', 'E', 'R', 'S', 0};
+const char USER_INDEX_MAGIC[8] = {'G', 'K', 'U', 'I', 'D', 'X', 0, 0};
+const uint32_t USER_STORE_VERSION = 1;
+const uint32_t USER_INDEX_VERSION = 2; // 2 added the email filter
+const unsigned USER_FILTER_PROBES = 7;
+
+struct UserDataHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t compactions; // times the live records were copied into a new file
+    uint64_t generation;  // random, shared with the index built for this file
+    uint64_t end;        // bytes in use, header included
+    uint64_t records;     // records in the file, tombstones included
+    uint8_t padding[24];
+};
+
+struct UserIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation; // of the users.db this indexes
+    uint64_t covered;    // users.db offset up to which records are indexed
+    uint64_t slotCount;  // power of two
+    uint64_t live;
+    uint64_t deleted; // slots holding a deleted marker
+    uint8_t padding[8];
+};
+
+struct UserIndexSlot
+{
+    uint64_t hash; // 0 empty, 1 deleted, otherwise the email hash
+    uint64_t offset;
+};
+
+enum class UserRecordKind : uint8_t
+{
+    Upsert = 1,
+    Tombstone = 2
+};
+
+// Outcome of UserStore::insert
+enum class UserInsert
+{
+    Added,
+    Exists, // another account has the email, possibly registered by another program meanwhile
+    Failed
+};
+
+struct UserRecordHeader
+{
+    uint32_t length; // whole record, padding included
+    uint32_t crc;
+    UserRecordKind kind;
+    uint8_t roleLength;
+    uint16_t emailLength;
+    uint16_t passwordLength;
+    uint16_t nameLength;
+};
+
+static_assert(sizeof(UserDataHeader) == 64, "users.db header layout");
+static_assert(sizeof(UserIndexHeader) == 64, "users.idx header layout");
+static_assert(sizeof(UserIndexSlot) == 16, "users.idx slot layout");
+static_assert(sizeof(UserRecordHeader) == 16, "users.db record layout");
+
+const uint64_t USER_SLOT_EMPTY = 0;
+const uint64_t USER_SLOT_DELETED = 1;
+
+#ifdef _WIN32
+typedef HANDLE NativeFile;
+#else
+typedef int NativeFile;
+#endif
+
+// Lock a whole open file against other processes, waiting for it if wait
+inline bool lockNativeFile(NativeFile file, bool exclusive, bool wait)
+{
+#ifdef _WIN32
+    OVERLAPPED whole = {};
+    DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+    return LockFileEx(file, flags, 0, MAXDWORD, MAXDWORD, &whole) != 0;
+#else
+    int operation = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+    int result;
+    while ((result = flock(file, operation)) != 0 && errno == EINTR)
+        ;
+    return result == 0;
+#endif
+}
+
+inline void unlockNativeFile(NativeFile file)
+{
+#ifdef _WIN32
+    OVERLAPPED whole = {};
+    UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &whole);
+#else
+    flock(file, LOCK_UN);
+#endif
+}
+
+// Read-write shared mapping of a whole file that can be grown
+class WritableMapping
+{
+private:
+    uint8_t *base;
+    size_t size;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fd;
+#endif
+
+    bool map()
+    {
+#ifdef _WIN32
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+        if (mappingHandle)
+            base = static_cast<uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+#else
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            base = static_cast<uint8_t *>(mapped);
+            madvise(mapped, size, MADV_RANDOM); // lookups jump around: map only the pages touched
+        }
+#endif
+        return base != nullptr;
+    }
+
+    void unmap()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+#else
+        if (base)
+            munmap(base, size);
+#endif
+        base = nullptr;
+    }
+
+    bool setFileSize(size_t newSize)
+    {
+#ifdef _WIN32
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(newSize);
+        return SetFilePointerEx(fileHandle, position, nullptr, FILE_BEGIN) && SetEndOfFile(fileHandle);
+#else
+        return ftruncate(fd, static_cast<off_t>(newSize)) == 0;
+#endif
+    }
+
+public:
+#ifdef _WIN32
+    WritableMapping() : base(nullptr), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {}
+#else
+    WritableMapping() : base(nullptr), size(0), fd(-1) {}
+#endif
+    WritableMapping(const WritableMapping &) = delete;
+    WritableMapping &operator=(const WritableMapping &) = delete;
+    ~WritableMapping() { close(); }
+
+    // Open or create path without mapping it yet, so it can be locked first
+    bool openFile(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+        return fileHandle != INVALID_HANDLE_VALUE;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        return fd >= 0;
+#endif
+    }
+
+    // Map the open file as it is now, growing it to at least minimumSize.
+    // fresh is set if it was empty.
+    bool mapAtLeast(size_t minimumSize, bool &fresh)
+    {
+        unmap();
+        size_t existing = 0;
+#ifdef _WIN32
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(fileHandle, &fileSize))
+            existing = static_cast<size_t>(fileSize.QuadPart);
+#else
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            existing = static_cast<size_t>(st.st_size);
+#endif
+        fresh = existing == 0;
+        size = std::max(existing, minimumSize);
+        return (size == existing || setFileSize(size)) && map();
+    }
+
+    // Open or create path, growing it to at least minimumSize. fresh is set
+    // if the file had to be created or was empty.
+    bool open(const std::string &path, size_t minimumSize, bool &fresh)
+    {
+        if (!openFile(path) || !mapAtLeast(minimumSize, fresh))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Map the file again at its current size, after another process grew it
+    bool remap()
+    {
+        bool fresh;
+        return mapAtLeast(0, fresh);
+    }
+
+    bool lock() { return lockNativeFile(nativeFile(), true, true); }
+
+    void unlock() { unlockNativeFile(nativeFile()); }
+
+    bool resize(size_t newSize)
+    {
+        unmap();
+        if (setFileSize(newSize))
+            size = newSize;
+        return map();
+    }
+
+    // Write [offset, offset + length) to disk before returning
+    bool sync(size_t offset, size_t length)
+    {
+        if (!base || length == 0)
+            return base != nullptr;
+#ifdef _WIN32
+        return FlushViewOfFile(base + offset, length) && FlushFileBuffers(fileHandle);
+#else
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t start = offset / page * page;
+        return msync(base + start, offset + length - start, MS_SYNC) == 0;
+#endif
+    }
+
+    void close()
+    {
+        unmap();
+#ifdef _WIN32
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        size = 0;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+    uint8_t *data() const { return base; }
+    size_t length() const { return size; }
+
+#ifdef _WIN32
+    NativeFile nativeFile() const { return fileHandle; }
+#else
+    NativeFile nativeFile() const { return fd; }
+#endif
+};
+
+// The read lock on users.db.lock that says a process has the store open.
+// It uses fcntl rather than flock, because only fcntl turns a read lock into
+// a write lock without dropping it first. Windows does not let a second
+// process open users.db while one has it, so there the store is always
+// held alone and nothing is locked.
+class StoreUseLock
+{
+private:
+#ifndef _WIN32
+    int fd;
+
+    bool set(short type, bool wait)
+    {
+        struct flock whole = {};
+        whole.l_type = type;
+        whole.l_whence = SEEK_SET;
+        int result;
+        while ((result = fcntl(fd, wait ? F_SETLKW : F_SETLK, &whole)) != 0 && errno == EINTR)
+            ;
+        return result == 0;
+    }
+#endif
+
+public:
+#ifdef _WIN32
+    StoreUseLock() {}
+#else
+    StoreUseLock() : fd(-1) {}
+#endif
+    StoreUseLock(const StoreUseLock &) = delete;
+    StoreUseLock &operator=(const StoreUseLock &) = delete;
+    ~StoreUseLock() { close(); }
+
+    // Create path if needed and take the read lock, waiting while another
+    // process compacts
+    bool open(const std::string &path)
+    {
+#ifdef _WIN32
+        (void)path;
+        return true;
+#else
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0 && set(F_RDLCK, true))
+            return true;
+        close();
+        return false;
+#endif
+    }
+
+    // Whether the lock became a write lock, i.e. no other process has the store open
+    bool tryExclusive()
+    {
+#ifdef _WIN32
+        return true;
+#else
+        return fd >= 0 && set(F_WRLCK, false);
+#endif
+    }
+
+    void share()
+    {
+#ifndef _WIN32
+        if (fd >= 0)
+            set(F_RDLCK, false);
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+    }
+};
+
+// FNV-1a over the email, kept clear of the empty and deleted markers
+inline uint64_t userEmailHash(const char *email, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(email[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash < 2 ? hash + 2 : hash;
+}
+
+class UserStore
+{
+private:
+    WritableMapping data;
+    WritableMapping index;
+    StoreUseLock inUse;
+    std::string dataPath;
+    std::string indexPath;
+    BackgroundSnapshotter compactor;
+    std::shared_ptr<bool> compactionResult; // set while a compaction is running or waiting to be installed
+    uint64_t compactedEnd;                  // users.db offset the compaction copies up to
+    uint64_t compactionRetryAt;             // record count before which a failed compaction is not retried
+
+    static const size_t INITIAL_DATA_SIZE = 64 << 10;
+    static const size_t INITIAL_SLOTS = 1024;
+    static const uint64_t COMPACTION_MIN_RECORDS = 1024;
+
+    UserDataHeader *dataHeader() const { return reinterpret_cast<UserDataHeader *>(data.data()); }
+    UserIndexHeader *indexHeader() const { return reinterpret_cast<UserIndexHeader *>(index.data()); }
+    UserIndexSlot *slots() const { return reinterpret_cast<UserIndexSlot *>(index.data() + sizeof(UserIndexHeader)); }
+
+    static size_t padded(size_t length) { return (length + 7) & ~static_cast<size_t>(7); }
+
+    // Header, slots, then one filter byte per slot
+    static size_t indexFileSize(uint64_t slotCount)
+    {
+        return sizeof(UserIndexHeader) + slotCount * (sizeof(UserIndexSlot) + 1);
+    }
+
+    uint8_t *filter() const { return reinterpret_cast<uint8_t *>(slots() + indexHeader()->slotCount); }
+
+    // Filter bit positions come from the email hash by double hashing; it is
+    // remixed first because the slot position already uses its low bits
+    template <typename Visit>
+    void filterBits(uint64_t hash, Visit visit) const
+    {
+        uint64_t mixed = (hash ^ (hash >> 31)) * 0x9e3779b97f4a7c15ULL;
+        uint64_t step = (mixed >> 32) | 1;
+        uint64_t mask = indexHeader()->slotCount * 8 - 1;
+        for (unsigned i = 0; i < USER_FILTER_PROBES; ++i, mixed += step)
+            if (!visit(mixed & mask))
+                return;
+    }
+
+    void filterAdd(uint64_t hash)
+    {
+        uint8_t *bits = filter();
+        filterBits(hash, [bits](uint64_t bit)
+                   {
+                       bits[bit >> 3] |= static_cast<uint8_t>(1u << (bit & 7));
+                       return true; });
+    }
+
+    // False only if no user has this email hash
+    bool filterMayContain(uint64_t hash) const
+    {
+        const uint8_t *bits = filter();
+        bool present = true;
+        filterBits(hash, [bits, &present](uint64_t bit)
+                   { return present = (bits[bit >> 3] >> (bit & 7)) & 1; });
+        return present;
+    }
+
+    const UserRecordHeader *recordAt(uint64_t offset) const
+    {
+        return reinterpret_cast<const UserRecordHeader *>(data.data() + offset);
+    }
+
+    // Whether the record at offset lies within this process's mapping, which
+    // lags behind users.db when another process has grown it
+    bool mapped(uint64_t offset) const
+    {
+        return offset + sizeof(UserRecordHeader) <= data.length() && offset + recordAt(offset)->length <= data.length();
+    }
+
+    static const char *recordEmail(const UserRecordHeader *record)
+    {
+        return reinterpret_cast<const char *>(record + 1);
+    }
+
+    // Whether a well-formed record starts at offset and ends by limit
+    bool recordValid(uint64_t offset, uint64_t limit) const
+    {
+        if (offset + sizeof(UserRecordHeader) > limit)
+            return false;
+        const UserRecordHeader *record = recordAt(offset);
+        size_t needed = sizeof(UserRecordHeader) + record->emailLength + record->passwordLength + record->nameLength +
+                        record->roleLength;
+        if (record->length < needed || record->length % 8 || offset + record->length > limit ||
+            (record->kind != UserRecordKind::Upsert && record->kind != UserRecordKind::Tombstone))
+            return false;
+        return crc32(data.data() + offset + 8, record->length - 8) == record->crc;
+    }
+
+    void decode(const UserRecordHeader *record, UserRecord &out) const
+    {
+        const char *field = recordEmail(record);
+        out.email.assign(field, record->emailLength);
+        field += record->emailLength;
+        out.password.assign(field, record->passwordLength);
+        field += record->passwordLength;
+        out.name.assign(field, record->nameLength);
+        field += record->nameLength;
+        out.role = UserRole::None;
+        parseRole(field, record->roleLength, out.role);
+    }
+
+    // Slot holding email, or nullptr; insertAt is set to where it would go
+    UserIndexSlot *probe(const char *email, size_t length, uint64_t hash, UserIndexSlot **insertAt) const
+    {
+        UserIndexSlot *table = slots();
+        uint64_t mask = indexHeader()->slotCount - 1;
+        UserIndexSlot *firstDeleted = nullptr;
+        for (uint64_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            UserIndexSlot &slot = table[i];
+            if (slot.hash == USER_SLOT_EMPTY)
+            {
+                if (insertAt)
+                    *insertAt = firstDeleted ? firstDeleted : &slot;
+                return nullptr;
+            }
+            if (slot.hash == USER_SLOT_DELETED)
+            {
+                if (!firstDeleted)
+                    firstDeleted = &slot;
+                continue;
+            }
+            if (slot.hash == hash && mapped(slot.offset))
+            {
+                const UserRecordHeader *record = recordAt(slot.offset);
+                if (record->emailLength == length && memcmp(recordEmail(record), email, length) == 0)
+                    return &slot;
+            }
+        }
+    }
+
+    // Rebuild the index with slotCount slots in a temp file and swap it in.
+    // With fromRecords the records are read again, into a table big enough
+    // for all of them; otherwise the current slots are carried over.
+    bool rebuildIndex(uint64_t slotCount, bool fromRecords)
+    {
+        std::vector<UserIndexSlot> carried;
+        uint64_t covered = sizeof(UserDataHeader);
+        if (fromRecords)
+        {
+            while (dataHeader()->records * 10 >= slotCount * 7)
+                slotCount *= 2;
+        }
+        else
+        {
+            for (uint64_t i = 0; i < indexHeader()->slotCount; ++i)
+                if (slots()[i].hash > USER_SLOT_DELETED)
+                    carried.push_back(slots()[i]);
+            covered = indexHeader()->covered;
+        }
+        if (index.isOpen())
+        {
+            indexHeader()->covered = 0; // tells other processes to reopen users.idx
+            index.sync(0, sizeof(UserIndexHeader));
+        }
+        index.close();
+
+        std::string tempPath = indexPath + ".tmp";
+        std::remove(tempPath.c_str());
+        bool fresh;
+        if (!index.open(tempPath, indexFileSize(slotCount), fresh))
+            return false;
+        UserIndexHeader *header = indexHeader();
+        memcpy(header->magic, USER_INDEX_MAGIC, sizeof(header->magic));
+        header->version = USER_INDEX_VERSION;
+        header->generation = dataHeader()->generation;
+        header->slotCount = slotCount;
+        header->live = 0;
+        header->deleted = 0;
+        header->covered = covered;
+
+        if (fromRecords)
+        {
+            indexRecords();
+        }
+        else
+        {
+            uint64_t mask = slotCount - 1;
+            for (const UserIndexSlot &slot : carried)
+            {
+                uint64_t i = slot.hash & mask;
+                while (slots()[i].hash != USER_SLOT_EMPTY)
+                    i = (i + 1) & mask;
+                slots()[i] = slot;
+                filterAdd(slot.hash);
+            }
+            header->live = carried.size();
+        }
+
+        bool ok = index.sync(0, index.length());
+        index.close();
+#ifdef _WIN32
+        std::remove(indexPath.c_str()); // rename does not replace on Windows
+#endif
+        ok = ok && std::rename(tempPath.c_str(), indexPath.c_str()) == 0;
+        return index.open(indexPath, 0, fresh) && ok;
+    }
+
+    // Keep the table under 70% full of live and deleted slots
+    bool reserveSlot()
+    {
+        const UserIndexHeader *header = indexHeader();
+        if ((header->live + header->deleted + 1) * 10 <= header->slotCount * 7)
+            return true;
+        uint64_t slotCount = header->slotCount;
+        while ((header->live + 1) * 10 > slotCount * 4)
+            slotCount *= 2;
+        return rebuildIndex(slotCount, false);
+    }
+
+    // Apply the record at offset to the index
+    bool indexRecord(uint64_t offset)
+    {
+        const UserRecordHeader *record = recordAt(offset);
+        const char *email = recordEmail(record);
+        uint64_t hash = userEmailHash(email, record->emailLength);
+        UserIndexSlot *insertAt = nullptr;
+        UserIndexSlot *slot = probe(email, record->emailLength, hash, &insertAt);
+        UserIndexHeader *header = indexHeader();
+        if (record->kind == UserRecordKind::Tombstone)
+        {
+            if (slot)
+            {
+                slot->hash = USER_SLOT_DELETED;
+                header->live--;
+                header->deleted++;
+            }
+        }
+        else if (slot)
+        {
+            slot->offset = offset;
+        }
+        else
+        {
+            if (!reserveSlot())
+                return false;
+            probe(email, record->emailLength, hash, &insertAt);
+            header = indexHeader();
+            if (insertAt->hash == USER_SLOT_DELETED)
+                header->deleted--;
+            insertAt->hash = hash;
+            insertAt->offset = offset;
+            header->live++;
+            filterAdd(hash);
+        }
+        return true;
+    }
+
+    // Index every record between the index's covered mark and the end of
+    // users.db. A record that fails its check ends the data there.
+    bool indexRecords()
+    {
+        UserDataHeader *header = dataHeader();
+        uint64_t offset = indexHeader()->covered;
+        while (offset < header->end)
+        {
+            if (!recordValid(offset, header->end))
+            {
+                header->end = offset;
+                data.sync(0, sizeof(UserDataHeader));
+                break;
+            }
+            uint64_t length = recordAt(offset)->length;
+            if (!indexRecord(offset))
+                return false;
+            offset += length;
+        }
+        indexHeader()->covered = offset;
+        return true;
+    }
+
+    // Grow users.db so that total more bytes fit after its records
+    bool reserveData(size_t total)
+    {
+        uint64_t start = dataHeader()->end;
+        if (start + total <= data.length())
+            return true;
+        size_t size = data.length();
+        while (start + total > size)
+            size *= 2;
+        return data.resize(size);
+    }
+
+    // Publish count records written after the old end, up to newEnd, and
+    // index them: the records and the data header are synced before the
+    // index is touched
+    bool commit(uint64_t newEnd, size_t count)
+    {
+        uint64_t start = dataHeader()->end;
+        if (!data.sync(start, newEnd - start))
+            return false;
+        dataHeader()->end = newEnd;
+        dataHeader()->records += count;
+        if (!data.sync(0, sizeof(UserDataHeader)))
+            return false;
+
+        // A crash from here on leaves records the next open indexes
+        if (!indexRecords())
+            return false;
+        return index.sync(0, index.length());
+    }
+
+    // Map users.db as it is now, writing a header if it is new, and open
+    // users.idx; users.db is locked
+    bool load()
+    {
+        bool fresh;
+        if (!data.mapAtLeast(INITIAL_DATA_SIZE, fresh))
+            return false;
+        UserDataHeader *header = dataHeader();
+        if (fresh)
+        {
+            memcpy(header->magic, USER_DATA_MAGIC, sizeof(header->magic));
+            header->version = USER_STORE_VERSION;
+            header->compactions = 0;
+            header->generation = std::random_device{}() | static_cast<uint64_t>(std::random_device{}()) << 32;
+            header->end = sizeof(UserDataHeader);
+            header->records = 0;
+            data.sync(0, sizeof(UserDataHeader));
+        }
+        if (memcmp(header->magic, USER_DATA_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != USER_STORE_VERSION || header->end < sizeof(UserDataHeader) ||
+            header->end > data.length())
+            return false;
+        return openIndex();
+    }
+
+    // Open users.idx and catch it up, or rebuild it if it does not belong
+    // to this users.db; users.db is locked
+    bool openIndex()
+    {
+        const UserDataHeader *header = dataHeader();
+        bool indexFresh;
+        bool usable = index.open(indexPath, 0, indexFresh) && !indexFresh &&
+                      index.length() >= sizeof(UserIndexHeader);
+        if (usable)
+        {
+            const UserIndexHeader *ih = indexHeader();
+            usable = memcmp(ih->magic, USER_INDEX_MAGIC, sizeof(ih->magic)) == 0 &&
+                     ih->version == USER_INDEX_VERSION && ih->generation == header->generation &&
+                     ih->covered >= sizeof(UserDataHeader) && ih->covered <= header->end && ih->slotCount >= 2 &&
+                     (ih->slotCount & (ih->slotCount - 1)) == 0 &&
+                     index.length() >= indexFileSize(ih->slotCount);
+        }
+        return usable ? indexRecords() && index.sync(0, index.length()) : rebuildIndex(INITIAL_SLOTS, true);
+    }
+
+    // Whether another process has changed the files since this one last
+    // looked: users.db grew past the mapping, users.idx was replaced, or
+    // records have not been indexed yet
+    bool behind() const
+    {
+        return dataHeader()->end > data.length() || indexHeader()->covered != dataHeader()->end;
+    }
+
+    // Lock users.db and catch up with other processes' changes. Unlocked
+    // again if that fails.
+    bool lock()
+    {
+        if (!data.lock())
+            return false;
+        bool ok = true;
+        if (behind())
+        {
+            if (dataHeader()->end > data.length())
+                ok = data.remap() && dataHeader()->end <= data.length();
+            if (ok && indexHeader()->covered < sizeof(UserDataHeader))
+            {
+                index.close();
+                ok = openIndex();
+            }
+            else if (ok)
+            {
+                ok = indexRecords() && index.sync(0, index.length());
+            }
+        }
+        if (!ok)
+            data.unlock();
+        return ok;
+    }
+
+    // Holds users.db's lock for a scope
+    class Exclusive
+    {
+    private:
+        UserStore &store;
+        bool held;
+
+    public:
+        explicit Exclusive(UserStore &owner) : store(owner), held(owner.lock()) {}
+        Exclusive(const Exclusive &) = delete;
+        Exclusive &operator=(const Exclusive &) = delete;
+        ~Exclusive()
+        {
+            if (held && store.data.isOpen())
+                store.data.unlock();
+        }
+
+        explicit operator bool() const { return held; }
+    };
+
+    // Encode records, append them and index them
+    bool append(const std::vector<const UserRecord *> &users, UserRecordKind kind)
+    {
+        if (!isOpen())
+            return false;
+        Exclusive hold(*this);
+        return hold && appendHeld(users, kind);
+    }
+
+    // append() for a caller that holds users.db's lock already
+    bool appendHeld(const std::vector<const UserRecord *> &users, UserRecordKind kind)
+    {
+        size_t total = 0;
+        for (const UserRecord *user : users)
+        {
+            if (user->email.size() > 0xffff || user->password.size() > 0xffff || user->name.size() > 0xffff)
+                return false;
+            total += padded(sizeof(UserRecordHeader) + user->email.size() + user->password.size() + user->name.size() +
+                            strlen(roleName(user->role)));
+        }
+
+        if (!reserveData(total))
+            return false;
+
+        uint64_t offset = dataHeader()->end;
+        for (const UserRecord *user : users)
+        {
+            UserRecordHeader *record = reinterpret_cast<UserRecordHeader *>(data.data() + offset);
+            const char *role = roleName(user->role);
+            size_t roleLength = strlen(role);
+            size_t fields = user->email.size() + user->password.size() + user->name.size() + roleLength;
+            record->length = static_cast<uint32_t>(padded(sizeof(UserRecordHeader) + fields));
+            record->kind = kind;
+            record->roleLength = static_cast<uint8_t>(roleLength);
+            record->emailLength = static_cast<uint16_t>(user->email.size());
+            record->passwordLength = static_cast<uint16_t>(user->password.size());
+            record->nameLength = static_cast<uint16_t>(user->name.size());
+            char *field = reinterpret_cast<char *>(record + 1);
+            for (const std::string *part : {&user->email, &user->password, &user->name})
+            {
+                memcpy(field, part->data(), part->size());
+                field += part->size();
+            }
+            memcpy(field, role, roleLength);
+            field += roleLength;
+            memset(field, 0, record->length - sizeof(UserRecordHeader) - fields);
+            record->crc = crc32(data.data() + offset + 8, record->length - 8);
+            offset += record->length;
+        }
+        if (!commit(offset, users.size()))
+            return false;
+        maybeCompact();
+        return true;
+    }
+
+    // Append records already encoded, from this or another users.db
+    bool appendCopies(const std::vector<const UserRecordHeader *> &records)
+    {
+        if (!isOpen())
+            return false;
+        Exclusive hold(*this);
+        if (!hold)
+            return false;
+        size_t total = 0;
+        for (const UserRecordHeader *record : records)
+            total += record->length;
+        if (!reserveData(total))
+            return false;
+        uint64_t offset = dataHeader()->end;
+        for (const UserRecordHeader *record : records)
+        {
+            memcpy(data.data() + offset, record, record->length);
+            offset += record->length;
+        }
+        return commit(offset, records.size());
+    }
+
+    // Copy the live records listed in live, which are offsets into source
+    // below end, into a new store at target. Runs on the compaction thread,
+    // reading source through its own mapping: records before end are never
+    // written again, so the store can keep appending meanwhile.
+    static bool writeCompacted(const std::string &source, uint64_t end, const std::vector<uint64_t> &live,
+                               uint32_t compactions, const std::string &target, const std::string &targetIndex)
+    {
+        std::remove(target.c_str());
+        std::remove(targetIndex.c_str());
+        MappedTextFile from;
+        UserStore to;
+        if (!from.open(source) || from.length() < end || !to.openFiles(target, targetIndex))
+            return false;
+        uint64_t slotCount = INITIAL_SLOTS;
+        while (live.size() * 10 >= slotCount * 7)
+            slotCount *= 2;
+        if (!to.rebuildIndex(slotCount, false))
+            return false;
+
+        std::vector<const UserRecordHeader *> records;
+        records.reserve(live.size());
+        for (uint64_t offset : live)
+            records.push_back(reinterpret_cast<const UserRecordHeader *>(from.data() + offset));
+        to.dataHeader()->compactions = compactions;
+        bool ok = records.empty() ? to.data.sync(0, sizeof(UserDataHeader)) : to.appendCopies(records);
+        to.close();
+        return ok;
+    }
+
+    // Start copying the live records on the compaction thread, if no other
+    // process has the store open
+    bool startCompaction()
+    {
+        if (compactionResult || !isOpen())
+            return false;
+        if (!inUse.tryExclusive())
+        {
+            compactionRetryAt = recordCount() + COMPACTION_MIN_RECORDS;
+            return false;
+        }
+        auto live = std::make_shared<std::vector<uint64_t>>();
+        live->reserve(size());
+        for (uint64_t i = 0; i < indexHeader()->slotCount; ++i)
+            if (slots()[i].hash > USER_SLOT_DELETED)
+                live->push_back(slots()[i].offset);
+        std::sort(live->begin(), live->end()); // keep file order, and read the source front to back
+
+        compactedEnd = dataHeader()->end;
+        compactionResult = std::make_shared<bool>(false);
+        auto result = compactionResult;
+        std::string source = dataPath;
+        uint64_t end = compactedEnd;
+        uint32_t compactions = dataHeader()->compactions + 1;
+        std::string target = dataPath + ".compact";
+        std::string targetIndex = indexPath + ".compact";
+        return compactor.start([=]
+                               { *result = writeCompacted(source, end, *live, compactions, target, targetIndex); });
+    }
+
+    // Swap in a finished compaction: records appended since it started are
+    // copied to the new users.db, which is then renamed over the old one
+    // along with its index. If the job failed the old files stay in use.
+    // Either way other processes may open the store again.
+    bool finishCompaction(bool wait)
+    {
+        if (!compactionResult || (!wait && compactor.isBusy()))
+            return true;
+        compactor.wait();
+        bool ok = *compactionResult && isOpen();
+        compactionResult.reset();
+        std::string target = dataPath + ".compact";
+        std::string targetIndex = indexPath + ".compact";
+        if (ok)
+        {
+            UserStore to;
+            std::vector<const UserRecordHeader *> appended;
+            for (uint64_t offset = compactedEnd; offset < dataHeader()->end; offset += recordAt(offset)->length)
+                appended.push_back(recordAt(offset));
+            ok = to.openFiles(target, targetIndex) && (appended.empty() || to.appendCopies(appended));
+        }
+        if (ok)
+        {
+            data.close();
+            index.close();
+#ifdef _WIN32
+            std::remove(dataPath.c_str()); // rename does not replace on Windows
+#endif
+            ok = std::rename(target.c_str(), dataPath.c_str()) == 0;
+            if (ok)
+            {
+#ifdef _WIN32
+                std::remove(indexPath.c_str());
+#endif
+                std::rename(targetIndex.c_str(), indexPath.c_str()); // otherwise rebuilt by open
+            }
+            bool reopened = openFiles(dataPath, indexPath);
+            ok = ok && reopened;
+        }
+        if (!ok)
+        {
+            std::remove(target.c_str());
+            std::remove(targetIndex.c_str());
+            compactionRetryAt = recordCount() + COMPACTION_MIN_RECORDS;
+        }
+        inUse.share();
+        return ok;
+    }
+
+    // Open or create the two files without users.db.lock, as the compaction
+    // does for the new ones
+    bool openFiles(const std::string &dataFile, const std::string &indexFile)
+    {
+        dataPath = dataFile;
+        indexPath = indexFile;
+        // The header is only written once the file is locked, so two
+        // programs starting on a new store do not both set it up
+        bool ok = data.openFile(dataPath) && data.lock();
+        ok = ok && load();
+        if (data.isOpen())
+            data.unlock();
+        if (!ok)
+        {
+            data.close();
+            index.close();
+        }
+        return ok;
+    }
+
+    // Install a finished compaction, or start one if dead records outnumber live ones
+    void maybeCompact()
+    {
+        finishCompaction(false);
+        uint64_t records = recordCount();
+        if (!compactionResult && records >= COMPACTION_MIN_RECORDS && records >= compactionRetryAt &&
+            records - size() > size())
+            startCompaction();
+    }
+
+public:
+    UserStore() : compactedEnd(0), compactionRetryAt(0) {}
+    UserStore(const UserStore &) = delete;
+    UserStore &operator=(const UserStore &) = delete;
+    ~UserStore() { close(); }
+
+    // Open or create the store; the index is caught up or rebuilt as needed.
+    // Waits while another process is compacting it.
+    bool open(const std::string &dataFile, const std::string &indexFile)
+    {
+        close();
+        if (!inUse.open(dataFile + ".lock") || !openFiles(dataFile, indexFile))
+        {
+            close();
+            return false;
+        }
+        maybeCompact();
+        return true;
+    }
+
+    // Close the files, installing a compaction that is still running first
+    void close()
+    {
+        finishCompaction(true);
+        data.close();
+        index.close();
+        inUse.close();
+    }
+
+    bool isOpen() const { return data.isOpen() && index.isOpen(); }
+
+    size_t size() const { return isOpen() ? indexHeader()->live : 0; }
+
+    // Records in users.db, replaced and removed users included
+    uint64_t recordCount() const { return isOpen() ? dataHeader()->records : 0; }
+
+    // How many times users.db has been compacted; with recordCount() == 0, a new store
+    uint32_t compactionCount() const { return isOpen() ? dataHeader()->compactions : 0; }
+
+    bool isCompacting() const { return compactionResult != nullptr; }
+
+    // Compact now and wait for it, whatever the share of dead records; false
+    // if another process has the store open
+    bool compact()
+    {
+        return finishCompaction(true) && startCompaction() && finishCompaction(true);
+    }
+
+    // Catch up with changes other programs have made to the store. find,
+    // put, insert and erase do this first; contains and forEach do not, so that
+    // several threads can call them at once.
+    bool refresh()
+    {
+        if (!isOpen())
+            return false;
+        if (!behind())
+            return true;
+        Exclusive hold(*this);
+        return static_cast<bool>(hold);
+    }
+
+    bool find(const std::string &email, UserRecord &out)
+    {
+        if (!refresh())
+            return false;
+        uint64_t hash = userEmailHash(email.data(), email.size());
+        const UserIndexSlot *slot = filterMayContain(hash) ? probe(email.data(), email.size(), hash, nullptr) : nullptr;
+        if (!slot)
+            return false;
+        decode(recordAt(slot->offset), out);
+        return true;
+    }
+
+    // Whether an account uses email, as of the last refresh; most unknown
+    // emails are ruled out by the filter alone
+    bool contains(const std::string &email) const
+    {
+        if (!isOpen())
+            return false;
+        uint64_t hash = userEmailHash(email.data(), email.size());
+        return filterMayContain(hash) && probe(email.data(), email.size(), hash, nullptr);
+    }
+
+    // Whether the filter lets email through to the index; for measuring it
+    bool mayContain(const std::string &email) const
+    {
+        return isOpen() && filterMayContain(userEmailHash(email.data(), email.size()));
+    }
+
+    // Add or replace a user
+    bool put(const UserRecord &user) { return append({&user}, UserRecordKind::Upsert); }
+
+    // Add or replace many users with one sync of each file
+    bool putMany(const std::vector<UserRecord> &users)
+    {
+        std::vector<const UserRecord *> pointers;
+        pointers.reserve(users.size());
+        for (const UserRecord &user : users)
+            pointers.push_back(&user);
+        return pointers.empty() || append(pointers, UserRecordKind::Upsert);
+    }
+
+    // Add a user only if no account has the email yet. The check is made
+    // under users.db's lock after catching up with other programs, so an
+    // account registered anywhere between an earlier contains() and this
+    // call is never replaced.
+    UserInsert insert(const UserRecord &user)
+    {
+        if (!isOpen())
+            return UserInsert::Failed;
+        Exclusive hold(*this);
+        if (!hold)
+            return UserInsert::Failed;
+        if (contains(user.email))
+            return UserInsert::Exists;
+        return appendHeld({&user}, UserRecordKind::Upsert) ? UserInsert::Added : UserInsert::Failed;
+    }
+
+    // Remove a user; false if there was none
+    bool erase(const std::string &email)
+    {
+        if (!isOpen())
+            return false;
+        Exclusive hold(*this);
+        if (!hold || !contains(email))
+            return false;
+        UserRecord tombstone;
+        tombstone.email = email;
+        return appendHeld({&tombstone}, UserRecordKind::Tombstone);
+    }
+
+    // Visit every live user as of the last refresh, in no particular order
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        if (!isOpen())
+            return;
+        UserRecord user;
+        for (uint64_t i = 0; i < indexHeader()->slotCount; ++i)
+            if (slots()[i].hash > USER_SLOT_DELETED && mapped(slots()[i].offset))
+            {
+                decode(recordAt(slots()[i].offset), user);
+                visit(user);
+            }
+    }
+};
+
+const char USER_DATA_FILE[] = "users.db";
+const char USER_INDEX_FILE[] = "users.idx";
+const char USER_TEXT_FILE[] = "users.txt"; // the old format, imported once
+
+// Open the user store. A store that has never been written to is filled
+// from users.txt, and imported says what that load found.
+inline bool openUserStore(UserStore &store, UserFileLoad &imported)
+{
+    if (!store.open(USER_DATA_FILE, USER_INDEX_FILE))
+        return false;
+    if (store.recordCount() != 0 || store.compactionCount() != 0)
+        return true;
+    UserMap users;
+    imported = loadUserFile(USER_TEXT_FILE, users);
+    std::vector<UserRecord> records;
+    records.reserve(users.size());
+    for (auto &user : users)
+        records.push_back(std::move(user.second));
+    return store.putMany(records);
+}
+
+#endif
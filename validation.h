@@ -0,0 +1,180 @@
+// Email and password validation without std::regex
+//
+// Each rule is a small deterministic automaton whose transition table is
+// built by constexpr functions, so it exists at compile time and checking
+// a string is one table lookup per character. The static_asserts at the
+// bottom run the automata inside the compiler.
+//
+// Email:    [a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\.[a-zA-Z]{2,}
+// Password: at least 8 characters, at least one digit, no line breaks
+
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+template <size_t States, size_t Classes>
+struct Dfa
+{
+    uint8_t classOf[256];            // character -> input class
+    uint8_t next[States][Classes];   // state x class -> state
+    bool accepting[States];
+    uint8_t start;
+
+    constexpr bool matches(const char *text, size_t length) const
+    {
+        uint8_t state = start;
+        for (size_t i = 0; i < length; ++i)
+            state = next[state][classOf[static_cast<unsigned char>(text[i])]];
+        return accepting[state];
+    }
+
+    bool matches(const std::string &text) const { return matches(text.data(), text.size()); }
+};
+
+constexpr size_t literalLength(const char *text)
+{
+    size_t length = 0;
+    while (text[length])
+        length++;
+    return length;
+}
+
+// ---- Email ----
+
+enum EmailClass : uint8_t
+{
+    EmailOther, // not allowed anywhere
+    EmailLetter,
+    EmailDigit,
+    EmailDot,
+    EmailHyphen,
+    EmailLocalOnly, // _ % + are allowed before the @ only
+    EmailAt,
+    EmailClassCount
+};
+
+// States: the local part, then the domain read as X.T where T is the
+// letters after the last dot. A dot may turn out to be part of X, so the
+// automaton keeps track of the latest candidate separator.
+enum EmailState : uint8_t
+{
+    EmailReject,
+    EmailStart,
+    EmailLocal,      // one or more local-part characters
+    EmailAfterAt,    // '@' seen, domain empty
+    EmailDomain,     // X non-empty, last character not a candidate separator
+    EmailDot1,       // X non-empty, then '.'
+    EmailTld1,       // ... then one letter
+    EmailTld2,       // ... then two or more letters (accepting)
+    EmailStateCount
+};
+
+constexpr Dfa<EmailStateCount, EmailClassCount> buildEmailDfa()
+{
+    Dfa<EmailStateCount, EmailClassCount> dfa{};
+    for (int c = 0; c < 256; ++c)
+    {
+        EmailClass cls = EmailOther;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            cls = EmailLetter;
+        else if (c >= '0' && c <= '9')
+            cls = EmailDigit;
+        else if (c == '.')
+            cls = EmailDot;
+        else if (c == '-')
+            cls = EmailHyphen;
+        else if (c == '_' || c == '%' || c == '+')
+            cls = EmailLocalOnly;
+        else if (c == '@')
+            cls = EmailAt;
+        dfa.classOf[c] = cls;
+    }
+
+    // Everything not set below goes to EmailReject (0)
+    for (EmailState s : {EmailStart, EmailLocal})
+        for (EmailClass c : {EmailLetter, EmailDigit, EmailDot, EmailHyphen, EmailLocalOnly})
+            dfa.next[s][c] = EmailLocal;
+    dfa.next[EmailLocal][EmailAt] = EmailAfterAt;
+
+    for (EmailClass c : {EmailLetter, EmailDigit, EmailDot, EmailHyphen})
+        dfa.next[EmailAfterAt][c] = EmailDomain;
+    for (EmailState s : {EmailDomain, EmailDot1, EmailTld1, EmailTld2})
+    {
+        dfa.next[s][EmailDigit] = EmailDomain;
+        dfa.next[s][EmailHyphen] = EmailDomain;
+        dfa.next[s][EmailDot] = EmailDot1;
+    }
+    dfa.next[EmailDomain][EmailLetter] = EmailDomain;
+    dfa.next[EmailDot1][EmailLetter] = EmailTld1;
+    dfa.next[EmailTld1][EmailLetter] = EmailTld2;
+    dfa.next[EmailTld2][EmailLetter] = EmailTld2;
+
+    dfa.accepting[EmailTld2] = true;
+    dfa.start = EmailStart;
+    return dfa;
+}
+
+constexpr Dfa<EmailStateCount, EmailClassCount> EMAIL_DFA = buildEmailDfa();
+
+// ---- Password ----
+
+const size_t PASSWORD_MIN_LENGTH = 8;
+
+enum PasswordClass : uint8_t
+{
+    PasswordOther,
+    PasswordDigit,
+    PasswordLineBreak, // '.' in the old pattern never matched these
+    PasswordClassCount
+};
+
+// State = min(length, 8) * 2 + (digit seen), plus a reject state at the end
+const size_t PASSWORD_STATES = (PASSWORD_MIN_LENGTH + 1) * 2 + 1;
+const uint8_t PASSWORD_REJECT = PASSWORD_STATES - 1;
+
+constexpr Dfa<PASSWORD_STATES, PasswordClassCount> buildPasswordDfa()
+{
+    Dfa<PASSWORD_STATES, PasswordClassCount> dfa{};
+    for (int c = 0; c < 256; ++c)
+        dfa.classOf[c] = c >= '0' && c <= '9' ? PasswordDigit : (c == '\n' || c == '\r') ? PasswordLineBreak
+                                                                                            : PasswordOther;
+    for (size_t length = 0; length <= PASSWORD_MIN_LENGTH; ++length)
+        for (size_t digit = 0; digit < 2; ++digit)
+        {
+            size_t state = length * 2 + digit;
+            size_t longer = length < PASSWORD_MIN_LENGTH ? length + 1 : length;
+            dfa.next[state][PasswordOther] = static_cast<uint8_t>(longer * 2 + digit);
+            dfa.next[state][PasswordDigit] = static_cast<uint8_t>(longer * 2 + 1);
+            dfa.next[state][PasswordLineBreak] = PASSWORD_REJECT;
+        }
+    for (size_t c = 0; c < PasswordClassCount; ++c)
+        dfa.next[PASSWORD_REJECT][c] = PASSWORD_REJECT;
+    dfa.accepting[PASSWORD_MIN_LENGTH * 2 + 1] = true;
+    dfa.start = 0;
+    return dfa;
+}
+
+constexpr Dfa<PASSWORD_STATES, PasswordClassCount> PASSWORD_DFA = buildPasswordDfa();
+
+inline bool isValidEmail(const std::string &email) { return EMAIL_DFA.matches(email); }
+
+// At least 8 characters and at least one digit
+inline bool isValidPassword(const std::string &password) { return PASSWORD_DFA.matches(password); }
+
+static_assert(EMAIL_DFA.matches("user@giki.edu.pk", literalLength("user@giki.edu.pk")), "plain address");
+static_assert(EMAIL_DFA.matches("a.b+c@Mail-1.COM", literalLength("a.b+c@Mail-1.COM")), "upper-case domain");
+static_assert(EMAIL_DFA.matches("x@..io", literalLength("x@..io")), "dots in the domain as the pattern allows");
+static_assert(!EMAIL_DFA.matches("user@giki.c", literalLength("user@giki.c")), "one-letter top-level domain");
+static_assert(!EMAIL_DFA.matches("user@.com", literalLength("user@.com")), "empty domain name");
+static_assert(!EMAIL_DFA.matches("user@giki.pk1", literalLength("user@giki.pk1")), "digit in top-level domain");
+static_assert(!EMAIL_DFA.matches("us er@giki.pk", literalLength("us er@giki.pk")), "space");
+static_assert(!EMAIL_DFA.matches("a@b@c.pk", literalLength("a@b@c.pk")), "two @");
+static_assert(PASSWORD_DFA.matches("abcdefg1", 8), "eight with a digit");
+static_assert(!PASSWORD_DFA.matches("abcdefgh", 8), "no digit");
+static_assert(!PASSWORD_DFA.matches("abcdef1", 7), "too short");
+static_assert(!PASSWORD_DFA.matches("abcdefg1\n", 9), "line break");
+
+#endif
@@ -0,0 +1,233 @@
+// Per-flight waitlists for bookings that could not get seats
+//
+// Each flight keeps a 4-ary min-heap ordered by priority class, then by
+// request sequence, so the most senior request of the best class is always
+// on top. A 4-ary heap is shallower than a binary one, which keeps pops
+// cheap when a mass cancellation promotes many requests at once.
+
+#ifndef WAITLIST_H
+#define WAITLIST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <utility>
+
+struct WaitlistEntry
+{
+    int waitID;
+    int flightID;
+    int priorityClass; // 1 = highest
+    uint64_t sequence; // request order
+    std::vector<std::string> passengerNames;
+
+    int seats() const { return static_cast<int>(passengerNames.size()); }
+};
+
+// d-ary min-heap over a vector; Less decides which element comes out first
+template <typename T, typename Less, int D = 4>
+class DaryHeap
+{
+private:
+    std::vector<T> items;
+    Less less;
+
+    void siftUp(size_t i)
+    {
+        while (i > 0)
+        {
+            size_t parent = (i - 1) / D;
+            if (!less(items[i], items[parent]))
+                break;
+            std::swap(items[i], items[parent]);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i)
+    {
+        while (true)
+        {
+            size_t best = i;
+            size_t first = D * i + 1;
+            for (size_t c = first; c < first + D && c < items.size(); ++c)
+            {
+                if (less(items[c], items[best]))
+                    best = c;
+            }
+            if (best == i)
+                return;
+            std::swap(items[i], items[best]);
+            i = best;
+        }
+    }
+
+public:
+    bool empty() const { return items.empty(); }
+
+    size_t size() const { return items.size(); }
+
+    const T &top() const { return items.front(); }
+
+    void push(T item)
+    {
+        items.push_back(std::move(item));
+        siftUp(items.size() - 1);
+    }
+
+    T pop()
+    {
+        T item = std::move(items.front());
+        items.front() = std::move(items.back());
+        items.pop_back();
+        if (!items.empty())
+            siftDown(0);
+        return item;
+    }
+
+    const std::vector<T> &contents() const { return items; }
+};
+
+struct WaitlistOrder
+{
+    bool operator()(const WaitlistEntry &a, const WaitlistEntry &b) const
+    {
+        return a.priorityClass != b.priorityClass ? a.priorityClass < b.priorityClass : a.sequence < b.sequence;
+    }
+};
+
+class Waitlist
+{
+private:
+    std::unordered_map<int, DaryHeap<WaitlistEntry, WaitlistOrder>> flights;
+    std::unordered_map<int, int> flightOf;   // waitID -> flight, for every entry inside a heap
+    std::unordered_map<int, size_t> live;    // per flight, entries in its heap not withdrawn
+    std::unordered_set<int> withdrawn;       // removed entries still inside a heap
+    int nextWaitID;
+    uint64_t nextSequence;
+
+    void queue(const WaitlistEntry &entry)
+    {
+        flights[entry.flightID].push(entry);
+        flightOf[entry.waitID] = entry.flightID;
+        live[entry.flightID]++;
+    }
+
+    // Drop withdrawn entries sitting on top of a heap
+    void skipWithdrawn(DaryHeap<WaitlistEntry, WaitlistOrder> &heap)
+    {
+        while (!heap.empty() && withdrawn.count(heap.top().waitID))
+        {
+            withdrawn.erase(heap.top().waitID);
+            flightOf.erase(heap.top().waitID);
+            heap.pop();
+        }
+    }
+
+public:
+    Waitlist() : nextWaitID(1), nextSequence(1) {}
+
+    // Queue a request and return it with its ID and sequence filled in
+    WaitlistEntry add(int flightID, int priorityClass, const std::vector<std::string> &passengerNames)
+    {
+        WaitlistEntry entry{nextWaitID++, flightID, priorityClass, nextSequence++, passengerNames};
+        queue(entry);
+        return entry;
+    }
+
+    // Re-queue an entry exactly as logged (replay and snapshot load)
+    void restore(const WaitlistEntry &entry)
+    {
+        if (entry.waitID >= nextWaitID)
+            nextWaitID = entry.waitID + 1;
+        if (entry.sequence >= nextSequence)
+            nextSequence = entry.sequence + 1;
+        queue(entry);
+    }
+
+    // Lazily remove an entry; it is discarded when it reaches the top.
+    // IDs no longer waiting are ignored.
+    void withdraw(int waitID)
+    {
+        auto found = flightOf.find(waitID);
+        if (found != flightOf.end() && withdrawn.insert(waitID).second)
+            live[found->second]--;
+    }
+
+    // Drop a flight's whole waitlist
+    void clearFlight(int flightID)
+    {
+        auto it = flights.find(flightID);
+        if (it == flights.end())
+            return;
+        for (const WaitlistEntry &entry : it->second.contents())
+        {
+            withdrawn.erase(entry.waitID);
+            flightOf.erase(entry.waitID);
+        }
+        flights.erase(it);
+        live.erase(flightID);
+    }
+
+    // Pop, in priority order, every request that fits into freeSeats.
+    // Stops at the first request that does not fit so nobody is overtaken.
+    std::vector<WaitlistEntry> promote(int flightID, int freeSeats)
+    {
+        std::vector<WaitlistEntry> promoted;
+        auto it = flights.find(flightID);
+        if (it == flights.end())
+            return promoted;
+
+        DaryHeap<WaitlistEntry, WaitlistOrder> &heap = it->second;
+        skipWithdrawn(heap);
+        while (!heap.empty() && heap.top().seats() <= freeSeats)
+        {
+            freeSeats -= heap.top().seats();
+            promoted.push_back(heap.pop());
+            flightOf.erase(promoted.back().waitID);
+            live[flightID]--;
+            skipWithdrawn(heap);
+        }
+        if (heap.empty())
+        {
+            flights.erase(it);
+            live.erase(flightID);
+        }
+        return promoted;
+    }
+
+    // Every waiting entry (for snapshots and display), in no particular order
+    void forEach(const std::function<void(const WaitlistEntry &)> &visit) const
+    {
+        for (const auto &flight : flights)
+        {
+            for (const WaitlistEntry &entry : flight.second.contents())
+            {
+                if (!withdrawn.count(entry.waitID))
+                    visit(entry);
+            }
+        }
+    }
+
+    // Requests still waiting on a flight, withdrawn ones not counted
+    size_t waiting(int flightID) const
+    {
+        auto it = live.find(flightID);
+        return it == live.end() ? 0 : it->second;
+    }
+
+    void clear()
+    {
+        flights.clear();
+        flightOf.clear();
+        live.clear();
+        withdrawn.clear();
+        nextWaitID = 1;
+        nextSequence = 1;
+    }
+};
+
+#endif
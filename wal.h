@@ -0,0 +1,598 @@
+// Write-ahead log for bookings, payments and flight changes
+//
+// File layout: an 8 byte header ("GKWAL" + 3 digit version) followed by records of
+//   u32 payload length | u32 crc32 | u64 lsn | u8 type | payload
+// The crc covers lsn, type and payload. Replay stops at the first torn or
+// corrupt record, so a crash in the middle of a write loses only that record.
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <cstdint>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Current version of the log and snapshot formats. Version 1 stored money
+// as doubles; readers still accept it and convert on load.
+const uint32_t WAL_FORMAT_VERSION = 2;
+
+// Kinds of events stored in the log
+enum class WalRecordType : uint8_t
+{
+    FlightAdd = 1,
+    FlightUpdate = 2,
+    FlightRemove = 3,
+    Book = 4,
+    Cancel = 5,
+    Pay = 6,
+    Archive = 7, // a flight's bookings moved to the history file
+    WaitlistAdd = 8,
+    WaitlistPromote = 9
+};
+
+// How long commit() waits before returning
+//   None        - written to the OS, no fsync (fast, lost on power failure)
+//   GroupCommit - one fsync covers every record appended in the same window
+//   Sync        - every commit pays for its own fsync
+enum class Durability
+{
+    None,
+    GroupCommit,
+    Sync
+};
+
+// CRC-32 (IEEE polynomial), slicing-by-8 so large snapshots verify at
+// memory speed rather than one table lookup per byte
+inline uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0)
+{
+    // std::array has no destructor, so the table outlives background threads at exit
+    static const std::array<uint32_t, 8 * 256> table = []
+    {
+        std::array<uint32_t, 8 * 256> t{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int slice = 1; slice < 8; ++slice)
+                t[slice * 256 + i] = (t[(slice - 1) * 256 + i] >> 8) ^ t[t[(slice - 1) * 256 + i] & 0xFF];
+        return t;
+    }();
+    const uint32_t *t = table.data();
+
+    crc = ~crc;
+    while (length >= 8)
+    {
+        uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24);
+        uint32_t hi = data[4] | data[5] << 8 | data[6] << 16 | static_cast<uint32_t>(data[7]) << 24;
+        crc = t[7 * 256 + (lo & 0xFF)] ^ t[6 * 256 + ((lo >> 8) & 0xFF)] ^
+              t[5 * 256 + ((lo >> 16) & 0xFF)] ^ t[4 * 256 + (lo >> 24)] ^
+              t[3 * 256 + (hi & 0xFF)] ^ t[2 * 256 + ((hi >> 8) & 0xFF)] ^
+              t[1 * 256 + ((hi >> 16) & 0xFF)] ^ t[hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length--)
+        crc = t[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Little-endian payload builder
+class WalBuffer
+{
+public:
+    std::vector<uint8_t> bytes;
+
+    void putU8(uint8_t v) { bytes.push_back(v); }
+
+    void putU32(uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void putU64(uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void putI32(int32_t v) { putU32(static_cast<uint32_t>(v)); }
+
+    void putI64(int64_t v) { putU64(static_cast<uint64_t>(v)); }
+
+    void putDouble(double v)
+    {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        putU64(bits);
+    }
+
+    void putString(const std::string &s)
+    {
+        putU32(static_cast<uint32_t>(s.size()));
+        bytes.insert(bytes.end(), s.begin(), s.end());
+    }
+};
+
+// Bounds-checked reader over a payload; ok() turns false on overrun
+class WalCursor
+{
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool valid;
+    uint32_t version; // format version of the file the bytes came from
+
+    bool need(size_t n)
+    {
+        if (!valid || size - pos < n)
+        {
+            valid = false;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    WalCursor(const uint8_t *d, size_t n, uint32_t formatVersion = WAL_FORMAT_VERSION)
+        : data(d), size(n), pos(0), valid(true), version(formatVersion) {}
+
+    bool ok() const { return valid; }
+
+    uint32_t formatVersion() const { return version; }
+
+    size_t remaining() const { return valid ? size - pos : 0; }
+
+    uint8_t getU8()
+    {
+        if (!need(1))
+            return 0;
+        return data[pos++];
+    }
+
+    uint32_t getU32()
+    {
+        if (!need(4))
+            return 0;
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i)
+            v |= static_cast<uint32_t>(data[pos++]) << (8 * i);
+        return v;
+    }
+
+    uint64_t getU64()
+    {
+        if (!need(8))
+            return 0;
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i)
+            v |= static_cast<uint64_t>(data[pos++]) << (8 * i);
+        return v;
+    }
+
+    int32_t getI32() { return static_cast<int32_t>(getU32()); }
+
+    int64_t getI64() { return static_cast<int64_t>(getU64()); }
+
+    double getDouble()
+    {
+        uint64_t bits = getU64();
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    std::string getString()
+    {
+        uint32_t n = getU32();
+        if (!need(n))
+            return std::string();
+        std::string s(reinterpret_cast<const char *>(data + pos), n);
+        pos += n;
+        return s;
+    }
+};
+
+// Flush stdio buffers and force the file contents to stable storage
+inline bool syncFile(FILE *file)
+{
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Shrink an open file to length bytes
+inline bool truncateFile(FILE *file, long length)
+{
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), length) == 0;
+#else
+    return ftruncate(fileno(file), length) == 0;
+#endif
+}
+
+class WriteAheadLog
+{
+private:
+    static constexpr char MAGIC[8] = {'G', 'K', 'W', 'A', 'L', '0', '0', '2'};
+    static constexpr uint32_t MAX_PAYLOAD = 16u << 20; // larger lengths mean a corrupt header
+
+    FILE *file;
+    std::string logPath;
+    Durability durability;
+    std::chrono::microseconds groupWindow;
+
+    std::mutex mtx;
+    std::condition_variable workAvailable;
+    std::condition_variable flushed;
+    std::vector<uint8_t> pending; // encoded records not yet handed to the OS
+    uint64_t nextLSN;
+    uint64_t appendedLSN; // highest LSN placed in pending
+    uint64_t durableLSN;  // highest LSN known to be on disk
+    bool stopping;
+    bool failed;
+    std::thread flusher;
+
+    // Background thread: collects everything appended during one window and
+    // covers it with a single write + fsync
+    void flushLoop()
+    {
+        std::vector<uint8_t> batch;
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            workAvailable.wait(lock, [this]
+                               { return stopping || !pending.empty(); });
+            if (pending.empty() && stopping)
+                break;
+
+            // Let other sessions join this group before paying for the fsync
+            if (groupWindow.count() > 0 && !stopping)
+            {
+                lock.unlock();
+                std::this_thread::sleep_for(groupWindow);
+                lock.lock();
+            }
+
+            batch.swap(pending);
+            uint64_t batchLSN = appendedLSN;
+            lock.unlock();
+
+            bool ok = fwrite(batch.data(), 1, batch.size(), file) == batch.size();
+            if (ok && durability != Durability::None)
+                ok = syncFile(file);
+            else if (ok)
+                ok = fflush(file) == 0;
+            batch.clear();
+
+            lock.lock();
+            if (ok)
+                durableLSN = batchLSN;
+            else
+                failed = true;
+            flushed.notify_all();
+        }
+    }
+
+    void encode(std::vector<uint8_t> &out, uint64_t lsn, WalRecordType type, const WalBuffer &payload)
+    {
+        WalBuffer body;
+        body.putU64(lsn);
+        body.putU8(static_cast<uint8_t>(type));
+        body.bytes.insert(body.bytes.end(), payload.bytes.begin(), payload.bytes.end());
+
+        WalBuffer header;
+        header.putU32(static_cast<uint32_t>(payload.bytes.size()));
+        header.putU32(crc32(body.bytes.data(), body.bytes.size()));
+
+        out.insert(out.end(), header.bytes.begin(), header.bytes.end());
+        out.insert(out.end(), body.bytes.begin(), body.bytes.end());
+    }
+
+    // Read the file header; 0 if it is not a log this code understands.
+    // Older versions differ only in how payloads are encoded.
+    static uint32_t readVersion(FILE *in)
+    {
+        char magic[sizeof(MAGIC)];
+        if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, MAGIC, 5) != 0 ||
+            magic[5] != '0' || magic[6] != '0' || magic[7] < '1' || magic[7] > MAGIC[7])
+            return 0;
+        return static_cast<uint32_t>(magic[7] - '0');
+    }
+
+public:
+    WriteAheadLog()
+        : file(nullptr), durability(Durability::GroupCommit), groupWindow(200),
+          nextLSN(1), appendedLSN(0), durableLSN(0), stopping(false), failed(false) {}
+
+    ~WriteAheadLog() { close(); }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // Scan a log file, calling apply() for every intact record in order.
+    // Returns the highest LSN seen and sets validBytes to the end of the last
+    // intact record so a torn tail can be cut off before appending.
+    static uint64_t replay(const std::string &path,
+                           const std::function<void(uint64_t, WalRecordType, WalCursor &)> &apply,
+                           long *validBytes = nullptr)
+    {
+        if (validBytes)
+            *validBytes = 0;
+
+        FILE *in = fopen(path.c_str(), "rb");
+        if (!in)
+            return 0;
+
+        uint32_t version = readVersion(in);
+        if (version == 0)
+        {
+            fclose(in);
+            return 0;
+        }
+
+        long good = sizeof(MAGIC);
+        uint64_t lastLSN = 0;
+        uint8_t header[8];
+        std::vector<uint8_t> body;
+        while (fread(header, 1, sizeof(header), in) == sizeof(header))
+        {
+            WalCursor h(header, sizeof(header));
+            uint32_t length = h.getU32();
+            uint32_t crc = h.getU32();
+            if (length > MAX_PAYLOAD)
+                break;
+
+            body.resize(8 + 1 + static_cast<size_t>(length));
+            if (fread(body.data(), 1, body.size(), in) != body.size())
+                break;
+            if (crc32(body.data(), body.size()) != crc)
+                break;
+
+            WalCursor meta(body.data(), 9);
+            uint64_t lsn = meta.getU64();
+            WalRecordType type = static_cast<WalRecordType>(meta.getU8());
+
+            WalCursor payload(body.data() + 9, length, version);
+            apply(lsn, type, payload);
+
+            lastLSN = lsn;
+            good += static_cast<long>(sizeof(header) + body.size());
+        }
+
+        fclose(in);
+        if (validBytes)
+            *validBytes = good;
+        return lastLSN;
+    }
+
+    // Format version of an existing log file, 0 if missing or unreadable
+    static uint32_t fileVersion(const std::string &path)
+    {
+        FILE *in = fopen(path.c_str(), "rb");
+        if (!in)
+            return 0;
+        uint32_t version = readVersion(in);
+        fclose(in);
+        return version;
+    }
+
+    // Whether path holds no log yet: missing, empty, or only the start of a
+    // header torn by a crash while the file was being created
+    static bool isBlank(const std::string &path)
+    {
+        FILE *in = fopen(path.c_str(), "rb");
+        if (!in)
+            return true;
+        char head[sizeof(MAGIC)];
+        size_t n = fread(head, 1, sizeof(head), in);
+        fclose(in);
+        return n < sizeof(MAGIC) && memcmp(head, MAGIC, n) == 0;
+    }
+
+    // Open (or create) the log for appending. startLSN and validBytes are the
+    // values returned by replay(); pass validBytes < 0 to have them computed.
+    // Fails, leaving the file alone, if it is not blank and its header is not
+    // one this code reads: it may come from a newer version or be damaged,
+    // and starting it afresh would throw away every record in it.
+    bool open(const std::string &path, Durability level, uint64_t startLSN = 0, long validBytes = -1)
+    {
+        close();
+
+        if (validBytes < 0)
+            startLSN = replay(path, [](uint64_t, WalRecordType, WalCursor &) {}, &validBytes);
+
+        logPath = path;
+        durability = level;
+        nextLSN = startLSN + 1;
+        appendedLSN = durableLSN = startLSN;
+        stopping = failed = false;
+
+        if (validBytes >= static_cast<long>(sizeof(MAGIC)))
+        {
+            // Cut off a torn tail so new records follow the last intact one
+            file = fopen(path.c_str(), "r+b");
+            if (file && (!truncateFile(file, validBytes) || fseek(file, 0, SEEK_END) != 0))
+            {
+                fclose(file);
+                file = nullptr;
+            }
+        }
+        else
+        {
+            if (!isBlank(path))
+                return false;
+            file = fopen(path.c_str(), "wb");
+            if (file && fwrite(MAGIC, 1, sizeof(MAGIC), file) != sizeof(MAGIC))
+            {
+                fclose(file);
+                file = nullptr;
+            }
+        }
+
+        if (!file || !syncFile(file))
+            return false;
+
+        if (durability == Durability::GroupCommit)
+            flusher = std::thread(&WriteAheadLog::flushLoop, this);
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Move everything logged so far to archivePath and continue in a fresh
+    // file. Used at checkpoints: once a snapshot covering the archived
+    // records is on disk the archive can be deleted. Refuses while an
+    // earlier archive is still there, since no snapshot covers its records
+    // yet and replacing it would lose them.
+    bool rotate(const std::string &archivePath)
+    {
+        if (!file)
+            return false;
+        if (FILE *previous = fopen(archivePath.c_str(), "rb"))
+        {
+            fclose(previous);
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (durability == Durability::GroupCommit)
+        {
+            flushed.wait(lock, [this]
+                         { return failed || (pending.empty() && durableLSN == appendedLSN); });
+        }
+        else if (!pending.empty())
+        {
+            failed = failed || fwrite(pending.data(), 1, pending.size(), file) != pending.size();
+            pending.clear();
+            if (!failed)
+                durableLSN = appendedLSN;
+        }
+        if (failed || !syncFile(file))
+            return false;
+
+        // The flusher is idle while we hold the lock with nothing pending
+        fclose(file);
+        bool ok = std::rename(logPath.c_str(), archivePath.c_str()) == 0;
+        file = fopen(logPath.c_str(), ok ? "wb" : "ab");
+        if (!file)
+        {
+            failed = true;
+            return false;
+        }
+        if (ok && (fwrite(MAGIC, 1, sizeof(MAGIC), file) != sizeof(MAGIC) || !syncFile(file)))
+            failed = true;
+        return ok && !failed;
+    }
+
+    void setGroupWindow(std::chrono::microseconds window) { groupWindow = window; }
+
+    // Queue a record and return its LSN without waiting for the disk
+    uint64_t append(WalRecordType type, const WalBuffer &payload)
+    {
+        if (!file)
+            return 0;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        uint64_t lsn = nextLSN++;
+        encode(pending, lsn, type, payload);
+        appendedLSN = lsn;
+
+        if (durability == Durability::GroupCommit)
+            workAvailable.notify_one();
+        return lsn;
+    }
+
+    // Block until every record up to lsn is as durable as the chosen level
+    // promises. Returns false if the log could not be written.
+    bool waitDurable(uint64_t lsn)
+    {
+        if (!file)
+            return false;
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (durability == Durability::GroupCommit)
+        {
+            flushed.wait(lock, [this, lsn]
+                         { return failed || durableLSN >= lsn; });
+            return !failed;
+        }
+
+        // None and Sync write inline under the lock
+        if (durableLSN < lsn && !pending.empty())
+        {
+            bool ok = fwrite(pending.data(), 1, pending.size(), file) == pending.size();
+            ok = ok && (durability == Durability::Sync ? syncFile(file) : fflush(file) == 0);
+            pending.clear();
+            if (ok)
+                durableLSN = appendedLSN;
+            else
+                failed = true;
+        }
+        return !failed;
+    }
+
+    // Append and wait: the record survives a crash once this returns true
+    bool commit(WalRecordType type, const WalBuffer &payload)
+    {
+        uint64_t lsn = append(type, payload);
+        return lsn != 0 && waitDurable(lsn);
+    }
+
+    uint64_t lastLSN()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return appendedLSN;
+    }
+
+    void close()
+    {
+        if (flusher.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stopping = true;
+            }
+            workAvailable.notify_one();
+            flusher.join();
+        }
+        if (file)
+        {
+            if (!pending.empty())
+            {
+                fwrite(pending.data(), 1, pending.size(), file);
+                pending.clear();
+            }
+            syncFile(file);
+            fclose(file);
+            file = nullptr;
+        }
+    }
+};
+
+#endif